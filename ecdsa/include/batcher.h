@@ -0,0 +1,82 @@
+#ifndef A2L_ECDSA_INCLUDE_BATCHER
+#define A2L_ECDSA_INCLUDE_BATCHER
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "relic/relic.h"
+#include "types.h"
+
+#define BATCHER_WINDOW 200 // default, in microseconds
+
+// Checks every entry at once, RLC_OK only if all of them are valid.
+typedef int (*batch_verify_t)(void **entries, size_t n);
+// Checks a single entry, used alone and once a batch fails.
+typedef int (*single_verify_t)(void *entry);
+
+struct batcher_ticket;
+
+// Verifications submitted by concurrent threads are collected into batches.
+// The first thread to submit to an empty batch leads it: it waits until the
+// batch is full or the window has passed, verifies it and wakes the others.
+// It also stops waiting once the batch holds a check from every busy thread,
+// so a check submitted while no other thread is busy is verified right away.
+typedef struct {
+  struct batcher_ticket **pending;
+  size_t capacity;
+  size_t size;
+  long window;
+  const atomic_size_t *busy; // threads that may submit, NULL to wait out the window
+  int collecting;
+  batch_verify_t verify_batch;
+  single_verify_t verify_one;
+  pthread_mutex_t lock;
+  pthread_cond_t filled;
+  pthread_cond_t not_full;
+  pthread_cond_t done;
+} batcher_st;
+
+typedef batcher_st *batcher_t;
+
+#define batcher_null(batcher) batcher = NULL;
+
+#define batcher_new(batcher, batch_capacity, batch_window, busy_threads,      \
+                    batch_function, single_function)                          \
+  do {                                                                        \
+    batcher = malloc(sizeof(batcher_st));                                     \
+    if (batcher == NULL) {                                                    \
+      RLC_THROW(ERR_NO_MEMORY);                                               \
+    }                                                                         \
+    (batcher)->capacity = batch_capacity;                                     \
+    (batcher)->size = 0;                                                      \
+    (batcher)->window = batch_window;                                         \
+    (batcher)->busy = busy_threads;                                           \
+    (batcher)->collecting = 0;                                                \
+    (batcher)->verify_batch = batch_function;                                 \
+    (batcher)->verify_one = single_function;                                  \
+    (batcher)->pending = calloc((batcher)->capacity,                          \
+                                sizeof(struct batcher_ticket *));             \
+    if ((batcher)->pending == NULL) {                                         \
+      RLC_THROW(ERR_NO_MEMORY);                                               \
+    }                                                                         \
+    pthread_mutex_init(&(batcher)->lock, NULL);                               \
+    pthread_cond_init(&(batcher)->filled, NULL);                              \
+    pthread_cond_init(&(batcher)->not_full, NULL);                            \
+    pthread_cond_init(&(batcher)->done, NULL);                                \
+  } while (0)
+
+#define batcher_free(batcher)                                                 \
+  do {                                                                        \
+    free((batcher)->pending);                                                 \
+    pthread_mutex_destroy(&(batcher)->lock);                                  \
+    pthread_cond_destroy(&(batcher)->filled);                                 \
+    pthread_cond_destroy(&(batcher)->not_full);                               \
+    pthread_cond_destroy(&(batcher)->done);                                   \
+    free(batcher);                                                            \
+    batcher = NULL;                                                           \
+  } while (0)
+
+int batcher_submit(batcher_t batcher, void *entry);
+
+#endif // A2L_ECDSA_INCLUDE_BATCHER
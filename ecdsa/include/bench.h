@@ -0,0 +1,160 @@
+#ifndef A2L_ECDSA_INCLUDE_BENCH
+#define A2L_ECDSA_INCLUDE_BENCH
+
+#include <stddef.h>
+#include <stdint.h>
+#include "relic/relic.h"
+#include "cl_pow_pool.h"
+#include "cl_reservoir.h"
+#include "types.h"
+#include "util.h"
+
+// Iterations per benchmark, scaled to the cost of the operation.
+#define BENCH_FAST_ITERATIONS 100000 // conversions and serialization
+#define BENCH_ITERATIONS 1000 // elliptic curve and pairing operations
+#define BENCH_SLOW_ITERATIONS 100 // class group operations
+#define BENCH_CLDL_BATCH 16 // proofs per batch verification
+#define BENCH_SIGNATURE_BATCH 64 // signatures per batch verification
+
+typedef struct {
+  cl_params_t cl_params;
+  cl_secret_key_t cl_sk;
+  cl_public_key_t cl_pk;
+  ec_secret_key_t ec_sk;
+  ec_public_key_t ec_pk;
+  ps_secret_key_t ps_sk;
+  ps_public_key_t ps_pk;
+  bn_t alpha;
+  bn_t tau;
+  bn_t tid;
+  bn_t scratch;
+  ec_t g_to_the_alpha;
+  ec_t u;
+  ec_t v;
+  GEN plain_alpha;
+  GEN plain_tau;
+  cl_ciphertext_t ctx_alpha;
+  cl_ciphertext_t scratch_ctx;
+  cl_randomness_st randomness;
+  cl_reservoir_t reservoir;
+  cl_pow_pool_t pow_pool;
+  zk_proof_cldl_t pi_cldl;
+  zk_proof_cldl_t scratch_cldl;
+  zk_proof_t pi_dlog;
+  zk_proof_t pi_dhtuple;
+  zk_proof_t scratch_zk_proof;
+  ecdsa_signature_t sigma_hat;
+  ecdsa_signature_t scratch_sigma_hat;
+  pedersen_com_t pcom;
+  pedersen_com_t scratch_pcom;
+  pedersen_decom_t pdecom;
+  pedersen_decom_t scratch_pdecom;
+  pedersen_com_zk_proof_t com_zk_proof;
+  pedersen_com_zk_proof_t scratch_com_zk_proof;
+  ps_signature_t sigma_tid;
+  ps_signature_t scratch_sigma;
+  uint8_t session_id[RLC_SESSION_ID_SIZE];
+  unsigned msg_data_length;
+  uint8_t *msg_data;
+  zmq_msg_t msg;
+  uint8_t serialized_ctx[2 * RLC_CL_CIPHERTEXT_SIZE];
+} bench_state_st;
+
+typedef bench_state_st *bench_state_t;
+
+#define bench_state_null(state) state = NULL;
+
+#define bench_state_new(state)                                  \
+  do {                                                          \
+    state = malloc(sizeof(bench_state_st));                     \
+    if (state == NULL) {                                        \
+      RLC_THROW(ERR_NO_MEMORY);                                 \
+    }                                                           \
+    cl_params_new((state)->cl_params);                          \
+    cl_secret_key_new((state)->cl_sk);                          \
+    cl_public_key_new((state)->cl_pk);                          \
+    ec_secret_key_new((state)->ec_sk);                          \
+    ec_public_key_new((state)->ec_pk);                          \
+    ps_secret_key_new((state)->ps_sk);                          \
+    ps_public_key_new((state)->ps_pk);                          \
+    bn_new((state)->alpha);                                     \
+    bn_new((state)->tau);                                       \
+    bn_new((state)->tid);                                       \
+    bn_new((state)->scratch);                                   \
+    ec_new((state)->g_to_the_alpha);                            \
+    ec_new((state)->u);                                         \
+    ec_new((state)->v);                                         \
+    cl_ciphertext_new((state)->ctx_alpha);                      \
+    cl_ciphertext_new((state)->scratch_ctx);                    \
+    cl_reservoir_new((state)->reservoir, 1, 0);                 \
+    cl_pow_pool_new((state)->pow_pool);                         \
+    zk_proof_cldl_new((state)->pi_cldl);                        \
+    zk_proof_cldl_new((state)->scratch_cldl);                   \
+    zk_proof_new((state)->pi_dlog);                             \
+    zk_proof_new((state)->pi_dhtuple);                          \
+    zk_proof_new((state)->scratch_zk_proof);                    \
+    ecdsa_signature_new((state)->sigma_hat);                  \
+    ecdsa_signature_new((state)->scratch_sigma_hat);          \
+    pedersen_com_new((state)->pcom);                            \
+    pedersen_com_new((state)->scratch_pcom);                    \
+    pedersen_decom_new((state)->pdecom);                        \
+    pedersen_decom_new((state)->scratch_pdecom);                \
+    pedersen_com_zk_proof_new((state)->com_zk_proof);           \
+    pedersen_com_zk_proof_new((state)->scratch_com_zk_proof);   \
+    ps_signature_new((state)->sigma_tid);                       \
+    ps_signature_new((state)->scratch_sigma);                   \
+    (state)->msg_data = NULL;                                   \
+    zmq_msg_init(&(state)->msg);                                \
+  } while (0)
+
+#define bench_state_free(state)                                 \
+  do {                                                          \
+    cl_params_free((state)->cl_params);                         \
+    cl_secret_key_free((state)->cl_sk);                         \
+    cl_public_key_free((state)->cl_pk);                         \
+    ec_secret_key_free((state)->ec_sk);                         \
+    ec_public_key_free((state)->ec_pk);                         \
+    ps_secret_key_free((state)->ps_sk);                         \
+    ps_public_key_free((state)->ps_pk);                         \
+    bn_free((state)->alpha);                                    \
+    bn_free((state)->tau);                                      \
+    bn_free((state)->tid);                                      \
+    bn_free((state)->scratch);                                  \
+    ec_free((state)->g_to_the_alpha);                           \
+    ec_free((state)->u);                                        \
+    ec_free((state)->v);                                        \
+    cl_ciphertext_free((state)->ctx_alpha);                     \
+    cl_ciphertext_free((state)->scratch_ctx);                   \
+    cl_reservoir_free((state)->reservoir);                      \
+    cl_pow_pool_free((state)->pow_pool);                        \
+    zk_proof_cldl_free((state)->pi_cldl);                       \
+    zk_proof_cldl_free((state)->scratch_cldl);                  \
+    zk_proof_free((state)->pi_dlog);                            \
+    zk_proof_free((state)->pi_dhtuple);                         \
+    zk_proof_free((state)->scratch_zk_proof);                   \
+    ecdsa_signature_free((state)->sigma_hat);                 \
+    ecdsa_signature_free((state)->scratch_sigma_hat);         \
+    pedersen_com_free((state)->pcom);                           \
+    pedersen_com_free((state)->scratch_pcom);                   \
+    pedersen_decom_free((state)->pdecom);                       \
+    pedersen_decom_free((state)->scratch_pdecom);               \
+    pedersen_com_zk_proof_free((state)->com_zk_proof);          \
+    pedersen_com_zk_proof_free((state)->scratch_com_zk_proof);  \
+    ps_signature_free((state)->sigma_tid);                      \
+    ps_signature_free((state)->scratch_sigma);                  \
+    free((state)->msg_data);                                    \
+    zmq_msg_close(&(state)->msg);                               \
+    free(state);                                                \
+    state = NULL;                                               \
+  } while (0)
+
+typedef struct {
+  const char *name;
+  int (*run)(bench_state_t state);
+  size_t iterations;
+} bench_t;
+
+int bench_setup(bench_state_t state);
+int bench_run(const bench_t *bench, bench_state_t state);
+
+#endif // A2L_ECDSA_INCLUDE_BENCH
@@ -0,0 +1,86 @@
+#ifndef A2L_ECDSA_INCLUDE_CL_POW_POOL
+#define A2L_ECDSA_INCLUDE_CL_POW_POOL
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "relic/relic.h"
+#include "pari/pari.h"
+#include "types.h"
+#include "util.h"
+
+#define CL_POW_POOL_THREADS 1 // besides the caller, which does one half itself
+#define CL_POW_POOL_QUEUE 8
+
+// An exponentiation handed to a pool thread, in its wire encoding since PARI
+// objects do not cross threads. Exponents are blinding factors, below q.
+typedef struct {
+  uint8_t base[RLC_CL_QFI_SIZE];
+  uint8_t exponent[RLC_CL_INT_HEADER_SIZE + RLC_BN_SIZE];
+  uint8_t result[RLC_CL_QFI_SIZE];
+  int status;
+  int done;
+} cl_pow_job_st;
+
+// Threads that take one of the two exponentiations of a re-randomisation off
+// the caller. The bases change every session, so unlike g_q and the public key
+// they have no fixed-base tables, and splitting the pair is what is left.
+typedef struct {
+  cl_params_t params;
+  pthread_t threads[CL_POW_POOL_THREADS];
+  struct pari_thread pari_threads[CL_POW_POOL_THREADS];
+  size_t started;
+  size_t attached;
+  cl_pow_job_st *queue[CL_POW_POOL_QUEUE];
+  size_t head;
+  size_t size;
+  int closed;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  pthread_cond_t done;
+} cl_pow_pool_st;
+
+typedef cl_pow_pool_st *cl_pow_pool_t;
+
+#define cl_pow_pool_null(pool) pool = NULL;
+
+#define cl_pow_pool_new(pool)                                               \
+  do {                                                                      \
+    pool = malloc(sizeof(cl_pow_pool_st));                                  \
+    if (pool == NULL) {                                                     \
+      RLC_THROW(ERR_NO_MEMORY);                                             \
+    }                                                                       \
+    (pool)->params = NULL;                                                  \
+    (pool)->started = 0;                                                    \
+    (pool)->attached = 0;                                                   \
+    (pool)->head = 0;                                                       \
+    (pool)->size = 0;                                                       \
+    (pool)->closed = 0;                                                     \
+    pthread_mutex_init(&(pool)->lock, NULL);                                \
+    pthread_cond_init(&(pool)->wake, NULL);                                 \
+    pthread_cond_init(&(pool)->done, NULL);                                 \
+  } while (0)
+
+#define cl_pow_pool_free(pool)                                              \
+  do {                                                                      \
+    cl_pow_pool_stop(pool);                                                 \
+    pthread_mutex_destroy(&(pool)->lock);                                   \
+    pthread_cond_destroy(&(pool)->wake);                                    \
+    pthread_cond_destroy(&(pool)->done);                                    \
+    free(pool);                                                             \
+    pool = NULL;                                                            \
+  } while (0)
+
+int cl_pow_pool_start(cl_pow_pool_t pool, const cl_params_t params);
+void cl_pow_pool_stop(cl_pow_pool_t pool);
+int cl_pow_pool_submit(cl_pow_pool_t pool, cl_pow_job_st *job);
+int cl_pow_pool_wait(cl_pow_pool_t pool, cl_pow_job_st *job);
+
+int cl_blinding_factor_sample(bn_t factor, bn_t inverse, const cl_params_t params);
+int cl_ciphertext_pow(cl_ciphertext_t result,
+                      const cl_ciphertext_t ciphertext,
+                      const bn_t exponent,
+                      cl_pow_pool_t pool,
+                      const cl_params_t params);
+
+#endif // A2L_ECDSA_INCLUDE_CL_POW_POOL
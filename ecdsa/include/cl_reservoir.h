@@ -0,0 +1,94 @@
+#ifndef A2L_ECDSA_INCLUDE_CL_RESERVOIR
+#define A2L_ECDSA_INCLUDE_CL_RESERVOIR
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "relic/relic.h"
+#include "types.h"
+#include "util.h"
+
+#define CL_RESERVOIR_CAPACITY 512
+#define CL_RESERVOIR_LOW_WATERMARK 128
+
+// Encryption randomness for a fixed CL public key, in its wire encoding: r and
+// the two powers cl_enc() would otherwise compute online. r < bound fits the
+// slot of the largest exponent.
+typedef struct {
+  uint8_t r[RLC_CL_INT_HEADER_SIZE + RLC_CEIL(CL_EXPONENT_BITS, 8)];
+  uint8_t g_q_to_the_r[RLC_CL_QFI_SIZE];
+  uint8_t pk_to_the_r[RLC_CL_QFI_SIZE];
+} cl_randomness_st;
+
+typedef struct {
+  size_t size;
+  uint64_t produced;
+  uint64_t taken;
+  uint64_t misses;  // takes that found the reservoir empty
+  uint64_t refills; // times the refiller woke up at the low watermark
+} cl_reservoir_stats_st;
+
+// A reservoir of encryption randomness. Once full, the refiller sleeps until
+// the consumers drain it to the low watermark and then tops it up in one
+// burst, so it is not woken for every entry taken.
+typedef struct {
+  cl_randomness_st *entries;
+  size_t capacity;
+  size_t low_watermark;
+  size_t head;
+  size_t size;
+  int closed;
+  cl_reservoir_stats_st stats;
+  pthread_mutex_t lock;
+  pthread_cond_t drained;
+} cl_reservoir_st;
+
+typedef cl_reservoir_st *cl_reservoir_t;
+
+#define cl_reservoir_null(reservoir) reservoir = NULL;
+
+#define cl_reservoir_new(reservoir, reservoir_capacity, reservoir_low_watermark)     \
+  do {                                                                               \
+    reservoir = malloc(sizeof(cl_reservoir_st));                                     \
+    if (reservoir == NULL) {                                                         \
+      RLC_THROW(ERR_NO_MEMORY);                                                      \
+    }                                                                                \
+    (reservoir)->capacity = reservoir_capacity;                                      \
+    (reservoir)->low_watermark = reservoir_low_watermark;                            \
+    (reservoir)->head = 0;                                                           \
+    (reservoir)->size = 0;                                                           \
+    (reservoir)->closed = 0;                                                         \
+    memset(&(reservoir)->stats, 0, sizeof(cl_reservoir_stats_st));                   \
+    (reservoir)->entries = calloc((reservoir)->capacity, sizeof(cl_randomness_st));  \
+    if ((reservoir)->entries == NULL) {                                              \
+      RLC_THROW(ERR_NO_MEMORY);                                                      \
+    }                                                                                \
+    pthread_mutex_init(&(reservoir)->lock, NULL);                                    \
+    pthread_cond_init(&(reservoir)->drained, NULL);                                  \
+  } while (0)
+
+#define cl_reservoir_free(reservoir)                                                 \
+  do {                                                                               \
+    memzero((reservoir)->entries, (reservoir)->capacity * sizeof(cl_randomness_st)); \
+    free((reservoir)->entries);                                                      \
+    pthread_mutex_destroy(&(reservoir)->lock);                                       \
+    pthread_cond_destroy(&(reservoir)->drained);                                     \
+    free(reservoir);                                                                 \
+    reservoir = NULL;                                                                \
+  } while (0)
+
+int cl_reservoir_put(cl_reservoir_t reservoir, const cl_randomness_st *entry);
+int cl_reservoir_take(cl_reservoir_t reservoir, cl_randomness_st *entry);
+void cl_reservoir_close(cl_reservoir_t reservoir);
+void cl_reservoir_stats(cl_reservoir_t reservoir, cl_reservoir_stats_st *stats);
+
+int cl_randomness_generate(cl_randomness_st *entry,
+                           const cl_public_key_t public_key,
+                           const cl_params_t params);
+int cl_enc_from_reservoir(cl_ciphertext_t ciphertext,
+                          const GEN plaintext,
+                          cl_reservoir_t reservoir,
+                          const cl_public_key_t public_key,
+                          const cl_params_t params);
+
+#endif // A2L_ECDSA_INCLUDE_CL_RESERVOIR
@@ -0,0 +1,72 @@
+#ifndef A2L_ECDSA_INCLUDE_KEYSTORE
+#define A2L_ECDSA_INCLUDE_KEYSTORE
+
+#include <stddef.h>
+#include <stdint.h>
+#include "relic/relic.h"
+#include "types.h"
+
+#define KEYSTORE_MAGIC "A2LKEYS"
+#define KEYSTORE_VERSION 1
+#define KEYSTORE_HEADER_SIZE 64 // in bytes
+#define KEYSTORE_ALIGNMENT 64 // of every entry, in bytes
+#define KEYSTORE_MAX_ENTRIES 16
+
+// What an entry holds. The values are part of the file format.
+typedef enum {
+  KEYSTORE_EC_SK = 1,
+  KEYSTORE_EC_PK,
+  KEYSTORE_CL_SK,
+  KEYSTORE_CL_PK,
+  KEYSTORE_CL_PK_TABLE,
+  KEYSTORE_PS_SK_X_1,
+  KEYSTORE_PS_PK_Y_1,
+  KEYSTORE_PS_PK_X_2,
+  KEYSTORE_PS_PK_Y_2,
+  KEYSTORE_G_Q_TABLE,
+  KEYSTORE_CL_LEVEL, // 4 bytes, little-endian, absent means 128
+} keystore_tag_t;
+
+typedef struct {
+  uint32_t tag;
+  const uint8_t *data;
+  size_t length;
+} keystore_entry_st;
+
+// A key file mapped read-only. It starts with a header (magic, version, entry
+// count, file size and a checksum of everything after the header) and a
+// directory of tagged entries, whose data follows at aligned offsets. Entries
+// are stored the way they go on the wire, so the parties read them in place.
+typedef struct {
+  uint8_t *map;
+  size_t size;
+} keystore_st;
+
+typedef keystore_st *keystore_t;
+
+#define keystore_null(store) store = NULL;
+
+#define keystore_new(store)                                                 \
+  do {                                                                      \
+    store = malloc(sizeof(keystore_st));                                    \
+    if (store == NULL) {                                                    \
+      RLC_THROW(ERR_NO_MEMORY);                                             \
+    }                                                                       \
+    (store)->map = NULL;                                                    \
+    (store)->size = 0;                                                      \
+  } while (0)
+
+#define keystore_free(store)                                                \
+  do {                                                                      \
+    keystore_close(store);                                                  \
+    free(store);                                                            \
+    store = NULL;                                                           \
+  } while (0)
+
+int keystore_probe(const char *path);
+int keystore_open(keystore_t store, const char *path);
+void keystore_close(keystore_t store);
+const uint8_t *keystore_get(const keystore_t store, uint32_t tag, size_t *length);
+int keystore_write(const char *path, const keystore_entry_st *entries, size_t count);
+
+#endif // A2L_ECDSA_INCLUDE_KEYSTORE
@@ -0,0 +1,68 @@
+#ifndef A2L_ECDSA_INCLUDE_PUZZLE_POOL
+#define A2L_ECDSA_INCLUDE_PUZZLE_POOL
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "relic/relic.h"
+#include "types.h"
+#include "util.h"
+
+#define PUZZLE_POOL_CAPACITY 256
+
+// A promise puzzle in its wire encoding. Puzzles are produced and consumed by
+// different threads, so they never hold PARI objects.
+typedef struct {
+  uint8_t alpha[RLC_BN_SIZE];
+  uint8_t g_to_the_alpha[RLC_EC_SIZE_COMPRESSED];
+  uint8_t ctx_alpha[2 * RLC_CL_CIPHERTEXT_SIZE];
+  uint8_t pi_cldl[RLC_CLDL_PROOF_SIZE];
+} puzzle_st;
+
+typedef struct {
+  puzzle_st *puzzles;
+  size_t capacity;
+  size_t head;
+  size_t size;
+  int closed;
+  pthread_mutex_t lock;
+  pthread_cond_t not_full;
+} puzzle_pool_st;
+
+typedef puzzle_pool_st *puzzle_pool_t;
+
+#define puzzle_pool_null(pool) pool = NULL;
+
+#define puzzle_pool_new(pool, pool_capacity)                            \
+  do {                                                                  \
+    pool = malloc(sizeof(puzzle_pool_st));                              \
+    if (pool == NULL) {                                                 \
+      RLC_THROW(ERR_NO_MEMORY);                                         \
+    }                                                                   \
+    (pool)->capacity = pool_capacity;                                   \
+    (pool)->head = 0;                                                   \
+    (pool)->size = 0;                                                   \
+    (pool)->closed = 0;                                                 \
+    (pool)->puzzles = calloc((pool)->capacity, sizeof(puzzle_st));      \
+    if ((pool)->puzzles == NULL) {                                      \
+      RLC_THROW(ERR_NO_MEMORY);                                         \
+    }                                                                   \
+    pthread_mutex_init(&(pool)->lock, NULL);                            \
+    pthread_cond_init(&(pool)->not_full, NULL);                         \
+  } while (0)
+
+#define puzzle_pool_free(pool)                                          \
+  do {                                                                  \
+    memzero((pool)->puzzles, (pool)->capacity * sizeof(puzzle_st));     \
+    free((pool)->puzzles);                                              \
+    pthread_mutex_destroy(&(pool)->lock);                               \
+    pthread_cond_destroy(&(pool)->not_full);                            \
+    free(pool);                                                         \
+    pool = NULL;                                                        \
+  } while (0)
+
+int puzzle_pool_put(puzzle_pool_t pool, const puzzle_st *puzzle);
+int puzzle_pool_take(puzzle_pool_t pool, puzzle_st *puzzle);
+void puzzle_pool_close(puzzle_pool_t pool);
+
+#endif // A2L_ECDSA_INCLUDE_PUZZLE_POOL
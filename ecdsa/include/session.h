@@ -0,0 +1,63 @@
+#ifndef A2L_ECDSA_INCLUDE_SESSION
+#define A2L_ECDSA_INCLUDE_SESSION
+
+#include <stddef.h>
+#include <stdint.h>
+#include "relic/relic.h"
+#include "types.h"
+
+#define SESSION_TABLE_INITIAL_CAPACITY 1024
+#define SESSION_TIMEOUT 3600 // in seconds
+
+typedef void (*session_data_free_t)(void *);
+
+typedef struct {
+  uint8_t id[RLC_SESSION_ID_SIZE];
+  void *data;
+  long long expiry;
+} session_entry_st;
+
+typedef struct {
+  session_entry_st *entries;
+  size_t capacity;
+  size_t size;
+  uint64_t key[2];
+  session_data_free_t data_free;
+} session_table_st;
+
+typedef session_table_st *session_table_t;
+
+#define session_table_null(table) table = NULL;
+
+#define session_table_new(table, free_function)                             \
+  do {                                                                      \
+    table = malloc(sizeof(session_table_st));                               \
+    if (table == NULL) {                                                    \
+      RLC_THROW(ERR_NO_MEMORY);                                             \
+    }                                                                       \
+    (table)->capacity = SESSION_TABLE_INITIAL_CAPACITY;                     \
+    (table)->size = 0;                                                      \
+    (table)->data_free = free_function;                                     \
+    (table)->entries = calloc((table)->capacity, sizeof(session_entry_st)); \
+    if ((table)->entries == NULL) {                                         \
+      RLC_THROW(ERR_NO_MEMORY);                                             \
+    }                                                                       \
+    rand_bytes((uint8_t *) (table)->key, sizeof((table)->key));             \
+  } while (0)
+
+#define session_table_free(table)                                           \
+  do {                                                                      \
+    session_table_clear(table);                                             \
+    free((table)->entries);                                                 \
+    free(table);                                                            \
+    table = NULL;                                                           \
+  } while (0)
+
+void *session_get(const session_table_t table, const uint8_t *id);
+int session_put(session_table_t table, const uint8_t *id, void *data);
+int session_put_until(session_table_t table, const uint8_t *id, void *data, long long expiry);
+void *session_remove(session_table_t table, const uint8_t *id);
+size_t session_expire(session_table_t table, long long now);
+void session_table_clear(session_table_t table);
+
+#endif // A2L_ECDSA_INCLUDE_SESSION
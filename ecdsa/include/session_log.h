@@ -0,0 +1,94 @@
+#ifndef A2L_ECDSA_INCLUDE_SESSION_LOG
+#define A2L_ECDSA_INCLUDE_SESSION_LOG
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "relic/relic.h"
+#include "session.h"
+#include "types.h"
+#include "util.h"
+
+#define SESSION_LOG_SEGMENTS 2
+#define SESSION_LOG_BUFFER_ENTRIES 256
+
+// An entry is the session identifier, the time it was written, the record and
+// a checksum that marks where a torn write begins.
+#define SESSION_LOG_ENTRY_SIZE(record_size)                                 \
+  (RLC_SESSION_ID_SIZE + sizeof(int64_t) + (record_size) + sizeof(uint64_t))
+
+// Called on open for every record younger than SESSION_TIMEOUT, along with the
+// time it was written.
+typedef int (*session_log_replay_t)(void *arg, const uint8_t *id, long long written, const uint8_t *record);
+
+// A write-ahead log of session records with group commit. The first thread to
+// find no flush in progress writes out everything buffered so far and syncs
+// once, the threads that appended meanwhile wait for it. Entries go to two
+// segment files in turn: once the active one has been written for
+// SESSION_TIMEOUT, every entry in the other has expired and it is truncated
+// and reused, which is all the checkpointing the log needs.
+typedef struct {
+  int fd[SESSION_LOG_SEGMENTS];
+  int active;
+  long long rotated;
+  size_t record_size;
+  size_t entry_size;
+  uint8_t *buffer;
+  uint8_t *spare; // written out by the flush in progress
+  size_t buffered;
+  uint64_t appended;
+  uint64_t durable;
+  int flushing;
+  int failed;
+  pthread_mutex_t lock;
+  pthread_cond_t flushed;
+} session_log_st;
+
+typedef session_log_st *session_log_t;
+
+#define session_log_null(wal) wal = NULL;
+
+#define session_log_new(wal, size_of_record)                                \
+  do {                                                                      \
+    wal = malloc(sizeof(session_log_st));                                   \
+    if (wal == NULL) {                                                      \
+      RLC_THROW(ERR_NO_MEMORY);                                             \
+    }                                                                       \
+    for (int i = 0; i < SESSION_LOG_SEGMENTS; i++) {                        \
+      (wal)->fd[i] = -1;                                                    \
+    }                                                                       \
+    (wal)->active = 0;                                                      \
+    (wal)->rotated = 0;                                                     \
+    (wal)->record_size = size_of_record;                                    \
+    (wal)->entry_size = SESSION_LOG_ENTRY_SIZE(size_of_record);             \
+    (wal)->buffered = 0;                                                    \
+    (wal)->appended = 0;                                                    \
+    (wal)->durable = 0;                                                     \
+    (wal)->flushing = 0;                                                    \
+    (wal)->failed = 0;                                                      \
+    (wal)->buffer = malloc(SESSION_LOG_BUFFER_ENTRIES * (wal)->entry_size); \
+    (wal)->spare = malloc(SESSION_LOG_BUFFER_ENTRIES * (wal)->entry_size);  \
+    if ((wal)->buffer == NULL || (wal)->spare == NULL) {                    \
+      RLC_THROW(ERR_NO_MEMORY);                                             \
+    }                                                                       \
+    pthread_mutex_init(&(wal)->lock, NULL);                                 \
+    pthread_cond_init(&(wal)->flushed, NULL);                               \
+  } while (0)
+
+#define session_log_free(wal)                                               \
+  do {                                                                      \
+    session_log_close(wal);                                                 \
+    memzero((wal)->buffer, SESSION_LOG_BUFFER_ENTRIES * (wal)->entry_size); \
+    free((wal)->buffer);                                                    \
+    free((wal)->spare);                                                     \
+    pthread_mutex_destroy(&(wal)->lock);                                    \
+    pthread_cond_destroy(&(wal)->flushed);                                  \
+    free(wal);                                                              \
+    wal = NULL;                                                             \
+  } while (0)
+
+int session_log_open(session_log_t wal, const char *path, session_log_replay_t replay, void *arg);
+void session_log_close(session_log_t wal);
+int session_log_append(session_log_t wal, const uint8_t *id, const uint8_t *record);
+
+#endif // A2L_ECDSA_INCLUDE_SESSION_LOG
@@ -1,32 +1,86 @@
 #ifndef A2L_ECDSA_INCLUDE_TUMBLER
 #define A2L_ECDSA_INCLUDE_TUMBLER
 
+#include <pthread.h>
 #include <stddef.h>
 #include <string.h>
 #include "relic/relic.h"
 #include "zmq.h"
+#include "batcher.h"
+#include "cl_reservoir.h"
+#include "puzzle_pool.h"
+#include "session.h"
+#include "session_log.h"
+#include "spent_tokens.h"
 #include "types.h"
+#include "util.h"
 
 #define TUMBLER_ENDPOINT  "tcp://*:8181"
-
-typedef enum {
-  REGISTRATION,
-  PROMISE_INIT,
-  PAYMENT_INIT,
-} msgcode_t;
+#define TUMBLER_WORKERS_ENDPOINT  "inproc://workers"
+#define TUMBLER_SPENT_TOKENS_FILE "../keys/tumbler.spent"
+#define TUMBLER_SESSION_LOG_FILE "../keys/tumbler.sessions"
 
 typedef struct {
-  char *key;
-  msgcode_t code;
-} symstruct_t;
+  bn_t gamma;
+  bn_t alpha;
+  ec_t g_to_the_alpha;
+  uint8_t kind; // TUMBLER_SESSION_PROMISE, _PAYMENT or _PENDING
+  uint8_t ctx_alpha[2 * RLC_CL_CIPHERTEXT_SIZE]; // serialized, GENs die with the request
+  uint8_t pi_cldl[RLC_CLDL_PROOF_SIZE];
+  ecdsa_signature_t sigma_r;
+  ecdsa_signature_t sigma_tr;
+  ecdsa_signature_t sigma_s;
+  ecdsa_signature_t sigma_ts;
+} tumbler_session_st;
+
+typedef tumbler_session_st *tumbler_session_t;
 
-static symstruct_t msg_lookuptable[] = {
-  { "registration", REGISTRATION },
-  { "promise_init", PROMISE_INIT },
-  { "payment_init", PAYMENT_INIT },
-};
+// A session as logged once its promise or its payment is done, the kind first.
+// A promise holds alpha, g^alpha, ctx_alpha with its proof, sigma_r and
+// sigma_tr with its proof, a payment holds gamma, sigma_s and sigma_ts. That is
+// all it takes to answer a retry of either again.
+#define TUMBLER_SESSION_PROMISE 1
+#define TUMBLER_SESSION_PAYMENT 2
+#define TUMBLER_SESSION_PENDING 3 // reserves the id of a request in progress, never logged
+#define TUMBLER_SESSION_RECORD_SIZE (1 + (6 * RLC_BN_SIZE) + (4 * RLC_EC_SIZE_COMPRESSED) + (2 * RLC_CL_CIPHERTEXT_SIZE) + RLC_CLDL_PROOF_SIZE)
 
-#define TOTAL_MESSAGES (sizeof(msg_lookuptable) / sizeof(symstruct_t))
+#define tumbler_session_null(session) session = NULL;
+
+#define tumbler_session_new(session)                      \
+  do {                                                    \
+    session = malloc(sizeof(tumbler_session_st));         \
+    if (session == NULL) {                                \
+      RLC_THROW(ERR_NO_MEMORY);                           \
+    }                                                     \
+    (session)->kind = 0;                                  \
+    bn_new((session)->gamma);                             \
+    bn_new((session)->alpha);                             \
+    ec_new((session)->g_to_the_alpha);                    \
+    ecdsa_signature_new((session)->sigma_r);              \
+    ecdsa_signature_new((session)->sigma_tr);             \
+    ecdsa_signature_new((session)->sigma_s);              \
+    ecdsa_signature_new((session)->sigma_ts);             \
+  } while (0)
+
+#define tumbler_session_free(session)                     \
+  do {                                                    \
+    bn_free((session)->gamma);                            \
+    bn_free((session)->alpha);                            \
+    ec_free((session)->g_to_the_alpha);                   \
+    ecdsa_signature_free((session)->sigma_r);             \
+    ecdsa_signature_free((session)->sigma_tr);            \
+    ecdsa_signature_free((session)->sigma_s);             \
+    ecdsa_signature_free((session)->sigma_ts);            \
+    free(session);                                        \
+    session = NULL;                                       \
+  } while (0)
+
+// A pending verification of a token under the tumbler's PS key.
+typedef struct {
+  ps_signature_t signature;
+  bn_t *tid;
+  ps_public_key_t public_key;
+} token_check_st;
 
 typedef struct {
   ec_secret_key_t tumbler_ec_sk;
@@ -38,14 +92,14 @@ typedef struct {
   cl_secret_key_t tumbler_cl_sk;
   cl_public_key_t tumbler_cl_pk;
   cl_params_t cl_params;
-  bn_t gamma;
-  bn_t alpha;
-  ec_t g_to_the_alpha;
-  cl_ciphertext_t ctx_alpha;
-  ecdsa_signature_t sigma_r;
-  ecdsa_signature_t sigma_tr;
-  ecdsa_signature_t sigma_s;
-  ecdsa_signature_t sigma_ts;
+  session_table_t sessions;
+  session_log_t session_log;
+  pthread_mutex_t sessions_lock;
+  puzzle_pool_t puzzles;
+  cl_reservoir_t randomness; // for the puzzles workers generate inline
+  spent_tokens_t spent_tokens;
+  batcher_t tokens; // created once the number of workers is known
+  atomic_size_t busy_workers; // handling a request, batches wait for no more
 } tumbler_state_st;
 
 typedef tumbler_state_st *tumbler_state_t;
@@ -67,14 +121,19 @@ typedef tumbler_state_st *tumbler_state_t;
     cl_secret_key_new((state)->tumbler_cl_sk);            \
     cl_public_key_new((state)->tumbler_cl_pk);            \
     cl_params_new((state)->cl_params);                    \
-    bn_new((state)->gamma);                               \
-    bn_new((state)->alpha);                               \
-    ec_new((state)->g_to_the_alpha);                      \
-    cl_ciphertext_new((state)->ctx_alpha);                \
-    ecdsa_signature_new((state)->sigma_r);                \
-    ecdsa_signature_new((state)->sigma_tr);               \
-    ecdsa_signature_new((state)->sigma_s);                \
-    ecdsa_signature_new((state)->sigma_ts);               \
+    session_table_new((state)->sessions,                  \
+                      tumbler_session_release);           \
+    pthread_mutex_init(&(state)->sessions_lock, NULL);    \
+    session_log_new((state)->session_log,                 \
+                    TUMBLER_SESSION_RECORD_SIZE);         \
+    puzzle_pool_new((state)->puzzles,                     \
+                    PUZZLE_POOL_CAPACITY);                \
+    cl_reservoir_new((state)->randomness,                 \
+                     CL_RESERVOIR_CAPACITY,               \
+                     CL_RESERVOIR_LOW_WATERMARK);         \
+    spent_tokens_new((state)->spent_tokens);              \
+    batcher_null((state)->tokens);                        \
+    atomic_init(&(state)->busy_workers, 0);               \
   } while (0)
 
 #define tumbler_state_free(state)                         \
@@ -88,27 +147,58 @@ typedef tumbler_state_st *tumbler_state_t;
     cl_secret_key_free((state)->tumbler_cl_sk);           \
     cl_public_key_free((state)->tumbler_cl_pk);           \
     cl_params_free((state)->cl_params);                   \
-    bn_free((state)->gamma);                              \
-    bn_free((state)->alpha);                              \
-    ec_free((state)->g_to_the_alpha);                     \
-    cl_ciphertext_free((state)->ctx_alpha);               \
-    ecdsa_signature_free((state)->sigma_r);               \
-    ecdsa_signature_free((state)->sigma_tr);              \
-    ecdsa_signature_free((state)->sigma_s);               \
-    ecdsa_signature_free((state)->sigma_ts);              \
+    session_table_free((state)->sessions);                \
+    pthread_mutex_destroy(&(state)->sessions_lock);       \
+    session_log_free((state)->session_log);               \
+    puzzle_pool_free((state)->puzzles);                   \
+    cl_reservoir_free((state)->randomness);               \
+    spent_tokens_free((state)->spent_tokens);             \
+    if ((state)->tokens != NULL) {                        \
+      batcher_free((state)->tokens);                      \
+    }                                                     \
     free(state);                                          \
     state = NULL;                                         \
   } while (0)
 
-typedef int (*msg_handler_t)(tumbler_state_t, void*, uint8_t*);
+// Workers share the key material read-only; only the session table, the puzzle
+// pool and the spent-token index are locked. The puzzle producer runs on the
+// same structure.
+typedef struct {
+  tumbler_state_t state;
+  void *context;
+  struct pari_thread pari_thread;
+  pthread_t thread;
+} tumbler_worker_st;
+
+typedef tumbler_worker_st *tumbler_worker_t;
+
+typedef int (*msg_handler_t)(tumbler_state_t, void*, uint8_t*, uint8_t*, uint32_t);
+
+// A handler and the least data it reads, checked before it is called.
+typedef struct {
+  msg_handler_t handler;
+  uint32_t min_length;
+} msg_handler_st;
+
+void tumbler_session_release(void *session);
+void tumbler_session_write(uint8_t *record, const tumbler_session_t session);
+int tumbler_session_read(tumbler_session_t session, const uint8_t *record);
+int tumbler_session_restore(void *arg, const uint8_t *id, long long written, const uint8_t *record);
 
-int get_message_type(char *key);
-msg_handler_t get_message_handler(char *key);
+const msg_handler_st *get_message_handler(const uint16_t opcode);
 int handle_message(tumbler_state_t state, void *socket, zmq_msg_t message);
 int receive_message(tumbler_state_t state, void *socket);
+void *worker_run(void *arg);
+
+int verify_token(void *check);
+int verify_tokens(void **checks, size_t n);
+
+int puzzle_generate(tumbler_state_t state, cl_reservoir_t randomness, puzzle_st *puzzle);
+void *puzzle_producer_run(void *arg);
+void *cl_reservoir_refiller_run(void *arg);
 
-int registration_handler(tumbler_state_t state, void *socket, uint8_t *data);
-int promise_init_handler(tumbler_state_t state, void *socket, uint8_t *data);
-int payment_init_handler(tumbler_state_t state, void *socket, uint8_t *data);
+int registration_handler(tumbler_state_t state, void *socket, uint8_t *session_id, uint8_t *data, uint32_t data_length);
+int promise_init_handler(tumbler_state_t state, void *socket, uint8_t *session_id, uint8_t *data, uint32_t data_length);
+int payment_init_handler(tumbler_state_t state, void *socket, uint8_t *session_id, uint8_t *data, uint32_t data_length);
 
 #endif // A2L_ECDSA_INCLUDE_TUMBLER
\ No newline at end of file
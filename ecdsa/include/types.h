@@ -4,39 +4,34 @@
 #include "relic/relic.h"
 #include "pari/pari.h"
 
+#define RLC_SESSION_ID_SIZE 16
+
+// Every message of the protocol, roughly in the order the parties exchange
+// them. The values are part of the wire format, new ones go at the end.
+typedef enum {
+  MSG_REGISTRATION = 1,
+  MSG_REGISTRATION_DONE,
+  MSG_TOKEN_SHARE,
+  MSG_PROMISE_INIT,
+  MSG_PROMISE_DONE,
+  MSG_PUZZLE_SHARE,
+  MSG_PUZZLE_SHARE_DONE,
+  MSG_PAYMENT_INIT,
+  MSG_PAYMENT_DONE,
+  MSG_PUZZLE_SOLUTION_SHARE,
+  MSG_ERROR,
+  MSG_OPCODES
+} msg_opcode_t;
+
+// A message read in place: the fields point into the received buffer, which
+// must outlive them.
 typedef struct {
-  char *type;
+  uint16_t opcode;
+  uint8_t *session_id;
   uint8_t *data;
+  uint32_t data_length;
 } message_st;
 
-typedef message_st *message_t;
-
-#define message_null(message) message = NULL;
-
-#define message_new(message, type_length, data_length)                  \
-  do {                                                                  \
-    message = malloc(sizeof(message_st));                               \
-    if (message == NULL) {                                              \
-      RLC_THROW(ERR_NO_MEMORY);                                         \
-    }                                                                   \
-    (message)->type = malloc(sizeof(char) * type_length);               \
-    if ((message)->type == NULL) {                                      \
-      RLC_THROW(ERR_NO_MEMORY);                                         \
-    }                                                                   \
-    (message)->data = malloc(sizeof(uint8_t) * data_length);            \
-    if ((message)->data == NULL) {                                      \
-      RLC_THROW(ERR_NO_MEMORY);                                         \
-    }                                                                   \
-  } while (0)
-
-#define message_free(message)                                           \
-  do {                                                                  \
-    free((message)->type);                                              \
-    free((message)->data);                                              \
-    free(message);                                                      \
-    message = NULL;                                                     \
-  } while (0)
-
 typedef struct {
   ec_t a;
   ec_t b;
@@ -204,12 +199,12 @@ typedef pedersen_com_zk_proof_st *pedersen_com_zk_proof_t;
   } while (0)
 
 typedef struct {
-  GEN Delta_K;  // fundamental discriminant
-  GEN E;        // the secp256k1 elliptic curve
-  GEN q;        // the order of the elliptic curve
-  GEN G;        // the generator of the elliptic curve group
-  GEN g_q;      // the generator of G^q
-  GEN bound;    // the bound for exponentiation
+  GEN Delta_K;   // fundamental discriminant
+  GEN q;         // the order of the secp256k1 elliptic curve group
+  GEN g_q;       // the generator of G^q
+  GEN bound;     // the bound for exponentiation
+  GEN L;         // the NUCOMP reduction bound, |q^2 * Delta_K|^(1/4)
+  GEN g_q_table; // the fixed-base table for g_q
 } cl_params_st;
 
 typedef cl_params_st *cl_params_t;
@@ -222,10 +217,18 @@ typedef cl_params_st *cl_params_t;
     if (params == NULL) {                             \
       RLC_THROW(ERR_NO_MEMORY);                       \
     }                                                 \
+    memset(params, 0, sizeof(cl_params_st));          \
   } while (0)
 
+// The parameters are clones on the PARI heap, see generate_cl_params().
 #define cl_params_free(params)                        \
   do {                                                \
+    if ((params)->Delta_K) gunclone((params)->Delta_K); \
+    if ((params)->q) gunclone((params)->q);           \
+    if ((params)->g_q) gunclone((params)->g_q);       \
+    if ((params)->bound) gunclone((params)->bound);   \
+    if ((params)->L) gunclone((params)->L);           \
+    if ((params)->g_q_table) gunclone((params)->g_q_table); \
     free(params);                                     \
     params = NULL;                                    \
   } while (0)
@@ -268,10 +271,12 @@ typedef cl_secret_key_st *cl_secret_key_t;
     if (secret_key == NULL) {                         \
       RLC_THROW(ERR_NO_MEMORY);                       \
     }                                                 \
+    (secret_key)->sk = NULL;                          \
   } while (0)
 
 #define cl_secret_key_free(secret_key)                \
   do {                                                \
+    if ((secret_key)->sk) gunclone((secret_key)->sk); \
     free(secret_key);                                 \
     secret_key = NULL;                                \
   } while (0)
@@ -279,6 +284,7 @@ typedef cl_secret_key_st *cl_secret_key_t;
 
 typedef struct {
   GEN pk;
+  GEN pk_table; // the fixed-base table for pk, if precomputed
 } cl_public_key_st;
 
 typedef cl_public_key_st *cl_public_key_t;
@@ -291,10 +297,14 @@ typedef cl_public_key_st *cl_public_key_t;
     if (public_key == NULL) {                         \
       RLC_THROW(ERR_NO_MEMORY);                       \
     }                                                 \
+    (public_key)->pk = NULL;                          \
+    (public_key)->pk_table = NULL;                    \
   } while (0)
 
 #define cl_public_key_free(public_key)                \
   do {                                                \
+    if ((public_key)->pk) gunclone((public_key)->pk); \
+    if ((public_key)->pk_table) gunclone((public_key)->pk_table); \
     free(public_key);                                 \
     public_key = NULL;                                \
   } while (0)
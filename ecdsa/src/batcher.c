@@ -0,0 +1,93 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <time.h>
+#include "relic/relic.h"
+#include "batcher.h"
+
+struct batcher_ticket {
+  void *entry;
+  int result;
+  int done;
+};
+
+static void batcher_deadline(struct timespec *deadline, long window) {
+  clock_gettime(CLOCK_REALTIME, deadline);
+  deadline->tv_nsec += window * 1000;
+  deadline->tv_sec += deadline->tv_nsec / 1000000000;
+  deadline->tv_nsec %= 1000000000;
+}
+
+static void batcher_run(batcher_t batcher, struct batcher_ticket **tickets, size_t n) {
+  void *entries[n];
+  for (size_t i = 0; i < n; i++) {
+    entries[i] = tickets[i]->entry;
+  }
+
+  if (n > 1 && batcher->verify_batch(entries, n) == RLC_OK) {
+    for (size_t i = 0; i < n; i++) {
+      tickets[i]->result = RLC_OK;
+    }
+    return;
+  }
+
+  // A failed batch says nothing about which entries are invalid.
+  for (size_t i = 0; i < n; i++) {
+    tickets[i]->result = batcher->verify_one(entries[i]);
+  }
+}
+
+int batcher_submit(batcher_t batcher, void *entry) {
+  struct batcher_ticket ticket = { entry, RLC_ERR, 0 };
+
+  pthread_mutex_lock(&batcher->lock);
+  while (batcher->size == batcher->capacity) {
+    pthread_cond_wait(&batcher->not_full, &batcher->lock);
+  }
+  batcher->pending[batcher->size++] = &ticket;
+
+  if (batcher->collecting) {
+    // The leader checks again whether anyone else could still join.
+    pthread_cond_signal(&batcher->filled);
+    while (!ticket.done) {
+      pthread_cond_wait(&batcher->done, &batcher->lock);
+    }
+    pthread_mutex_unlock(&batcher->lock);
+    return ticket.result;
+  }
+
+  // Lead this batch: collect until it is full, every busy thread is in it or
+  // the window has passed. A busy thread that submits nothing here only
+  // holds the batch for the window.
+  batcher->collecting = 1;
+  struct timespec deadline;
+  batcher_deadline(&deadline, batcher->window);
+  while (batcher->size < batcher->capacity
+     && (batcher->busy == NULL || batcher->size < atomic_load(batcher->busy))) {
+    if (pthread_cond_timedwait(&batcher->filled, &batcher->lock, &deadline) == ETIMEDOUT) {
+      break;
+    }
+  }
+
+  const size_t n = batcher->size;
+  struct batcher_ticket *tickets[n];
+  for (size_t i = 0; i < n; i++) {
+    tickets[i] = batcher->pending[i];
+  }
+  batcher->size = 0;
+  batcher->collecting = 0;
+  pthread_cond_broadcast(&batcher->not_full);
+  pthread_mutex_unlock(&batcher->lock);
+
+  // The next batch fills up while this one is verified.
+  batcher_run(batcher, tickets, n);
+
+  pthread_mutex_lock(&batcher->lock);
+  for (size_t i = 0; i < n; i++) {
+    tickets[i]->done = 1;
+  }
+  pthread_cond_broadcast(&batcher->done);
+  pthread_mutex_unlock(&batcher->lock);
+
+  return ticket.result;
+}
@@ -0,0 +1,173 @@
+// Turns the CL parameters into limb arrays at build time, so that the parties
+// wrap them as PARI integers instead of parsing decimal strings on every start.
+// Run by the build as
+//
+//   cl_params_gen <directory> <default level> <level>...
+//
+// it writes cl_params.h, the sizes that depend on the security level, and
+// cl_params_constants.h, the parameters themselves, for every level given.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pari/pari.h"
+
+typedef struct {
+  int level;         // in bits of security
+  long Delta_K_bits; // size of the fundamental discriminant
+  // Parameters generated using SageMath script, NULL for derived levels.
+  const char *Delta_K;
+  const char *bound;
+  const char *g_q_a;
+  const char *g_q_b;
+  const char *g_q_c;
+} cl_level_st;
+
+// Discriminant sizes matching the security of 112 to 256-bit symmetric keys.
+// The bound is for exponentiation, for uniform sampling to be at 2^{-40} from
+// the unifom in <g_q>.
+static const cl_level_st levels[] = {
+  { 112, 1348, NULL, NULL, NULL, NULL, NULL },
+  { 128, 1827,
+    "-7917297328878683784842235952488620683924100338715963369693275768732162831834859052302716918416013031853265985178593375655994934704463023676296364363803257769443921988228513012040548137047446483986199954435962221122006965317176921759968659376932101987729556148116190707955808747136944623277094531007901655971804163515065712136708172984834192213773138039179492400722665370317221867505959207212674207052581946756527848674480328854830559945140752059719739492686061412113598389028096554833252668553020964851121112531561161799093718416247246137641387797659",
+    "25413151665722220203610173826311975594790577398151861612310606875883990655261658217495681782816066858410439979225400605895077952191850577877370585295070770312182177789916520342292660169492395314400288273917787194656036294620169343699612953311314935485124063580486497538161801803224580096",
+    "4008431686288539256019978212352910132512184203702279780629385896624473051840259706993970111658701503889384191610389161437594619493081376284617693948914940268917628321033421857293703008209538182518138447355678944124861126384966287069011522892641935034510731734298233539616955610665280660839844718152071538201031396242932605390717004106131705164194877377",
+    "-3117991088204303366418764671444893060060110057237597977724832444027781815030207752301780903747954421114626007829980376204206959818582486516608623149988315386149565855935873517607629155593328578131723080853521348613293428202727746191856239174267496577422490575311784334114151776741040697808029563449966072264511544769861326483835581088191752567148165409",
+    "7226982982667784284607340011220616424554394853592495056851825214613723615410492468400146084481943091452495677425649405002137153382700126963171182913281089395393193450415031434185562111748472716618186256410737780813669746598943110785615647848722934493732187571819575328802273312361412673162473673367423560300753412593868713829574117975260110889575205719" },
+  { 192, 3598, NULL, NULL, NULL, NULL, NULL },
+  { 256, 5971, NULL, NULL, NULL, NULL, NULL },
+};
+
+// Order of the secp256k1 elliptic curve group and the group G^q.
+static const char *q_value = "115792089237316195423570985008687907852837564279074904382605163141518161494337";
+
+static GEN cl_constant_int(const char *value) {
+  return value[0] == '-' ? negi(strtoi(value + 1)) : strtoi(value);
+}
+
+// Delta_K = -q * p for the first prime p above 2^(bits - |q|) with p = 3 mod 4
+// and (q/p) = -1, so Delta_K = 1 mod 4 is fundamental and q is inert. g_q is
+// [phi_q^-1(r^2)]^q as in the CL construction: the square of the prime form r
+// over the smallest split prime, lifted to q^2 * Delta_K, raised to q. The
+// bound is 2^40 times the class number bound log|Delta_K| sqrt|Delta_K| / pi,
+// with log|Delta_K| / pi < 7 * bits / 30.
+static void cl_level_derive(GEN *Delta_K, GEN *bound, GEN *g_q, long bits, GEN q) {
+  GEN p = nextprime(int2n(bits - expi(q) - 1));
+  while (mod4(p) != 3 || kronecker(q, p) != -1) {
+    p = nextprime(addiu(p, 1));
+  }
+  *Delta_K = negi(mulii(q, p));
+
+  ulong r = 3;
+  GEN f = NULL;
+  while (f == NULL) {
+    if (uisprime(r) && krois(*Delta_K, (long) r) == 1) {
+      // The lift below needs the first coefficient prime to q.
+      f = redimag(gsqr(primeform_u(*Delta_K, r)));
+      if (!equali1(gcdii(gel(f, 1), q))) {
+        f = NULL;
+      }
+    }
+    r += 2;
+  }
+  GEN lift = redimag(qfi(gel(f, 1), mulii(gel(f, 2), q), mulii(gel(f, 3), sqri(q))));
+  *g_q = nupow(lift, q, sqrtnint(absi(mulii(sqri(q), *Delta_K)), 4));
+
+  *bound = shifti(mului((ulong) (7 * bits + 29) / 30, sqrtint(absi(*Delta_K))), 40);
+}
+
+// Least significant limb first, the order int_LSW()/int_nextW() walk in.
+static void write_limbs(FILE *file, const char *name, GEN x) {
+  const long n = lgefint(x) - 2;
+  GEN limb = int_LSW(x);
+
+  fprintf(file, "#define %s_SIGN %ld\n", name, signe(x));
+  fprintf(file, "static const ulong %s[%ld] = {", name, n);
+  for (long i = 0; i < n; i++, limb = int_nextW(limb)) {
+    fprintf(file, "%s0x%016lxUL%s", i % 4 == 0 ? "\n  " : " ", (ulong) *limb, i + 1 < n ? "," : "");
+  }
+  fprintf(file, "\n};\n");
+}
+
+static FILE *open_header(const char *directory, const char *name) {
+  const size_t path_length = strlen(directory) + strlen(name) + 2;
+  char path[path_length];
+  snprintf(path, path_length, "%s/%s", directory, name);
+
+  FILE *file = fopen(path, "w");
+  if (file == NULL) {
+    fprintf(stderr, "Error: could not open %s.\n", path);
+    exit(1);
+  }
+  fprintf(file, "// Generated by cl_params_gen, do not edit.\n");
+  return file;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 4) {
+    fprintf(stderr, "Usage: %s <directory> <default level> <level>...\n", argv[0]);
+    exit(1);
+  }
+
+  pari_init(100000000, 2);
+
+  FILE *sizes = open_header(argv[1], "cl_params.h");
+  FILE *constants = open_header(argv[1], "cl_params_constants.h");
+
+  fprintf(sizes, "#ifndef A2L_CL_PARAMS\n#define A2L_CL_PARAMS\n\n");
+  fprintf(sizes, "// The level the parties are built for, unless a target picks another one.\n");
+  fprintf(sizes, "#ifndef CL_SECURITY_LEVEL\n#define CL_SECURITY_LEVEL %d\n#endif\n\n", atoi(argv[2]));
+  fprintf(constants, "#ifndef A2L_CL_PARAMS_CONSTANTS\n#define A2L_CL_PARAMS_CONSTANTS\n\n");
+  fprintf(constants, "#include \"cl_params.h\"\n\n#define CL_PARAMS_BITS_IN_LONG %d\n\n", BITS_IN_LONG);
+
+  GEN q = cl_constant_int(q_value);
+  for (int i = 3; i < argc; i++) {
+    const cl_level_st *level = NULL;
+    for (size_t j = 0; j < sizeof(levels) / sizeof(levels[0]); j++) {
+      if (levels[j].level == atoi(argv[i])) level = &levels[j];
+    }
+    if (level == NULL) {
+      fprintf(stderr, "Error: no CL parameters for security level %s.\n", argv[i]);
+      exit(1);
+    }
+
+    pari_sp av = avma;
+    GEN Delta_K, bound, g_q;
+    if (level->Delta_K != NULL) {
+      Delta_K = cl_constant_int(level->Delta_K);
+      bound = cl_constant_int(level->bound);
+      g_q = qfi(cl_constant_int(level->g_q_a), cl_constant_int(level->g_q_b), cl_constant_int(level->g_q_c));
+    } else {
+      cl_level_derive(&Delta_K, &bound, &g_q, level->Delta_K_bits, q);
+    }
+    GEN Delta_q = absi(mulii(sqri(q), Delta_K));
+
+    // Forms only carry (a, b), both below sqrt|q^2 * Delta_K| once reduced. The
+    // largest exponent is the proof response u1 < 2^41 * bound.
+    fprintf(sizes, "#%s CL_SECURITY_LEVEL == %d\n", i == 3 ? "if" : "elif", level->level);
+    fprintf(sizes, "#define CL_DELTA_K_BITS %ld\n", expi(Delta_K) + 1);
+    fprintf(sizes, "#define CL_QFI_COEFF_BYTES %ld\n", (expi(sqrtint(Delta_q)) + 8) / 8);
+    fprintf(sizes, "#define CL_EXPONENT_BITS %ld\n", expi(bound) + 1 + 41);
+
+    fprintf(constants, "#%s CL_SECURITY_LEVEL == %d\n", i == 3 ? "if" : "elif", level->level);
+    write_limbs(constants, "CL_DELTA_K", Delta_K);
+    write_limbs(constants, "CL_BOUND", bound);
+    write_limbs(constants, "CL_Q", q);
+    write_limbs(constants, "CL_G_Q_A", gel(g_q, 1));
+    write_limbs(constants, "CL_G_Q_B", gel(g_q, 2));
+    write_limbs(constants, "CL_G_Q_C", gel(g_q, 3));
+    // The NUCOMP reduction bound, |q^2 * Delta_K|^(1/4).
+    write_limbs(constants, "CL_L", sqrtnint(Delta_q, 4));
+    set_avma(av);
+  }
+
+  fprintf(sizes, "#else\n#error \"CL_SECURITY_LEVEL was not generated, see CL_SECURITY_LEVELS\"\n#endif\n\n");
+  fprintf(sizes, "#endif // A2L_CL_PARAMS\n");
+  fprintf(constants, "#endif\n\n#endif // A2L_CL_PARAMS_CONSTANTS\n");
+  if (fclose(sizes) != 0 || fclose(constants) != 0) {
+    fprintf(stderr, "Error: could not write the headers to %s.\n", argv[1]);
+    exit(1);
+  }
+
+  pari_close();
+  return 0;
+}
@@ -0,0 +1,604 @@
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "relic/relic.h"
+#include "pari/pari.h"
+#include "zmq.h"
+#include "loadgen.h"
+#include "types.h"
+#include "util.h"
+
+static size_t histogram_index(long long value) {
+  if (value < (1 << LOADGEN_HISTOGRAM_SUB_BITS)) {
+    return value < 0 ? 0 : (size_t) value;
+  }
+
+  const int exponent = 63 - __builtin_clzll((unsigned long long) value);
+  const int shift = exponent - LOADGEN_HISTOGRAM_SUB_BITS;
+  const size_t sub_bucket = (size_t) (value >> shift) & ((1 << LOADGEN_HISTOGRAM_SUB_BITS) - 1);
+  return ((size_t) (shift + 1) << LOADGEN_HISTOGRAM_SUB_BITS) + sub_bucket;
+}
+
+static long long histogram_upper_bound(size_t index) {
+  if (index < (1 << LOADGEN_HISTOGRAM_SUB_BITS)) {
+    return (long long) index;
+  }
+
+  const int shift = (int) (index >> LOADGEN_HISTOGRAM_SUB_BITS) - 1;
+  const long long sub_bucket = (long long) (index & ((1 << LOADGEN_HISTOGRAM_SUB_BITS) - 1));
+  return (((1LL << LOADGEN_HISTOGRAM_SUB_BITS) + sub_bucket + 1) << shift) - 1;
+}
+
+static void histogram_record(histogram_st *histogram, long long value) {
+  histogram->counts[histogram_index(value)]++;
+  histogram->total++;
+  histogram->sum += value;
+  if (value > histogram->max) {
+    histogram->max = value;
+  }
+}
+
+static void histogram_merge(histogram_st *into, const histogram_st *from) {
+  for (size_t i = 0; i < LOADGEN_HISTOGRAM_BUCKETS; i++) {
+    into->counts[i] += from->counts[i];
+  }
+  into->total += from->total;
+  into->sum += from->sum;
+  if (from->max > into->max) {
+    into->max = from->max;
+  }
+}
+
+static long long histogram_percentile(const histogram_st *histogram, unsigned p) {
+  const uint64_t rank = (p * histogram->total + 99) / 100;
+  uint64_t seen = 0;
+  for (size_t i = 0; i < LOADGEN_HISTOGRAM_BUCKETS; i++) {
+    seen += histogram->counts[i];
+    if (seen >= rank && seen > 0) {
+      const long long bound = histogram_upper_bound(i);
+      return bound < histogram->max ? bound : histogram->max;
+    }
+  }
+  return histogram->max;
+}
+
+// Runs a step of either party. The states hold no PARI objects between steps,
+// so whatever a step leaves on the stack can go as soon as it returns.
+static int alice_step(int (*step)(alice_state_t, void *), alice_state_t state, void *socket) {
+  pari_sp av = avma;
+  const int result_status = step(state, socket);
+  set_avma(av);
+  return result_status;
+}
+
+static int bob_step(int (*step)(bob_state_t, void *), bob_state_t state, void *socket) {
+  pari_sp av = avma;
+  const int result_status = step(state, socket);
+  set_avma(av);
+  return result_status;
+}
+
+// Starts the next payment of a client under fresh session identifiers, with
+// Alice's registration.
+int payment_start(loadgen_worker_t worker, loadgen_session_t session) {
+  if (worker == NULL || session == NULL || session->remaining == 0) {
+    RLC_THROW(ERR_NO_VALID);
+  }
+
+  alice_state_t alice = session->alice;
+  bob_state_t bob = session->bob;
+
+  rand_bytes(alice->session_id, RLC_SESSION_ID_SIZE);
+  rand_bytes(bob->session_id, RLC_SESSION_ID_SIZE);
+  alice->registration_completed = 0;
+  alice->puzzle_shared = 0;
+  alice->puzzle_solved = 0;
+  bob->token_received = 0;
+  bob->promise_completed = 0;
+  bob->puzzle_shared = 0;
+  bob->puzzle_solved = 0;
+
+  session->remaining--;
+  worker->active++;
+  session->step = STEP_REGISTRATION;
+  session->start_time = ttimer();
+  session->phase_start_time = session->start_time;
+  session->deadline = session->start_time + worker->config->timeout * (long long) (CLOCK_PRECISION / 1000);
+
+  if (session_put(worker->sessions, alice->session_id, session) != RLC_OK
+  ||  session_put(worker->sessions, bob->session_id, session) != RLC_OK) {
+    return RLC_ERR;
+  }
+
+  return alice_step(registration, alice, worker->tumbler);
+}
+
+// Takes a payment as far as the messages received so far allow.
+int payment_advance(loadgen_worker_t worker, loadgen_session_t session) {
+  if (worker == NULL || session == NULL) {
+    RLC_THROW(ERR_NO_VALID);
+  }
+
+  alice_state_t alice = session->alice;
+  bob_state_t bob = session->bob;
+
+  for (;;) {
+    switch (session->step) {
+      case STEP_REGISTRATION:
+        if (!alice->registration_completed) {
+          return RLC_OK;
+        }
+        session->phase_times[PHASE_REGISTRATION] = ttimer() - session->phase_start_time;
+
+        if (alice_step(token_share, alice, worker->alice) != RLC_OK) {
+          return RLC_ERR;
+        }
+        session->step = STEP_TOKEN_SHARE;
+        break;
+
+      case STEP_TOKEN_SHARE:
+        if (!bob->token_received) {
+          return RLC_OK;
+        }
+        session->phase_start_time = ttimer();
+
+        if (bob_step(promise_init, bob, worker->tumbler) != RLC_OK) {
+          return RLC_ERR;
+        }
+        session->step = STEP_PROMISE;
+        break;
+
+      case STEP_PROMISE:
+        if (!bob->promise_completed) {
+          return RLC_OK;
+        }
+        session->phase_times[PHASE_PROMISE] = ttimer() - session->phase_start_time;
+
+        if (bob_step(puzzle_share, bob, worker->bob) != RLC_OK) {
+          return RLC_ERR;
+        }
+        session->step = STEP_PUZZLE_SHARE;
+        break;
+
+      case STEP_PUZZLE_SHARE:
+        if (!alice->puzzle_shared) {
+          return RLC_OK;
+        }
+        session->phase_start_time = ttimer();
+
+        if (alice_step(payment_init, alice, worker->tumbler) != RLC_OK) {
+          return RLC_ERR;
+        }
+        session->step = STEP_PAYMENT;
+        break;
+
+      case STEP_PAYMENT:
+        if (!alice->puzzle_solved) {
+          return RLC_OK;
+        }
+        session->phase_times[PHASE_PUZZLE_SOLVE] = ttimer() - session->phase_start_time;
+
+        if (alice_step(puzzle_solution_share, alice, worker->alice) != RLC_OK) {
+          return RLC_ERR;
+        }
+        session->step = STEP_SOLUTION;
+        break;
+
+      case STEP_SOLUTION:
+        if (!bob->puzzle_solved) {
+          return RLC_OK;
+        }
+        session->phase_times[PHASE_PAYMENT] = ttimer() - session->start_time;
+        session->step = STEP_DONE;
+        return RLC_OK;
+
+      default:
+        return RLC_OK;
+    }
+
+    // Every step gets the whole timeout, however long the payment has run.
+    session->deadline = ttimer() + worker->config->timeout * (long long) (CLOCK_PRECISION / 1000);
+  }
+}
+
+// Records how a payment ended and starts the client's next one. A payment
+// that cannot start counts as failed right away.
+void payment_end(loadgen_worker_t worker, loadgen_session_t session, int result) {
+  for (;;) {
+    session_remove(worker->sessions, session->alice->session_id);
+    session_remove(worker->sessions, session->bob->session_id);
+    session->step = STEP_IDLE;
+    worker->active--;
+
+    if (result == RLC_OK) {
+      worker->completed++;
+      for (int phase = 0; phase < TOTAL_PHASES; phase++) {
+        histogram_record(&worker->histograms[phase], session->phase_times[phase] / 1000);
+      }
+    } else {
+      worker->failed++;
+    }
+
+    if (session->remaining == 0) {
+      return;
+    }
+
+    result = payment_start(worker, session);
+    if (result == RLC_OK) {
+      return;
+    }
+  }
+}
+
+// Hands a message to the party it is meant for. Replies from the tumbler name
+// either Alice's or Bob's session, messages between the two always Alice's.
+static void worker_dispatch(loadgen_worker_t worker, void *socket, zmq_msg_t *message) {
+  message_st msg;
+  if (message_parse(&msg, message) != RLC_OK) {
+    fprintf(stderr, "Error: malformed message.\n");
+    return;
+  }
+
+  // Late replies to payments that already timed out are dropped here.
+  loadgen_session_t session = session_get(worker->sessions, msg.session_id);
+  if (session == NULL) {
+    return;
+  }
+
+  int result_status;
+  if (socket == worker->bob
+  || (socket == worker->tumbler && memcmp(msg.session_id, session->bob->session_id, RLC_SESSION_ID_SIZE) == 0)) {
+    result_status = bob_handle_message(session->bob, socket, &msg);
+  } else {
+    result_status = alice_handle_message(session->alice, socket, &msg);
+  }
+
+  if (result_status == RLC_OK) {
+    result_status = payment_advance(worker, session);
+  }
+
+  if (result_status != RLC_OK || session->step == STEP_DONE) {
+    payment_end(worker, session, result_status);
+  }
+}
+
+// Takes every message waiting on a socket without blocking.
+static int worker_receive(loadgen_worker_t worker, void *socket) {
+  for (;;) {
+    zmq_msg_t message;
+    if (zmq_msg_init(&message) != 0) {
+      fprintf(stderr, "Error: could not initialize the message.\n");
+      return RLC_ERR;
+    }
+
+    int rc = zmq_msg_recv(&message, socket, ZMQ_DONTWAIT);
+    // The message is the last frame, after the delimiter a DEALER peer sends.
+    while (rc >= 0 && zmq_msg_more(&message)) {
+      rc = zmq_msg_recv(&message, socket, 0);
+    }
+
+    if (rc < 0) {
+      const int error = zmq_errno();
+      zmq_msg_close(&message);
+      if (error == EAGAIN) {
+        return RLC_OK;
+      }
+      fprintf(stderr, "Error: could not receive the message.\n");
+      return RLC_ERR;
+    }
+
+    worker_dispatch(worker, socket, &message);
+    zmq_msg_close(&message);
+  }
+}
+
+static void *worker_socket(loadgen_worker_t worker, const char *endpoint, int bind) {
+  void *socket = zmq_socket(worker->context, ZMQ_DEALER);
+  if (!socket) {
+    fprintf(stderr, "Error: could not create a socket.\n");
+    return NULL;
+  }
+
+  // Each payment has at most one message in flight on a socket, so the queues
+  // are bounded by the number of clients and need no high-water mark.
+  int linger = 0, hwm = 0;
+  zmq_setsockopt(socket, ZMQ_LINGER, &linger, sizeof(linger));
+  zmq_setsockopt(socket, ZMQ_SNDHWM, &hwm, sizeof(hwm));
+  zmq_setsockopt(socket, ZMQ_RCVHWM, &hwm, sizeof(hwm));
+
+  const int rc = bind ? zmq_bind(socket, endpoint) : zmq_connect(socket, endpoint);
+  if (rc != 0) {
+    fprintf(stderr, "Error: could not %s the socket to %s.\n", bind ? "bind" : "connect", endpoint);
+    zmq_close(socket);
+    return NULL;
+  }
+
+  return socket;
+}
+
+void *worker_run(void *arg) {
+  loadgen_worker_t worker = (loadgen_worker_t) arg;
+  const unsigned payments = worker->clients * worker->config->payments;
+
+  loadgen_session_t *sessions = NULL;
+
+  if (init_thread(&worker->pari_thread) != RLC_OK) {
+    fprintf(stderr, "Error: could not initialize the worker.\n");
+    worker->failed = payments;
+    return NULL;
+  }
+
+  RLC_TRY {
+    // The pair is bound before it is connected, which inproc requires.
+    worker->tumbler = worker_socket(worker, worker->config->endpoint, 0);
+    worker->bob = worker_socket(worker, worker->endpoint, 1);
+    worker->alice = worker_socket(worker, worker->endpoint, 0);
+    if (worker->tumbler == NULL || worker->bob == NULL || worker->alice == NULL) {
+      RLC_THROW(ERR_CAUGHT);
+    }
+
+    session_table_new(worker->sessions, NULL);
+
+    sessions = calloc(worker->clients, sizeof(loadgen_session_t));
+    if (sessions == NULL) {
+      RLC_THROW(ERR_NO_MEMORY);
+    }
+
+    for (unsigned i = 0; i < worker->clients; i++) {
+      loadgen_session_new(sessions[i]);
+      sessions[i]->alice->party = worker->config->alice;
+      sessions[i]->bob->party = worker->config->bob;
+      sessions[i]->remaining = worker->config->payments;
+    }
+
+    for (unsigned i = 0; i < worker->clients; i++) {
+      const int rc = payment_start(worker, sessions[i]);
+      if (rc != RLC_OK) {
+        payment_end(worker, sessions[i], rc);
+      }
+    }
+
+    zmq_pollitem_t items[] = {
+      { worker->tumbler, 0, ZMQ_POLLIN, 0 },
+      { worker->alice, 0, ZMQ_POLLIN, 0 },
+      { worker->bob, 0, ZMQ_POLLIN, 0 },
+    };
+    const int items_count = sizeof(items) / sizeof(items[0]);
+
+    while (worker->active > 0) {
+      if (zmq_poll(items, items_count, LOADGEN_POLL_INTERVAL) < 0) {
+        fprintf(stderr, "Error: could not poll the sockets.\n");
+        RLC_THROW(ERR_CAUGHT);
+      }
+
+      for (int i = 0; i < items_count; i++) {
+        if ((items[i].revents & ZMQ_POLLIN) && worker_receive(worker, items[i].socket) != RLC_OK) {
+          RLC_THROW(ERR_CAUGHT);
+        }
+      }
+
+      const long long now = ttimer();
+      for (unsigned i = 0; i < worker->clients; i++) {
+        if (sessions[i]->step != STEP_IDLE && now > sessions[i]->deadline) {
+          fprintf(stderr, "Error: a payment timed out.\n");
+          payment_end(worker, sessions[i], RLC_ERR);
+        }
+      }
+    }
+  } RLC_CATCH_ANY {
+    worker->failed = payments - worker->completed;
+  } RLC_FINALLY {
+    if (sessions != NULL) {
+      for (unsigned i = 0; i < worker->clients; i++) {
+        if (sessions[i] != NULL) loadgen_session_free(sessions[i]);
+      }
+      free(sessions);
+    }
+    if (worker->sessions != NULL) session_table_free(worker->sessions);
+
+    void **sockets[] = { &worker->tumbler, &worker->alice, &worker->bob };
+    for (size_t i = 0; i < sizeof(sockets) / sizeof(sockets[0]); i++) {
+      if (*sockets[i] != NULL) {
+        zmq_close(*sockets[i]);
+        *sockets[i] = NULL;
+      }
+    }
+  }
+
+  clean_thread();
+  return NULL;
+}
+
+// Runs the given number of clients spread over the workers, and prints what
+// they measured.
+static int run_level(loadgen_config_t config, void *context, unsigned clients_count) {
+  int result_status = RLC_OK;
+  unsigned workers_started = 0;
+  unsigned clients_started = 0;
+
+  const unsigned workers_count = config->workers < clients_count ? config->workers : clients_count;
+  loadgen_worker_t workers = calloc(workers_count, sizeof(loadgen_worker_st));
+  if (workers == NULL) {
+    return RLC_ERR;
+  }
+
+  long long start_time = ttimer();
+  for (unsigned i = 0; i < workers_count; i++) {
+    workers[i].config = config;
+    workers[i].context = context;
+    workers[i].clients = clients_count / workers_count + (i < clients_count % workers_count);
+    snprintf(workers[i].endpoint, sizeof(workers[i].endpoint), "inproc://loadgen-%u-%u", clients_count, i);
+    pari_thread_alloc(&workers[i].pari_thread, PARI_STACK_SIZE, NULL);
+    if (pthread_create(&workers[i].thread, NULL, worker_run, &workers[i]) != 0) {
+      pari_thread_free(&workers[i].pari_thread);
+      result_status = RLC_ERR;
+      break;
+    }
+    workers_started++;
+    clients_started += workers[i].clients;
+  }
+
+  unsigned completed = 0, failed = 0;
+  histogram_st histograms[TOTAL_PHASES];
+  memset(histograms, 0, sizeof(histograms));
+
+  for (unsigned i = 0; i < workers_started; i++) {
+    pthread_join(workers[i].thread, NULL);
+    pari_thread_free(&workers[i].pari_thread);
+
+    completed += workers[i].completed;
+    failed += workers[i].failed;
+    for (int phase = 0; phase < TOTAL_PHASES; phase++) {
+      histogram_merge(&histograms[phase], &workers[i].histograms[phase]);
+    }
+  }
+  long long total_time = ttimer() - start_time;
+
+  if (result_status != RLC_OK) {
+    fprintf(stderr, "Error: could only start %u of %u clients.\n", clients_started, clients_count);
+  }
+  printf("throughput,%u,%u,%u,%.3f\n",
+         clients_started, completed, failed, completed * CLOCK_PRECISION / total_time);
+
+  for (int phase = 0; phase < TOTAL_PHASES; phase++) {
+    const histogram_st *histogram = &histograms[phase];
+    if (histogram->total == 0) {
+      continue;
+    }
+
+    printf("latency,%u,%s,%llu,%lld,%lld,%lld,%lld,%lld\n",
+           clients_started,
+           phase_names[phase],
+           (unsigned long long) histogram->total,
+           histogram->sum / (long long) histogram->total,
+           histogram_percentile(histogram, 50),
+           histogram_percentile(histogram, 90),
+           histogram_percentile(histogram, 99),
+           histogram->max);
+
+    for (size_t i = 0; i < LOADGEN_HISTOGRAM_BUCKETS; i++) {
+      if (histogram->counts[i] > 0) {
+        printf("histogram,%u,%s,%lld,%llu\n",
+               clients_started,
+               phase_names[phase],
+               histogram_upper_bound(i),
+               (unsigned long long) histogram->counts[i]);
+      }
+    }
+  }
+  fflush(stdout);
+
+  free(workers);
+  return result_status;
+}
+
+static void usage(const char *name) {
+  fprintf(stderr, "Usage: %s [-e endpoint] [-c max clients] [-n payments per client] [-t timeout in ms] [-w workers]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+  init();
+  int result_status = RLC_OK;
+
+  unsigned max_clients = 64;
+  const char *endpoint = LOADGEN_TUMBLER_ENDPOINT;
+  unsigned payments = LOADGEN_PAYMENTS;
+  long timeout = LOADGEN_TIMEOUT;
+  unsigned workers = LOADGEN_WORKERS;
+
+  int option;
+  while ((option = getopt(argc, argv, "e:c:n:t:w:")) != -1) {
+    switch (option) {
+      case 'e':
+        endpoint = optarg;
+        break;
+
+      case 'c':
+        max_clients = (unsigned) strtoul(optarg, NULL, 10);
+        break;
+
+      case 'n':
+        payments = (unsigned) strtoul(optarg, NULL, 10);
+        break;
+
+      case 't':
+        timeout = strtol(optarg, NULL, 10);
+        break;
+
+      case 'w':
+        workers = (unsigned) strtoul(optarg, NULL, 10);
+        break;
+
+      default:
+        usage(argv[0]);
+        exit(1);
+    }
+  }
+
+  if (max_clients < 1 || max_clients > LOADGEN_MAX_CLIENTS || payments < 1 || timeout < 1
+  ||  workers < 1 || workers > LOADGEN_MAX_WORKERS) {
+    usage(argv[0]);
+    exit(1);
+  }
+
+  loadgen_config_t config;
+  loadgen_config_null(config);
+
+  void *context = zmq_ctx_new();
+  if (!context) {
+    fprintf(stderr, "Error: could not create a context.\n");
+    exit(1);
+  }
+
+  // Every worker has three sockets, whatever the number of clients.
+  zmq_ctx_set(context, ZMQ_MAX_SOCKETS, 3 * LOADGEN_MAX_WORKERS + 16);
+
+  RLC_TRY {
+    loadgen_config_new(config);
+    config->endpoint = endpoint;
+    config->payments = payments;
+    config->timeout = timeout;
+    config->workers = workers;
+
+    // The parties' pools are left stopped, the workers already keep the cores
+    // busy and the exponentiations run on the calling thread without one.
+    if (party_load(config->alice, ALICE_KEY_FILE_PREFIX) != RLC_OK
+    ||  party_load(config->bob, BOB_KEY_FILE_PREFIX) != RLC_OK) {
+      RLC_THROW(ERR_CAUGHT);
+    }
+
+    // The CL public key is left as the parties read it, with the table from the
+    // tumbler's key store or without one, so clients cost what Alice and Bob do.
+    // Double the number of concurrent payments until the maximum is reached.
+    printf("throughput,clients,completed,failed,payments_per_sec\n");
+    printf("latency,clients,phase,count,mean_us,p50_us,p90_us,p99_us,max_us\n");
+    printf("histogram,clients,phase,bucket_us,count\n");
+    for (unsigned clients = 1; ; clients = clients * 2 < max_clients ? clients * 2 : max_clients) {
+      if (run_level(config, context, clients) != RLC_OK) {
+        RLC_THROW(ERR_CAUGHT);
+      }
+
+      if (clients == max_clients) {
+        break;
+      }
+    }
+  } RLC_CATCH_ANY {
+    result_status = RLC_ERR;
+  } RLC_FINALLY {
+    if (config != NULL) loadgen_config_free(config);
+  }
+
+  int rc = zmq_ctx_destroy(context);
+  if (rc != 0) {
+    fprintf(stderr, "Error: could not destroy the context.\n");
+    exit(1);
+  }
+
+  clean();
+
+  return result_status;
+}
@@ -0,0 +1,763 @@
+#include <stdio.h>
+#include <string.h>
+#include "relic/relic.h"
+#include "pari/pari.h"
+#include "zmq.h"
+#include "protocol.h"
+#include "types.h"
+#include "util.h"
+
+// Indexed by opcode, with the least data each handler reads. Messages a party
+// does not expect are left empty.
+static const alice_msg_handler_st alice_msg_handlers[MSG_OPCODES] = {
+  [MSG_REGISTRATION_DONE] = { registration_done_handler, 2 * RLC_G1_SIZE_COMPRESSED },
+  [MSG_PUZZLE_SHARE] = { puzzle_share_handler, RLC_EC_SIZE_COMPRESSED + (2 * RLC_CL_CIPHERTEXT_SIZE) },
+  [MSG_PAYMENT_DONE] = { payment_done_handler, 2 * RLC_BN_SIZE },
+};
+
+static const bob_msg_handler_st bob_msg_handlers[MSG_OPCODES] = {
+  [MSG_TOKEN_SHARE] = { token_share_handler, RLC_BN_SIZE + (2 * RLC_G1_SIZE_COMPRESSED) + RLC_SESSION_ID_SIZE },
+  [MSG_PROMISE_DONE] = { promise_done_handler, (5 * RLC_EC_SIZE_COMPRESSED) + (3 * RLC_BN_SIZE) + (2 * RLC_CL_CIPHERTEXT_SIZE)
+    + RLC_CLDL_PROOF_T1_SIZE + RLC_CLDL_PROOF_T3_SIZE + RLC_CLDL_PROOF_U1_SIZE + RLC_CLDL_PROOF_U2_SIZE },
+  [MSG_PUZZLE_SHARE_DONE] = { puzzle_share_done_handler, 0 },
+  [MSG_PUZZLE_SOLUTION_SHARE] = { puzzle_solution_share_handler, RLC_BN_SIZE },
+};
+
+const alice_msg_handler_st *alice_get_message_handler(const uint16_t opcode) {
+  return opcode < MSG_OPCODES && alice_msg_handlers[opcode].handler != NULL ? &alice_msg_handlers[opcode] : NULL;
+}
+
+const bob_msg_handler_st *bob_get_message_handler(const uint16_t opcode) {
+  return opcode < MSG_OPCODES && bob_msg_handlers[opcode].handler != NULL ? &bob_msg_handlers[opcode] : NULL;
+}
+
+// Reads the keys of Alice or Bob and the CL parameters. The pool is left to
+// the caller.
+int party_load(party_t party, const char *key_file_prefix) {
+  if (party == NULL || key_file_prefix == NULL) {
+    RLC_THROW(ERR_NO_VALID);
+  }
+
+  int result_status = RLC_OK;
+
+  RLC_TRY {
+    if (read_tables_from_file(party->cl_params) != RLC_OK) {
+      RLC_THROW(ERR_CAUGHT);
+    }
+
+    if (generate_cl_params(party->cl_params) != RLC_OK) {
+      RLC_THROW(ERR_CAUGHT);
+    }
+
+    if (read_keys_from_file_alice_bob(key_file_prefix,
+                                      party->ec_sk,
+                                      party->ec_pk,
+                                      party->tumbler_ec_pk,
+                                      party->tumbler_ps_pk,
+                                      party->tumbler_cl_pk) != RLC_OK) {
+      RLC_THROW(ERR_CAUGHT);
+    }
+  } RLC_CATCH_ANY {
+    result_status = RLC_ERR;
+  }
+
+  return result_status;
+}
+
+// Runs the handler of a message that belongs to one of Alice's payments.
+// Whatever the handler leaves on the PARI stack is garbage once it returns.
+int alice_handle_message(alice_state_t state, void *socket, const message_st *msg) {
+  if (state == NULL || msg == NULL) {
+    RLC_THROW(ERR_NO_VALID);
+  }
+
+  int result_status = RLC_OK;
+  pari_sp av = avma;
+
+  RLC_TRY {
+    if (msg->opcode == MSG_ERROR) {
+      fprintf(stderr, "Error: the peer could not handle the request.\n");
+      RLC_THROW(ERR_CAUGHT);
+    }
+
+    const alice_msg_handler_st *msg_handler = alice_get_message_handler(msg->opcode);
+    if (msg_handler == NULL) {
+      fprintf(stderr, "Error: invalid message type.\n");
+      RLC_THROW(ERR_CAUGHT);
+    }
+
+    // Handlers read at fixed offsets, so the data must be long enough first.
+    if (msg->data_length < msg_handler->min_length) {
+      fprintf(stderr, "Error: message too short.\n");
+      RLC_THROW(ERR_CAUGHT);
+    }
+
+    if (msg_handler->handler(state, socket, msg->data, msg->data_length) != RLC_OK) {
+      RLC_THROW(ERR_CAUGHT);
+    }
+  } RLC_CATCH_ANY {
+    result_status = RLC_ERR;
+  } RLC_FINALLY {
+    set_avma(av);
+  }
+
+  return result_status;
+}
+
+// Runs the handler of a message that belongs to one of Bob's payments.
+// Whatever the handler leaves on the PARI stack is garbage once it returns.
+int bob_handle_message(bob_state_t state, void *socket, const message_st *msg) {
+  if (state == NULL || msg == NULL) {
+    RLC_THROW(ERR_NO_VALID);
+  }
+
+  int result_status = RLC_OK;
+  pari_sp av = avma;
+
+  RLC_TRY {
+    if (msg->opcode == MSG_ERROR) {
+      fprintf(stderr, "Error: the peer could not handle the request.\n");
+      RLC_THROW(ERR_CAUGHT);
+    }
+
+    const bob_msg_handler_st *msg_handler = bob_get_message_handler(msg->opcode);
+    if (msg_handler == NULL) {
+      fprintf(stderr, "Error: invalid message type.\n");
+      RLC_THROW(ERR_CAUGHT);
+    }
+
+    // Handlers read at fixed offsets, so the data must be long enough first.
+    if (msg->data_length < msg_handler->min_length) {
+      fprintf(stderr, "Error: message too short.\n");
+      RLC_THROW(ERR_CAUGHT);
+    }
+
+    if (msg_handler->handler(state, socket, msg->data, msg->data_length) != RLC_OK) {
+      RLC_THROW(ERR_CAUGHT);
+    }
+  } RLC_CATCH_ANY {
+    result_status = RLC_ERR;
+  } RLC_FINALLY {
+    set_avma(av);
+  }
+
+  return result_status;
+}
+
+int registration(alice_state_t state, void *socket) {
+  if (state == NULL) {
+    RLC_THROW(ERR_NO_VALID);
+  }
+  
+  int result_status = RLC_OK;
+
+  bn_t q;
+  bn_null(q);
+
+  pedersen_com_zk_proof_t com_zk_proof;
+  pedersen_com_zk_proof_null(com_zk_proof);
+
+  RLC_TRY {
+    bn_new(q);
+    pedersen_com_zk_proof_new(com_zk_proof);
+
+    ec_curve_get_ord(q);
+    bn_rand_mod(state->tid, q);
+
+    if (pedersen_commit(state->pcom, state->pdecom, state->party->tumbler_ps_pk->Y_1, state->tid) != RLC_OK) {
+      RLC_THROW(ERR_CAUGHT);
+    }
+
+    if (zk_pedersen_com_prove(com_zk_proof, state->party->tumbler_ps_pk->Y_1, state->pcom, state->pdecom) != RLC_OK) {
+      RLC_THROW(ERR_CAUGHT);
+    }
+
+    // Build the message in place, header first.
+    const uint16_t msg_type = MSG_REGISTRATION;
+    const unsigned msg_data_length = (2 * RLC_G1_SIZE_COMPRESSED) + (2 * RLC_BN_SIZE);
+    zmq_msg_t registration;
+    uint8_t *msg_data;
+    if (message_build(&registration, &msg_data, msg_type, state->session_id, msg_data_length) != RLC_OK) {
+      fprintf(stderr, "Error: could not initialize the message (%s).\n", message_name(msg_type));
+      RLC_THROW(ERR_CAUGHT);
+    }
+
+    // Serialize the message.
+    g1_write_bin(msg_data, RLC_G1_SIZE_COMPRESSED, state->pcom->c, 1);
+    g1_write_bin(msg_data + RLC_G1_SIZE_COMPRESSED, RLC_G1_SIZE_COMPRESSED, com_zk_proof->c->c, 1);
+    bn_write_bin(msg_data + (2 * RLC_G1_SIZE_COMPRESSED), RLC_BN_SIZE, com_zk_proof->u);
+    bn_write_bin(msg_data + (2 * RLC_G1_SIZE_COMPRESSED) + RLC_BN_SIZE, RLC_BN_SIZE, com_zk_proof->v);
+
+    // Send the message.
+    if (message_send_dealer(&registration, socket, ZMQ_DONTWAIT) != RLC_OK) {
+      fprintf(stderr, "Error: could not send the message (%s).\n", message_name(msg_type));
+      RLC_THROW(ERR_CAUGHT);
+    }
+  } RLC_CATCH_ANY {
+    result_status = RLC_ERR;
+  } RLC_FINALLY {
+    bn_free(q);
+    pedersen_com_zk_proof_free(com_zk_proof);
+  }
+
+  return result_status;
+}
+
+int registration_done_handler(alice_state_t state, void *socket, uint8_t *data, uint32_t data_length) {
+  if (state == NULL || data == NULL) {
+    RLC_THROW(ERR_NO_VALID);
+  }
+
+  int result_status = RLC_OK;
+
+  bn_t q, t;
+  bn_null(q);
+  bn_null(t);
+
+  RLC_TRY {
+    bn_new(q);
+    bn_new(t);
+
+    // Deserialize the data from the message.
+    g1_read_bin(state->sigma_tid->sigma_1, data, RLC_G1_SIZE_COMPRESSED);
+    g1_read_bin(state->sigma_tid->sigma_2, data + RLC_G1_SIZE_COMPRESSED, RLC_G1_SIZE_COMPRESSED);
+
+    if (ps_unblind(state->sigma_tid, state->pdecom) != RLC_OK) {
+      RLC_THROW(ERR_CAUGHT);
+    }
+
+    if (ps_verify(state->sigma_tid, state->tid, state->party->tumbler_ps_pk) != RLC_OK) {
+      RLC_THROW(ERR_CAUGHT);
+    }
+    
+    g1_get_ord(q);
+    bn_rand_mod(t, q);
+
+    g1_mul(state->sigma_tid->sigma_1, state->sigma_tid->sigma_1, t);
+    g1_mul(state->sigma_tid->sigma_2, state->sigma_tid->sigma_2, t);
+    state->registration_completed = 1;
+  } RLC_CATCH_ANY {
+    result_status = RLC_ERR;
+  } RLC_FINALLY {
+    bn_free(q);
+    bn_free(t);
+  }
+
+  return result_status;
+}
+
+int token_share(alice_state_t state, void *socket) {
+  if (state == NULL) {
+    RLC_THROW(ERR_NO_VALID);
+  }
+
+  int result_status = RLC_OK;
+
+  RLC_TRY {
+    // Build the message in place, header first.
+    const uint16_t msg_type = MSG_TOKEN_SHARE;
+    const unsigned msg_data_length = RLC_BN_SIZE + (2 * RLC_G1_SIZE_COMPRESSED) + RLC_SESSION_ID_SIZE;
+    zmq_msg_t token_share;
+    uint8_t *msg_data;
+    if (message_build(&token_share, &msg_data, msg_type, state->session_id, msg_data_length) != RLC_OK) {
+      fprintf(stderr, "Error: could not initialize the message (%s).\n", message_name(msg_type));
+      RLC_THROW(ERR_CAUGHT);
+    }
+
+    // Serialize the data for the message.
+    bn_write_bin(msg_data, RLC_BN_SIZE, state->tid);
+    g1_write_bin(msg_data + RLC_BN_SIZE, RLC_G1_SIZE_COMPRESSED, state->sigma_tid->sigma_1, 1);
+    g1_write_bin(msg_data + RLC_BN_SIZE + RLC_G1_SIZE_COMPRESSED, RLC_G1_SIZE_COMPRESSED, state->sigma_tid->sigma_2, 1);
+
+    // Bob names the payment by this identifier when he shares the puzzle.
+    memcpy(msg_data + RLC_BN_SIZE + (2 * RLC_G1_SIZE_COMPRESSED), state->session_id, RLC_SESSION_ID_SIZE);
+
+    // Send the message.
+    if (message_send_dealer(&token_share, socket, ZMQ_DONTWAIT) != RLC_OK) {
+      fprintf(stderr, "Error: could not send the message (%s).\n", message_name(msg_type));
+      RLC_THROW(ERR_CAUGHT);
+    }
+  } RLC_CATCH_ANY {
+    result_status = RLC_ERR;
+  }
+ 
+  return result_status;
+}
+
+int puzzle_share_handler(alice_state_t state, void *socket, uint8_t *data, uint32_t data_length) {
+  if (state == NULL || data == NULL) {
+    RLC_THROW(ERR_NO_VALID);
+  }
+
+  int result_status = RLC_OK;
+
+  RLC_TRY {
+    // Deserialize the data from the message.
+    ec_read_bin(state->g_to_the_alpha_times_beta, data, RLC_EC_SIZE_COMPRESSED);
+    
+    memcpy(state->ctx_alpha_times_beta, data + RLC_EC_SIZE_COMPRESSED, sizeof(state->ctx_alpha_times_beta));
+
+    // Build the message in place, header first.
+    const uint16_t msg_type = MSG_PUZZLE_SHARE_DONE;
+    const unsigned msg_data_length = 0;
+    zmq_msg_t puzzle_share_done;
+    uint8_t *msg_data;
+    if (message_build(&puzzle_share_done, &msg_data, msg_type, state->session_id, msg_data_length) != RLC_OK) {
+      fprintf(stderr, "Error: could not initialize the message (%s).\n", message_name(msg_type));
+      RLC_THROW(ERR_CAUGHT);
+    }
+
+    // Send the message.
+    if (message_send(&puzzle_share_done, socket, ZMQ_DONTWAIT) != RLC_OK) {
+      fprintf(stderr, "Error: could not send the message (%s).\n", message_name(msg_type));
+      RLC_THROW(ERR_CAUGHT);
+    }
+
+    state->puzzle_shared = 1;
+  } RLC_CATCH_ANY {
+    result_status = RLC_ERR;
+  }
+
+  return result_status;
+}
+
+int payment_init(alice_state_t state, void *socket) {
+  if (state == NULL) {
+    RLC_THROW(ERR_NO_VALID);
+  }
+
+  int result_status = RLC_OK;
+
+  // NOTE: Commented parts are for doubly randomized version.
+  //cl_ciphertext_t ctx_alpha_times_beta_times_tau;
+  //bn_t q;
+
+  //cl_ciphertext_null(ctx_alpha_times_beta_times_tau);
+  //bn_null(q);
+
+  RLC_TRY {
+    // cl_ciphertext_new(ctx_alpha_times_beta_times_tau);
+    // bn_new(q);
+    // ec_curve_get_ord(q);
+
+    // Homomorphically randomize the challenge ciphertext.
+    // GEN tau_prime = randomi(state->party->cl_params->bound);
+    // bn_read_str(state->tau, GENtostr(tau_prime), strlen(GENtostr(tau_prime)), 10);
+    // bn_mod(state->tau, state->tau, q);
+    // ec_mul(state->g_to_the_alpha_times_beta_times_tau, state->g_to_the_alpha_times_beta, state->tau);
+
+    // const unsigned tau_str_len = bn_size_str(state->tau, 10);
+    // char tau_str[tau_str_len];
+    // bn_write_str(tau_str, tau_str_len, state->tau, 10);
+
+    // GEN plain_tau = strtoi(tau_str);
+    // ctx_alpha_times_beta_times_tau->c1 = nupow(state->ctx_alpha_times_beta->c1, plain_tau, NULL);
+    // ctx_alpha_times_beta_times_tau->c2 = nupow(state->ctx_alpha_times_beta->c2, plain_tau, NULL);
+
+    if (adaptor_ecdsa_sign(state->sigma_hat_s,
+                           tx,
+                           sizeof(tx),
+                           state->g_to_the_alpha_times_beta, //state->g_to_the_alpha_times_beta_times_tau,
+                           state->party->ec_sk) != RLC_OK) {
+      RLC_THROW(ERR_CAUGHT);
+    }
+
+    // Build the message in place, header first.
+    const uint16_t msg_type = MSG_PAYMENT_INIT;
+    const unsigned msg_data_length = (2 * RLC_BN_SIZE) + (2 * RLC_CL_CIPHERTEXT_SIZE);
+    zmq_msg_t payment_init;
+    uint8_t *msg_data;
+    if (message_build(&payment_init, &msg_data, msg_type, state->session_id, msg_data_length) != RLC_OK) {
+      fprintf(stderr, "Error: could not initialize the message (%s).\n", message_name(msg_type));
+      RLC_THROW(ERR_CAUGHT);
+    }
+
+    // Serialize the data for the message.
+    bn_write_bin(msg_data, RLC_BN_SIZE, state->sigma_hat_s->r);
+    bn_write_bin(msg_data + RLC_BN_SIZE, RLC_BN_SIZE, state->sigma_hat_s->s);
+    memcpy(msg_data + (2 * RLC_BN_SIZE), state->ctx_alpha_times_beta, sizeof(state->ctx_alpha_times_beta)); //ctx_alpha_times_beta_times_tau
+
+    // Send the message.
+    if (message_send_dealer(&payment_init, socket, ZMQ_DONTWAIT) != RLC_OK) {
+      fprintf(stderr, "Error: could not send the message (%s).\n", message_name(msg_type));
+      RLC_THROW(ERR_CAUGHT);
+    }
+  } RLC_CATCH_ANY {
+    result_status = RLC_ERR;
+  } RLC_FINALLY {
+    //cl_ciphertext_free(ctx_alpha_times_beta_times_tau);
+    //bn_free(q);
+  }
+
+  return result_status;
+}
+
+int payment_done_handler(alice_state_t state, void *socket, uint8_t *data, uint32_t data_length) {
+  if (state == NULL || data == NULL) {
+    RLC_THROW(ERR_NO_VALID);
+  }
+
+  int result_status = RLC_OK;
+
+  bn_t q, x, sigma_s_inverse, gamma; //tau_inverse
+  ec_t g_to_the_gamma;
+
+  bn_null(q);
+  bn_null(x);
+  bn_null(sigma_s_inverse);
+  bn_null(gamma);
+  //bn_null(tau_inverse);
+  ec_null(g_to_the_gamma);
+
+  RLC_TRY {
+    bn_new(q);
+    bn_new(x);
+    bn_new(sigma_s_inverse);
+    bn_new(gamma);
+    //bn_new(tau_inverse);
+    ec_new(g_to_the_gamma);
+
+    ec_curve_get_ord(q);
+
+    // Deserialize the data from the message.
+    bn_read_bin(state->sigma_s->r, data, RLC_BN_SIZE);
+    bn_read_bin(state->sigma_s->s, data + RLC_BN_SIZE, RLC_BN_SIZE);
+
+    // Extract the secret value.
+    bn_gcd_ext(x, sigma_s_inverse, NULL, state->sigma_s->s, q);
+    if (bn_sign(sigma_s_inverse) == RLC_NEG) {
+      bn_add(sigma_s_inverse, sigma_s_inverse, q);
+    }
+
+		bn_mul(gamma, sigma_s_inverse, state->sigma_hat_s->s);
+		bn_mod(gamma, gamma, q);
+
+    // Verify the extracted secret.
+    ec_mul_gen(g_to_the_gamma, gamma);
+    if (ec_cmp(state->g_to_the_alpha_times_beta, g_to_the_gamma) != RLC_EQ) { // state->g_to_the_alpha_times_beta_times_tau
+      RLC_THROW(ERR_CAUGHT);
+    }
+
+    // Derandomize the extracted secret.
+    // bn_gcd_ext(x, tau_inverse, NULL, state->tau, q);
+    // if (bn_sign(tau_inverse) == RLC_NEG) {
+    //   bn_add(tau_inverse, tau_inverse, q);
+    // }
+
+    // bn_mul(state->alpha_hat, gamma, tau_inverse);
+    // bn_mod(state->alpha_hat, state->alpha_hat, q);
+    bn_copy(state->alpha_hat, gamma);
+
+    state->puzzle_solved = 1;
+  } RLC_CATCH_ANY {
+    result_status = RLC_ERR;
+  } RLC_FINALLY {
+    bn_free(q);
+    bn_free(x);
+    bn_free(sigma_s_inverse);
+    //bn_free(tau_inverse);
+    ec_free(g_to_the_gamma);
+  }
+ 
+  return result_status;
+}
+
+int puzzle_solution_share(alice_state_t state, void *socket) {
+  if (state == NULL) {
+    RLC_THROW(ERR_NO_VALID);
+  }
+
+  int result_status = RLC_OK;
+
+  RLC_TRY {
+    // Build the message in place, header first.
+    const uint16_t msg_type = MSG_PUZZLE_SOLUTION_SHARE;
+    const unsigned msg_data_length = RLC_BN_SIZE;
+    zmq_msg_t puzzle_solution_share;
+    uint8_t *msg_data;
+    if (message_build(&puzzle_solution_share, &msg_data, msg_type, state->session_id, msg_data_length) != RLC_OK) {
+      fprintf(stderr, "Error: could not initialize the message (%s).\n", message_name(msg_type));
+      RLC_THROW(ERR_CAUGHT);
+    }
+
+    // Serialize the data for the message.
+    bn_write_bin(msg_data, RLC_BN_SIZE, state->alpha_hat);
+
+    // Send the message.
+    if (message_send_dealer(&puzzle_solution_share, socket, ZMQ_DONTWAIT) != RLC_OK) {
+      fprintf(stderr, "Error: could not send the message (%s).\n", message_name(msg_type));
+      RLC_THROW(ERR_CAUGHT);
+    }
+  } RLC_CATCH_ANY {
+    result_status = RLC_ERR;
+  }
+
+  return result_status;
+}
+
+int token_share_handler(bob_state_t state, void *socket, uint8_t *data, uint32_t data_length) {
+  if (state == NULL || data == NULL) {
+    RLC_THROW(ERR_NO_VALID);
+  }
+
+  int result_status = RLC_OK;
+
+  RLC_TRY {    
+    // Deserialize the data from the message.
+    bn_read_bin(state->tid, data, RLC_BN_SIZE);
+    g1_read_bin(state->sigma_tid->sigma_1, data + RLC_BN_SIZE, RLC_G1_SIZE_COMPRESSED);
+    g1_read_bin(state->sigma_tid->sigma_2, data + RLC_BN_SIZE + RLC_G1_SIZE_COMPRESSED, RLC_G1_SIZE_COMPRESSED);
+
+    // Alice looks the payment up by her own identifier. Bob keeps his for the
+    // tumbler, where the promise and her payment are separate sessions.
+    memcpy(state->alice_session_id, data + RLC_BN_SIZE + (2 * RLC_G1_SIZE_COMPRESSED), RLC_SESSION_ID_SIZE);
+
+    state->token_received = 1;
+  } RLC_CATCH_ANY {
+    result_status = RLC_ERR;
+  }
+
+  return result_status;
+}
+
+int promise_init(bob_state_t state, void *socket) {
+  if (state == NULL) {
+    RLC_THROW(ERR_NO_VALID);
+  }
+
+  int result_status = RLC_OK;
+
+  RLC_TRY {
+    if (cp_ecdsa_sig(state->sigma_r->r, state->sigma_r->s, tx, sizeof(tx), 0, state->party->ec_sk->sk) != RLC_OK) {
+      RLC_THROW(ERR_CAUGHT);
+    }
+
+    // Build the message in place, header first.
+    const uint16_t msg_type = MSG_PROMISE_INIT;
+    const unsigned msg_data_length = (2 * RLC_G1_SIZE_COMPRESSED) + (3 * RLC_BN_SIZE);
+    zmq_msg_t promise_init;
+    uint8_t *msg_data;
+    if (message_build(&promise_init, &msg_data, msg_type, state->session_id, msg_data_length) != RLC_OK) {
+      fprintf(stderr, "Error: could not initialize the message (%s).\n", message_name(msg_type));
+      RLC_THROW(ERR_CAUGHT);
+    }
+
+    // Serialize the message.
+    bn_write_bin(msg_data, RLC_BN_SIZE, state->tid);
+    g1_write_bin(msg_data + RLC_BN_SIZE, RLC_G1_SIZE_COMPRESSED, state->sigma_tid->sigma_1, 1);
+    g1_write_bin(msg_data + RLC_BN_SIZE + RLC_G1_SIZE_COMPRESSED, RLC_G1_SIZE_COMPRESSED, state->sigma_tid->sigma_2, 1);
+    bn_write_bin(msg_data + RLC_BN_SIZE + (2 * RLC_G1_SIZE_COMPRESSED), RLC_BN_SIZE, state->sigma_r->r);
+    bn_write_bin(msg_data + (2 * RLC_BN_SIZE) + (2 * RLC_G1_SIZE_COMPRESSED), RLC_BN_SIZE, state->sigma_r->s);
+
+    // Send the message.
+    if (message_send_dealer(&promise_init, socket, ZMQ_DONTWAIT) != RLC_OK) {
+      fprintf(stderr, "Error: could not send the message (%s).\n", message_name(msg_type));
+      RLC_THROW(ERR_CAUGHT);
+    }
+  } RLC_CATCH_ANY {
+    result_status = RLC_ERR;
+  }
+
+  return result_status;
+}
+
+int promise_done_handler(bob_state_t state, void *socket, uint8_t *data, uint32_t data_length) {
+  if (state == NULL || data == NULL) {
+    RLC_THROW(ERR_NO_VALID);
+  }
+
+  int result_status = RLC_OK;
+
+  cl_ciphertext_t ctx_alpha;
+  zk_proof_cldl_t pi_cldl;
+
+  cl_ciphertext_null(ctx_alpha);
+  zk_proof_cldl_null(pi_cldl);
+
+  RLC_TRY {
+    cl_ciphertext_new(ctx_alpha);
+    zk_proof_cldl_new(pi_cldl);
+
+    // Deserialize the data from the message.
+    ec_read_bin(state->g_to_the_alpha, data, RLC_EC_SIZE_COMPRESSED);
+    bn_read_bin(state->sigma_t->r, data + RLC_EC_SIZE_COMPRESSED, RLC_BN_SIZE);
+    bn_read_bin(state->sigma_t->s, data + RLC_EC_SIZE_COMPRESSED + RLC_BN_SIZE, RLC_BN_SIZE);
+    ec_read_bin(state->sigma_t->R, data + RLC_EC_SIZE_COMPRESSED + (2 * RLC_BN_SIZE), RLC_EC_SIZE_COMPRESSED);
+    ec_read_bin(state->sigma_t->pi->a, data + (2 * RLC_EC_SIZE_COMPRESSED) + (2 * RLC_BN_SIZE), RLC_EC_SIZE_COMPRESSED);
+    ec_read_bin(state->sigma_t->pi->b, data + (3 * RLC_EC_SIZE_COMPRESSED) + (2 * RLC_BN_SIZE), RLC_EC_SIZE_COMPRESSED);
+    bn_read_bin(state->sigma_t->pi->z, data + (4 * RLC_EC_SIZE_COMPRESSED) + (2 * RLC_BN_SIZE), RLC_BN_SIZE);
+
+    ctx_alpha->c1 = cl_qfi_read_bin(data + (4 * RLC_EC_SIZE_COMPRESSED) + (3 * RLC_BN_SIZE), RLC_CL_CIPHERTEXT_SIZE, state->party->cl_params);
+    ctx_alpha->c2 = cl_qfi_read_bin(data + (4 * RLC_EC_SIZE_COMPRESSED) + (3 * RLC_BN_SIZE) + RLC_CL_CIPHERTEXT_SIZE, RLC_CL_CIPHERTEXT_SIZE, state->party->cl_params);
+    if (ctx_alpha->c1 == NULL || ctx_alpha->c2 == NULL) {
+      RLC_THROW(ERR_NO_VALID);
+    }
+
+    pi_cldl->t1 = cl_qfi_read_bin(data + (4 * RLC_EC_SIZE_COMPRESSED) + (3 * RLC_BN_SIZE) + (2 * RLC_CL_CIPHERTEXT_SIZE), RLC_CLDL_PROOF_T1_SIZE, state->party->cl_params);
+    ec_read_bin(pi_cldl->t2, data + (4 * RLC_EC_SIZE_COMPRESSED) + (3 * RLC_BN_SIZE) + (2 * RLC_CL_CIPHERTEXT_SIZE) 
+              + RLC_CLDL_PROOF_T1_SIZE, RLC_EC_SIZE_COMPRESSED);
+    pi_cldl->t3 = cl_qfi_read_bin(data + (5 * RLC_EC_SIZE_COMPRESSED) + (3 * RLC_BN_SIZE) + (2 * RLC_CL_CIPHERTEXT_SIZE) 
+                                  + RLC_CLDL_PROOF_T1_SIZE, RLC_CLDL_PROOF_T3_SIZE, state->party->cl_params);
+    pi_cldl->u1 = cl_int_read_bin(data + (5 * RLC_EC_SIZE_COMPRESSED) + (3 * RLC_BN_SIZE) + (2 * RLC_CL_CIPHERTEXT_SIZE) 
+                                  + RLC_CLDL_PROOF_T1_SIZE + RLC_CLDL_PROOF_T3_SIZE, RLC_CLDL_PROOF_U1_SIZE);
+    pi_cldl->u2 = cl_int_read_bin(data + (5 * RLC_EC_SIZE_COMPRESSED) + (3 * RLC_BN_SIZE) + (2 * RLC_CL_CIPHERTEXT_SIZE) 
+                                  + RLC_CLDL_PROOF_T1_SIZE + RLC_CLDL_PROOF_T3_SIZE + RLC_CLDL_PROOF_U1_SIZE, RLC_CLDL_PROOF_U2_SIZE);
+
+    // Verify ZK proofs.
+    if (zk_cldl_verify(pi_cldl, state->g_to_the_alpha, ctx_alpha, state->party->tumbler_cl_pk, state->party->cl_params) != RLC_OK) {
+      RLC_THROW(ERR_CAUGHT);
+    }
+
+    if (adaptor_ecdsa_preverify(state->sigma_t, tx, sizeof(tx), state->g_to_the_alpha, state->party->tumbler_ec_pk) != 1) {
+      RLC_THROW(ERR_CAUGHT);
+    }
+
+    // The verified puzzle waits for puzzle_share in its wire encoding.
+    memcpy(state->ctx_alpha, data + (4 * RLC_EC_SIZE_COMPRESSED) + (3 * RLC_BN_SIZE), sizeof(state->ctx_alpha));
+    state->promise_completed = 1;
+  } RLC_CATCH_ANY {
+    result_status = RLC_ERR;
+  } RLC_FINALLY {
+    cl_ciphertext_free(ctx_alpha);
+    zk_proof_cldl_free(pi_cldl);
+  }
+
+  return result_status;
+}
+
+int puzzle_share(bob_state_t state, void *socket) {
+  if (state == NULL) {
+    RLC_THROW(ERR_NO_VALID);
+  }
+  
+  int result_status = RLC_OK;
+
+  cl_ciphertext_t ctx_alpha;
+  cl_ciphertext_t ctx_alpha_times_beta;
+  ec_t g_to_the_alpha_times_beta;
+
+  cl_ciphertext_null(ctx_alpha);
+  cl_ciphertext_null(ctx_alpha_times_beta);
+  ec_null(g_to_the_alpha_times_beta);
+
+  RLC_TRY {
+    cl_ciphertext_new(ctx_alpha);
+    cl_ciphertext_new(ctx_alpha_times_beta);
+    ec_new(g_to_the_alpha_times_beta);
+
+    ctx_alpha->c1 = cl_qfi_read_bin(state->ctx_alpha, RLC_CL_CIPHERTEXT_SIZE, state->party->cl_params);
+    ctx_alpha->c2 = cl_qfi_read_bin(state->ctx_alpha + RLC_CL_CIPHERTEXT_SIZE, RLC_CL_CIPHERTEXT_SIZE, state->party->cl_params);
+    if (ctx_alpha->c1 == NULL || ctx_alpha->c2 == NULL) {
+      RLC_THROW(ERR_NO_VALID);
+    }
+
+    // Randomize the promise challenge.
+    if (cl_blinding_factor_sample(state->beta, state->beta_inverse, state->party->cl_params) != RLC_OK) {
+      RLC_THROW(ERR_CAUGHT);
+    }
+
+    ec_mul(g_to_the_alpha_times_beta, state->g_to_the_alpha, state->beta);
+    ec_norm(g_to_the_alpha_times_beta, g_to_the_alpha_times_beta);
+
+    // Homomorphically randomize the challenge ciphertext, both halves at once.
+    if (cl_ciphertext_pow(ctx_alpha_times_beta, ctx_alpha, state->beta, state->party->pow_pool, state->party->cl_params) != RLC_OK) {
+      RLC_THROW(ERR_CAUGHT);
+    }
+
+    // Build the message in place, header first.
+    const uint16_t msg_type = MSG_PUZZLE_SHARE;
+    const unsigned msg_data_length = RLC_EC_SIZE_COMPRESSED + (2 * RLC_CL_CIPHERTEXT_SIZE);
+    zmq_msg_t puzzle_share;
+    uint8_t *msg_data;
+    if (message_build(&puzzle_share, &msg_data, msg_type, state->alice_session_id, msg_data_length) != RLC_OK) {
+      fprintf(stderr, "Error: could not initialize the message (%s).\n", message_name(msg_type));
+      RLC_THROW(ERR_CAUGHT);
+    }
+
+    // Serialize the data for the message.
+    ec_write_bin(msg_data, RLC_EC_SIZE_COMPRESSED, g_to_the_alpha_times_beta, 1);
+    cl_qfi_write_bin(msg_data + RLC_EC_SIZE_COMPRESSED, RLC_CL_CIPHERTEXT_SIZE, ctx_alpha_times_beta->c1);
+    cl_qfi_write_bin(msg_data + RLC_EC_SIZE_COMPRESSED + RLC_CL_CIPHERTEXT_SIZE, RLC_CL_CIPHERTEXT_SIZE, ctx_alpha_times_beta->c2);
+
+    // Send the message.
+    if (message_send_dealer(&puzzle_share, socket, ZMQ_DONTWAIT) != RLC_OK) {
+      fprintf(stderr, "Error: could not send the message (%s).\n", message_name(msg_type));
+      RLC_THROW(ERR_CAUGHT);
+    }
+  } RLC_CATCH_ANY {
+    result_status = RLC_ERR;
+  } RLC_FINALLY {
+    cl_ciphertext_free(ctx_alpha);
+    cl_ciphertext_free(ctx_alpha_times_beta);
+    ec_free(g_to_the_alpha_times_beta);
+  }
+
+  return result_status;
+}
+
+int puzzle_share_done_handler(bob_state_t state, void *socket, uint8_t *data, uint32_t data_length) {
+  if (state == NULL || data == NULL) {
+    RLC_THROW(ERR_NO_VALID);
+  }
+
+  state->puzzle_shared = 1;
+  return RLC_OK;
+}
+
+int puzzle_solution_share_handler(bob_state_t state, void *socket, uint8_t *data, uint32_t data_length) {
+  if (state == NULL || data == NULL) {
+    RLC_THROW(ERR_NO_VALID);
+  }
+
+  int result_status = RLC_OK;
+
+  bn_t x, q, alpha, alpha_hat, alpha_inverse;
+
+  bn_null(x);
+  bn_null(q);
+  bn_null(alpha);
+  bn_null(alpha_hat);
+  bn_null(alpha_inverse);
+
+  RLC_TRY {
+    bn_new(x);
+    bn_new(q);
+    bn_new(alpha);
+    bn_new(alpha_hat);
+    bn_new(alpha_inverse);
+    
+    // Deserialize the data from the message.
+    bn_read_bin(alpha_hat, data, RLC_BN_SIZE);
+
+    ec_curve_get_ord(q);
+
+    // Extract the secret alpha, beta was inverted when it was sampled.
+    bn_mul(alpha, alpha_hat, state->beta_inverse);
+    bn_mod(alpha, alpha, q);
+
+    // Complete the "almost" signature.
+    bn_gcd_ext(x, alpha_inverse, NULL, alpha, q);
+    if (bn_sign(alpha_inverse) == RLC_NEG) {
+      bn_add(alpha_inverse, alpha_inverse, q);
+    }
+
+    bn_mul(state->sigma_t->s, state->sigma_t->s, alpha_inverse);
+    bn_mod(state->sigma_t->s, state->sigma_t->s, q);
+
+    // Verify the completed signature.
+    if (cp_ecdsa_ver(state->sigma_t->r, state->sigma_t->s, tx, sizeof(tx), 0, state->party->tumbler_ec_pk->pk) != 1) {
+      RLC_THROW(ERR_CAUGHT);
+    }
+    state->puzzle_solved = 1;
+  } RLC_CATCH_ANY {
+    result_status = RLC_ERR;
+  } RLC_FINALLY {
+    bn_free(x);
+    bn_free(q);
+    bn_free(alpha)
+    bn_free(alpha_hat);
+    bn_free(alpha_inverse);
+  }
+
+  return result_status;
+}
@@ -0,0 +1,301 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "relic/relic.h"
+#include "spent_tokens.h"
+
+typedef struct {
+  char magic[8];
+  uint64_t record_size;
+  uint64_t count;
+} spent_tokens_header_st;
+
+static uint64_t spent_tokens_mix(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return x;
+}
+
+// Token identifiers are chosen by the clients, keyed for the same reason as
+// the session table. A tid is not a whole number of words, the bytes past the
+// last full one are hashed as a zero-padded word.
+static uint64_t spent_tokens_hash(const spent_tokens_t index, const uint8_t *tid) {
+  uint64_t h = 0;
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= RLC_BN_SIZE; i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, tid + i, sizeof(uint64_t));
+    h = spent_tokens_mix(h ^ word ^ index->key[(i / sizeof(uint64_t)) & 1]);
+  }
+  if (i < RLC_BN_SIZE) {
+    uint64_t word = 0;
+    memcpy(&word, tid + i, RLC_BN_SIZE - i);
+    h = spent_tokens_mix(h ^ word ^ index->key[(i / sizeof(uint64_t)) & 1]);
+  }
+  return h;
+}
+
+// Records past the end of what was written read as zeros, and no token has a
+// zero tid.
+static int spent_tokens_written(const uint8_t *record) {
+  for (size_t i = 0; i < RLC_BN_SIZE; i++) {
+    if (record[i] != 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static size_t spent_tokens_reserved(void) {
+  return SPENT_TOKENS_HEADER_SIZE + SPENT_TOKENS_MAX_RECORDS * RLC_BN_SIZE;
+}
+
+static uint8_t *spent_tokens_record(const spent_tokens_t index, size_t r) {
+  return index->log + SPENT_TOKENS_HEADER_SIZE + r * RLC_BN_SIZE;
+}
+
+static uint64_t *spent_tokens_block(const spent_tokens_t index, uint64_t h) {
+  const size_t block = (size_t) (h >> 32) & (index->bloom_blocks - 1);
+  return index->bloom + block * SPENT_TOKENS_BLOOM_BLOCK_WORDS;
+}
+
+// Each probe takes 9 bits of a second hash: 3 pick the word, 6 the bit.
+static void spent_tokens_bloom_add(spent_tokens_t index, uint64_t h) {
+  uint64_t *block = spent_tokens_block(index, h);
+  uint64_t bits = spent_tokens_mix(h ^ index->key[1]);
+  for (int i = 0; i < SPENT_TOKENS_BLOOM_HASHES; i++, bits >>= 9) {
+    block[(bits >> 6) & (SPENT_TOKENS_BLOOM_BLOCK_WORDS - 1)] |= (uint64_t) 1 << (bits & 63);
+  }
+}
+
+static int spent_tokens_bloom_test(const spent_tokens_t index, uint64_t h) {
+  const uint64_t *block = spent_tokens_block(index, h);
+  uint64_t bits = spent_tokens_mix(h ^ index->key[1]);
+  for (int i = 0; i < SPENT_TOKENS_BLOOM_HASHES; i++, bits >>= 9) {
+    if ((block[(bits >> 6) & (SPENT_TOKENS_BLOOM_BLOCK_WORDS - 1)] & ((uint64_t) 1 << (bits & 63))) == 0) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static void spent_tokens_place(spent_tokens_t index, size_t r, uint64_t h) {
+  const size_t mask = index->capacity - 1;
+  size_t i = h & mask;
+  while (index->slots[i] != 0) {
+    i = (i + 1) & mask;
+  }
+  index->slots[i] = (uint32_t) (r + 1);
+  spent_tokens_bloom_add(index, h);
+}
+
+static int spent_tokens_rehash(spent_tokens_t index, size_t capacity) {
+  const size_t bloom_blocks = capacity / SPENT_TOKENS_BLOOM_SLOTS_PER_BLOCK;
+  uint32_t *slots = calloc(capacity, sizeof(uint32_t));
+  uint64_t *bloom = calloc(bloom_blocks * SPENT_TOKENS_BLOOM_BLOCK_WORDS, sizeof(uint64_t));
+  if (slots == NULL || bloom == NULL) {
+    free(slots);
+    free(bloom);
+    return RLC_ERR;
+  }
+
+  free(index->slots);
+  free(index->bloom);
+  index->slots = slots;
+  index->bloom = bloom;
+  index->capacity = capacity;
+  index->bloom_blocks = bloom_blocks;
+
+  for (size_t r = 0; r < index->count; r++) {
+    const uint8_t *record = spent_tokens_record(index, r);
+    if (spent_tokens_written(record)) {
+      spent_tokens_place(index, r, spent_tokens_hash(index, record));
+    }
+  }
+  return RLC_OK;
+}
+
+// The file is extended sparsely, the mapping already covers the new records.
+static int spent_tokens_grow(spent_tokens_t index) {
+  size_t records = index->log_records + RLC_MAX(index->log_records, SPENT_TOKENS_LOG_GROWTH);
+  if (records > SPENT_TOKENS_MAX_RECORDS) {
+    records = SPENT_TOKENS_MAX_RECORDS;
+  }
+  if (records == index->log_records) {
+    return RLC_ERR;
+  }
+
+  if (ftruncate(index->fd, (off_t) (SPENT_TOKENS_HEADER_SIZE + records * RLC_BN_SIZE)) != 0) {
+    return RLC_ERR;
+  }
+  index->log_records = records;
+  return RLC_OK;
+}
+
+// Called with the lock held, which is released while the log is synced. Every
+// record inserted so far goes to disk before the count that covers them, so a
+// crash in between loses tids that were never acknowledged rather than
+// inventing any. Only the thread syncing writes the count in the header.
+static void spent_tokens_flush(spent_tokens_t index) {
+  const size_t page = (size_t) sysconf(_SC_PAGESIZE);
+  const size_t from = index->durable;
+  const size_t to = index->count;
+  const size_t start = (SPENT_TOKENS_HEADER_SIZE + from * RLC_BN_SIZE) / page * page;
+  const size_t end = SPENT_TOKENS_HEADER_SIZE + to * RLC_BN_SIZE;
+  spent_tokens_header_st *header = (spent_tokens_header_st *) index->log;
+
+  index->syncing = 1;
+  pthread_mutex_unlock(&index->lock);
+
+  int synced = msync(index->log + start, end - start, MS_SYNC) == 0;
+  if (synced) {
+    header->count = to;
+    synced = msync(index->log, SPENT_TOKENS_HEADER_SIZE, MS_SYNC) == 0;
+  }
+
+  pthread_mutex_lock(&index->lock);
+  index->syncing = 0;
+  if (synced) {
+    index->durable = to;
+  } else {
+    // As with the session log, nothing says what reached the disk, so every
+    // later insert is refused instead of acknowledged.
+    index->failed = 1;
+  }
+  pthread_cond_broadcast(&index->synced);
+}
+
+int spent_tokens_open(spent_tokens_t index, const char *path) {
+  int result_status = RLC_OK;
+
+  RLC_TRY {
+    index->fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (index->fd < 0) {
+      RLC_THROW(ERR_NO_FILE);
+    }
+
+    struct stat file_stat;
+    if (fstat(index->fd, &file_stat) != 0) {
+      RLC_THROW(ERR_NO_READ);
+    }
+
+    uint8_t *log = mmap(NULL, spent_tokens_reserved(), PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_NORESERVE, index->fd, 0);
+    if (log == MAP_FAILED) {
+      RLC_THROW(ERR_NO_MEMORY);
+    }
+    index->log = log;
+
+    spent_tokens_header_st *header = (spent_tokens_header_st *) index->log;
+    if (file_stat.st_size == 0) {
+      if (spent_tokens_grow(index) != RLC_OK) {
+        RLC_THROW(ERR_NO_BUFFER);
+      }
+      memcpy(header->magic, SPENT_TOKENS_MAGIC, sizeof(header->magic));
+      header->record_size = RLC_BN_SIZE;
+      header->count = 0;
+    } else {
+      if ((size_t) file_stat.st_size < SPENT_TOKENS_HEADER_SIZE
+      ||  memcmp(header->magic, SPENT_TOKENS_MAGIC, sizeof(header->magic)) != 0
+      ||  header->record_size != RLC_BN_SIZE) {
+        RLC_THROW(ERR_NO_VALID);
+      }
+
+      index->log_records = ((size_t) file_stat.st_size - SPENT_TOKENS_HEADER_SIZE) / RLC_BN_SIZE;
+      if (header->count > index->log_records) {
+        RLC_THROW(ERR_NO_VALID);
+      }
+    }
+    index->count = header->count;
+    index->durable = header->count;
+
+    size_t capacity = SPENT_TOKENS_INITIAL_CAPACITY;
+    while (4 * (index->count + 1) > 3 * capacity) {
+      capacity *= 2;
+    }
+    if (spent_tokens_rehash(index, capacity) != RLC_OK) {
+      RLC_THROW(ERR_NO_MEMORY);
+    }
+  } RLC_CATCH_ANY {
+    fprintf(stderr, "Error: could not open the spent-token log %s.\n", path);
+    result_status = RLC_ERR;
+  }
+
+  return result_status;
+}
+
+void spent_tokens_close(spent_tokens_t index) {
+  if (index->log != NULL) {
+    munmap(index->log, spent_tokens_reserved());
+    index->log = NULL;
+  }
+  if (index->fd >= 0) {
+    close(index->fd);
+    index->fd = -1;
+  }
+}
+
+int spent_tokens_insert(spent_tokens_t index, const uint8_t *tid) {
+  const uint64_t h = spent_tokens_hash(index, tid);
+
+  pthread_mutex_lock(&index->lock);
+
+  if (index->failed) {
+    pthread_mutex_unlock(&index->lock);
+    fprintf(stderr, "Error: the spent-token log failed to sync earlier.\n");
+    return RLC_ERR;
+  }
+
+  // Fresh tokens are the common case. Once the filter rules a tid out, the
+  // probe only looks for an empty slot and never touches the log.
+  const int maybe_spent = spent_tokens_bloom_test(index, h);
+  const size_t mask = index->capacity - 1;
+  for (size_t i = h & mask; index->slots[i] != 0; i = (i + 1) & mask) {
+    if (maybe_spent && memcmp(spent_tokens_record(index, index->slots[i] - 1), tid, RLC_BN_SIZE) == 0) {
+      pthread_mutex_unlock(&index->lock);
+      return RLC_ERR;
+    }
+  }
+
+  if ((index->count == index->log_records && spent_tokens_grow(index) != RLC_OK)
+  ||  (4 * (index->count + 1) > 3 * index->capacity && spent_tokens_rehash(index, 2 * index->capacity) != RLC_OK)) {
+    pthread_mutex_unlock(&index->lock);
+    fprintf(stderr, "Error: could not grow the spent-token index.\n");
+    return RLC_ERR;
+  }
+
+  const size_t r = index->count;
+  memcpy(spent_tokens_record(index, r), tid, RLC_BN_SIZE);
+  spent_tokens_place(index, r, h);
+  index->count++;
+
+  // Other threads already see the tid as spent, only this caller waits for it
+  // to reach the disk before answering. Whoever finds no sync in progress
+  // syncs for everyone who inserted so far.
+  while (index->durable <= r && !index->failed) {
+    if (index->syncing) {
+      pthread_cond_wait(&index->synced, &index->lock);
+    } else {
+      spent_tokens_flush(index);
+    }
+  }
+
+  const int durable = index->durable > r;
+  pthread_mutex_unlock(&index->lock);
+
+  if (!durable) {
+    fprintf(stderr, "Error: could not sync the spent-token log.\n");
+    return RLC_ERR;
+  }
+  return RLC_OK;
+}
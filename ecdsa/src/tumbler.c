@@ -1,3 +1,9 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -5,58 +11,249 @@
 #include "relic/relic.h"
 #include "pari/pari.h"
 #include "zmq.h"
+#include "batcher.h"
+#include "puzzle_pool.h"
+#include "session.h"
+#include "session_log.h"
 #include "tumbler.h"
 #include "types.h"
 #include "util.h"
 
-int get_message_type(char *key) {
-  for (size_t i = 0; i < TOTAL_MESSAGES; i++) {
-    symstruct_t sym = msg_lookuptable[i];
-    if (strcmp(sym.key, key) == 0) {
-      return sym.code;
-    }
+volatile sig_atomic_t TERMINATED;
+
+void termination_handler(int signum) {
+  TERMINATED = 1;
+}
+
+void tumbler_session_release(void *session) {
+  tumbler_session_t tumbler_session = (tumbler_session_t) session;
+  tumbler_session_free(tumbler_session);
+}
+
+// Only an adaptor signature carries R and the proof of its discrete log.
+static uint8_t *tumbler_signature_write(uint8_t *record, const ecdsa_signature_t signature, int with_proof) {
+  bn_write_bin(record, RLC_BN_SIZE, signature->r);
+  bn_write_bin(record + RLC_BN_SIZE, RLC_BN_SIZE, signature->s);
+  record += 2 * RLC_BN_SIZE;
+  if (with_proof) {
+    ec_write_bin(record, RLC_EC_SIZE_COMPRESSED, signature->R, 1);
+    ec_write_bin(record + RLC_EC_SIZE_COMPRESSED, RLC_EC_SIZE_COMPRESSED, signature->pi->a, 1);
+    ec_write_bin(record + (2 * RLC_EC_SIZE_COMPRESSED), RLC_EC_SIZE_COMPRESSED, signature->pi->b, 1);
+    bn_write_bin(record + (3 * RLC_EC_SIZE_COMPRESSED), RLC_BN_SIZE, signature->pi->z);
+    record += (3 * RLC_EC_SIZE_COMPRESSED) + RLC_BN_SIZE;
   }
-  return -1;
+  return record;
 }
 
-msg_handler_t get_message_handler(char *key) {
-  switch (get_message_type(key))
-  {
-    case REGISTRATION:
-      return registration_handler;
-    
-    case PROMISE_INIT:
-      return promise_init_handler;
+static const uint8_t *tumbler_signature_read(ecdsa_signature_t signature, const uint8_t *record, int with_proof) {
+  bn_read_bin(signature->r, record, RLC_BN_SIZE);
+  bn_read_bin(signature->s, record + RLC_BN_SIZE, RLC_BN_SIZE);
+  record += 2 * RLC_BN_SIZE;
+  if (with_proof) {
+    ec_read_bin(signature->R, record, RLC_EC_SIZE_COMPRESSED);
+    ec_read_bin(signature->pi->a, record + RLC_EC_SIZE_COMPRESSED, RLC_EC_SIZE_COMPRESSED);
+    ec_read_bin(signature->pi->b, record + (2 * RLC_EC_SIZE_COMPRESSED), RLC_EC_SIZE_COMPRESSED);
+    bn_read_bin(signature->pi->z, record + (3 * RLC_EC_SIZE_COMPRESSED), RLC_BN_SIZE);
+    record += (3 * RLC_EC_SIZE_COMPRESSED) + RLC_BN_SIZE;
+  }
+  return record;
+}
 
-    case PAYMENT_INIT:
-      return payment_init_handler;
+void tumbler_session_write(uint8_t *record, const tumbler_session_t session) {
+  memset(record, 0, TUMBLER_SESSION_RECORD_SIZE);
+  *record++ = session->kind;
+
+  if (session->kind == TUMBLER_SESSION_PROMISE) {
+    bn_write_bin(record, RLC_BN_SIZE, session->alpha);
+    record += RLC_BN_SIZE;
+    ec_write_bin(record, RLC_EC_SIZE_COMPRESSED, session->g_to_the_alpha, 1);
+    record += RLC_EC_SIZE_COMPRESSED;
+    memcpy(record, session->ctx_alpha, 2 * RLC_CL_CIPHERTEXT_SIZE);
+    record += 2 * RLC_CL_CIPHERTEXT_SIZE;
+    memcpy(record, session->pi_cldl, RLC_CLDL_PROOF_SIZE);
+    record += RLC_CLDL_PROOF_SIZE;
+    record = tumbler_signature_write(record, session->sigma_r, 0);
+    tumbler_signature_write(record, session->sigma_tr, 1);
+  } else {
+    bn_write_bin(record, RLC_BN_SIZE, session->gamma);
+    record += RLC_BN_SIZE;
+    record = tumbler_signature_write(record, session->sigma_s, 0);
+    tumbler_signature_write(record, session->sigma_ts, 0);
+  }
+}
 
-    default:
-      fprintf(stderr, "Error: invalid message type.\n");
-      exit(1);
+int tumbler_session_read(tumbler_session_t session, const uint8_t *record) {
+  const uint8_t kind = *record++;
+
+  if (kind == TUMBLER_SESSION_PROMISE) {
+    bn_read_bin(session->alpha, record, RLC_BN_SIZE);
+    record += RLC_BN_SIZE;
+    ec_read_bin(session->g_to_the_alpha, record, RLC_EC_SIZE_COMPRESSED);
+    record += RLC_EC_SIZE_COMPRESSED;
+    memcpy(session->ctx_alpha, record, 2 * RLC_CL_CIPHERTEXT_SIZE);
+    record += 2 * RLC_CL_CIPHERTEXT_SIZE;
+    memcpy(session->pi_cldl, record, RLC_CLDL_PROOF_SIZE);
+    record += RLC_CLDL_PROOF_SIZE;
+    record = tumbler_signature_read(session->sigma_r, record, 0);
+    tumbler_signature_read(session->sigma_tr, record, 1);
+  } else if (kind == TUMBLER_SESSION_PAYMENT) {
+    bn_read_bin(session->gamma, record, RLC_BN_SIZE);
+    record += RLC_BN_SIZE;
+    record = tumbler_signature_read(session->sigma_s, record, 0);
+    tumbler_signature_read(session->sigma_ts, record, 0);
+  } else {
+    return RLC_ERR;
   }
+  session->kind = kind;
+  return RLC_OK;
+}
+
+// Copies the session logged under an id into session, if there is one. Another
+// worker can expire and free the entry once the lock is released, so the copy
+// goes through its record. Otherwise session itself reserves the id as a
+// placeholder until the request settles it, and concurrent requests under the
+// same id are turned away rather than spending a token or decrypting twice.
+static int tumbler_session_reserve(tumbler_state_t state, const uint8_t *session_id,
+                                   tumbler_session_t session, int *found) {
+  uint8_t record[TUMBLER_SESSION_RECORD_SIZE];
+  int result_status = RLC_OK;
+
+  *found = 0;
+  pthread_mutex_lock(&state->sessions_lock);
+  const tumbler_session_t existing = session_get(state->sessions, session_id);
+  if (existing == NULL) {
+    session->kind = TUMBLER_SESSION_PENDING;
+    result_status = session_put(state->sessions, session_id, session);
+  } else if (existing->kind == TUMBLER_SESSION_PENDING) {
+    fprintf(stderr, "Error: session already in progress.\n");
+    result_status = RLC_ERR;
+  } else {
+    tumbler_session_write(record, existing);
+    *found = 1;
+  }
+  pthread_mutex_unlock(&state->sessions_lock);
+
+  if (*found && tumbler_session_read(session, record) != RLC_OK) {
+    result_status = RLC_ERR;
+  }
+  memzero(record, sizeof(record));
+
+  return result_status;
+}
+
+// Puts a logged session in place of the placeholder that reserved its id, or
+// only drops the placeholder so that the id can be tried again. Either way the
+// placeholder is released, unless it expired and the table released it.
+static int tumbler_session_settle(tumbler_state_t state, const uint8_t *session_id,
+                                  tumbler_session_t placeholder, tumbler_session_t session) {
+  int result_status = RLC_OK;
+
+  pthread_mutex_lock(&state->sessions_lock);
+  if (session_get(state->sessions, session_id) == placeholder) {
+    session_remove(state->sessions, session_id);
+    tumbler_session_release(placeholder);
+  }
+  if (session != NULL) {
+    result_status = session_put(state->sessions, session_id, session);
+  }
+  pthread_mutex_unlock(&state->sessions_lock);
+
+  return result_status;
+}
+
+// Replays a logged session into the table. Runs before the workers start.
+int tumbler_session_restore(void *arg, const uint8_t *id, long long written, const uint8_t *record) {
+  tumbler_state_t state = (tumbler_state_t) arg;
+  int result_status = RLC_OK;
+
+  tumbler_session_t session;
+  tumbler_session_null(session);
+
+  RLC_TRY {
+    tumbler_session_new(session);
+    if (tumbler_session_read(session, record) != RLC_OK) {
+      RLC_THROW(ERR_NO_VALID);
+    }
+
+    // While running, the tumbler turns away a second session under an id it
+    // holds, so the first record logged under an id is the one kept.
+    if (session_get(state->sessions, id) != NULL) {
+      fprintf(stderr, "Warning: skipped a second logged session under one id.\n");
+    } else {
+      // The restart does not extend the session, it expires when it would have.
+      if (session_put_until(state->sessions, id, session, written + SESSION_TIMEOUT) != RLC_OK) {
+        RLC_THROW(ERR_CAUGHT);
+      }
+      tumbler_session_null(session);
+    }
+  } RLC_CATCH_ANY {
+    result_status = RLC_ERR;
+  } RLC_FINALLY {
+    if (session != NULL) tumbler_session_free(session);
+  }
+
+  return result_status;
+}
+
+// Indexed by opcode, with the least data each handler reads. Messages this
+// party does not expect are left empty.
+static const msg_handler_st msg_handlers[MSG_OPCODES] = {
+  [MSG_REGISTRATION] = { registration_handler, (2 * RLC_G1_SIZE_COMPRESSED) + (2 * RLC_BN_SIZE) },
+  [MSG_PROMISE_INIT] = { promise_init_handler, (3 * RLC_BN_SIZE) + (2 * RLC_G1_SIZE_COMPRESSED) },
+  [MSG_PAYMENT_INIT] = { payment_init_handler, (2 * RLC_BN_SIZE) + (2 * RLC_CL_CIPHERTEXT_SIZE) },
+};
+
+const msg_handler_st *get_message_handler(const uint16_t opcode) {
+  return opcode < MSG_OPCODES && msg_handlers[opcode].handler != NULL ? &msg_handlers[opcode] : NULL;
 }
 
 int handle_message(tumbler_state_t state, void *socket, zmq_msg_t message) {
   int result_status = RLC_OK;
 
-  message_t msg;
-  message_null(msg);
+  message_st msg;
+  const uint8_t *session_id = NULL;
+
+  // Everything a handler leaves on the PARI stack is garbage once it returns.
+  pari_sp av = avma;
+
+  // Counted until the reply is out, so batches this request joins wait for it.
+  atomic_fetch_add(&state->busy_workers, 1);
 
   RLC_TRY {
     printf("Received message size: %ld bytes\n", zmq_msg_size(&message));
-    deserialize_message(&msg, (uint8_t *) zmq_msg_data(&message));
+    if (message_parse(&msg, &message) != RLC_OK) {
+      fprintf(stderr, "Error: malformed message.\n");
+      RLC_THROW(ERR_CAUGHT);
+    }
+    session_id = msg.session_id;
+
+    const msg_handler_st *msg_handler = get_message_handler(msg.opcode);
+    if (msg_handler == NULL) {
+      fprintf(stderr, "Error: invalid message type.\n");
+      RLC_THROW(ERR_CAUGHT);
+    }
+
+    // Handlers read at fixed offsets, so the data must be long enough first.
+    if (msg.data_length < msg_handler->min_length) {
+      fprintf(stderr, "Error: message too short.\n");
+      RLC_THROW(ERR_CAUGHT);
+    }
 
-    printf("Executing %s...\n", msg->type);
-    msg_handler_t msg_handler = get_message_handler(msg->type);
-    if (msg_handler(state, socket, msg->data) != RLC_OK) {
+    printf("Executing %s...\n", message_name(msg.opcode));
+    if (msg_handler->handler(state, socket, msg.session_id, msg.data, msg.data_length) != RLC_OK) {
       RLC_THROW(ERR_CAUGHT);
     }
-    printf("Finished executing %s.\n\n", msg->type);
+    printf("Finished executing %s.\n\n", message_name(msg.opcode));
   } RLC_CATCH_ANY {
     result_status = RLC_ERR;
+    // The client blocks until its request is answered, so a request that failed
+    // before its reply went out gets an error instead.
+    if (reply_pending(socket) && message_send_error(socket, session_id) != RLC_OK) {
+      fprintf(stderr, "Error: could not send the error reply.\n");
+    }
   } RLC_FINALLY {
-    if (msg != NULL) message_free(msg);
+    atomic_fetch_sub(&state->busy_workers, 1);
+    set_avma(av);
   }
 
   return result_status;
@@ -74,10 +271,23 @@ int receive_message(tumbler_state_t state, void *socket) {
       RLC_THROW(ERR_CAUGHT);
     }
 
-    rc = zmq_msg_recv(&message, socket, ZMQ_DONTWAIT);
-    if (rc != -1 && handle_message(state, socket, message) != RLC_OK) {
+    rc = wait_for_message(socket, RECEIVE_TIMEOUT);
+    if (rc < 0) {
+      fprintf(stderr, "Error: could not poll the socket.\n");
       RLC_THROW(ERR_CAUGHT);
     }
+
+    if (rc > 0) {
+      rc = zmq_msg_recv(&message, socket, 0);
+      if (rc < 0) {
+        fprintf(stderr, "Error: could not receive the message.\n");
+        RLC_THROW(ERR_CAUGHT);
+      }
+
+      if (handle_message(state, socket, message) != RLC_OK) {
+        RLC_THROW(ERR_CAUGHT);
+      }
+    }
   } RLC_CATCH_ANY {
     result_status = RLC_ERR;
   } RLC_FINALLY {
@@ -87,15 +297,238 @@ int receive_message(tumbler_state_t state, void *socket) {
   return result_status;
 }
 
-int registration_handler(tumbler_state_t state, void *socket, uint8_t *data) {
-  if (state == NULL || data == NULL) {
+void *worker_run(void *arg) {
+  tumbler_worker_t worker = (tumbler_worker_t) arg;
+  void *socket = NULL;
+
+  if (init_thread(&worker->pari_thread) != RLC_OK) {
+    fprintf(stderr, "Error: could not initialize the worker.\n");
+    TERMINATED = 1;
+    return NULL;
+  }
+
+  while (!TERMINATED) {
+    if (socket == NULL) {
+      socket = zmq_socket(worker->context, ZMQ_REP);
+      if (!socket) {
+        fprintf(stderr, "Error: could not create a socket.\n");
+        TERMINATED = 1;
+        break;
+      }
+
+      int linger = 0;
+      zmq_setsockopt(socket, ZMQ_LINGER, &linger, sizeof(linger));
+      if (zmq_connect(socket, TUMBLER_WORKERS_ENDPOINT) != 0) {
+        fprintf(stderr, "Error: could not connect to the tumbler.\n");
+        TERMINATED = 1;
+        break;
+      }
+    }
+
+    // A failed request is answered with an error. Only if even that could not be
+    // sent is the REP socket left expecting a reply, and then the worker
+    // reconnects with a fresh one.
+    if (receive_message(worker->state, socket) != RLC_OK) {
+      fprintf(stderr, "Error: could not handle the request.\n");
+      if (reply_pending(socket)) {
+        zmq_close(socket);
+        socket = NULL;
+      }
+    }
+  }
+
+  if (socket != NULL) {
+    zmq_close(socket);
+  }
+  clean_thread();
+
+  return NULL;
+}
+
+int verify_token(void *check) {
+  token_check_st *token_check = (token_check_st *) check;
+  return ps_verify(token_check->signature, *token_check->tid, token_check->public_key);
+}
+
+int verify_tokens(void **checks, size_t n) {
+  int result_status = RLC_OK;
+
+  ps_signature_t signatures[n];
+  bn_t tids[n];
+
+  for (size_t i = 0; i < n; i++) {
+    bn_null(tids[i]);
+  }
+
+  RLC_TRY {
+    for (size_t i = 0; i < n; i++) {
+      token_check_st *token_check = (token_check_st *) checks[i];
+      signatures[i] = token_check->signature;
+      bn_new(tids[i]);
+      bn_copy(tids[i], *token_check->tid);
+    }
+
+    // Every token in a batch is checked under the same key.
+    if (ps_batch_verify(signatures, tids, n, ((token_check_st *) checks[0])->public_key) != RLC_OK) {
+      RLC_THROW(ERR_CAUGHT);
+    }
+  } RLC_CATCH_ANY {
+    result_status = RLC_ERR;
+  } RLC_FINALLY {
+    for (size_t i = 0; i < n; i++) {
+      bn_free(tids[i]);
+    }
+  }
+
+  return result_status;
+}
+
+// Encrypts alpha with randomness from the reservoir, or with fresh randomness
+// when it is NULL.
+int puzzle_generate(tumbler_state_t state, cl_reservoir_t randomness, puzzle_st *puzzle) {
+  if (state == NULL || puzzle == NULL) {
     RLC_THROW(ERR_NO_VALID);
   }
 
   int result_status = RLC_OK;
 
-  message_t registration_done_msg;
-  uint8_t *serialized_message = NULL;
+  bn_t q, alpha;
+  ec_t g_to_the_alpha;
+  cl_ciphertext_t ctx_alpha;
+  zk_proof_cldl_t pi_cldl;
+
+  bn_null(q);
+  bn_null(alpha);
+  ec_null(g_to_the_alpha);
+  cl_ciphertext_null(ctx_alpha);
+  zk_proof_cldl_null(pi_cldl);
+
+  pari_sp av = avma;
+
+  RLC_TRY {
+    bn_new(q);
+    bn_new(alpha);
+    ec_new(g_to_the_alpha);
+    cl_ciphertext_new(ctx_alpha);
+    zk_proof_cldl_new(pi_cldl);
+
+    ec_curve_get_ord(q);
+    bn_rand_mod(alpha, q);
+    ec_mul_gen(g_to_the_alpha, alpha);
+
+    GEN plain_alpha = cl_int_from_bn(alpha);
+    if (cl_enc_from_reservoir(ctx_alpha, plain_alpha, randomness, state->tumbler_cl_pk, state->cl_params) != RLC_OK) {
+      RLC_THROW(ERR_CAUGHT);
+    }
+
+    if (zk_cldl_prove(pi_cldl, plain_alpha, ctx_alpha, state->tumbler_cl_pk, state->cl_params) != RLC_OK) {
+      RLC_THROW(ERR_CAUGHT);
+    }
+
+    // Serialize the puzzle in the order it is sent to Bob.
+    bn_write_bin(puzzle->alpha, RLC_BN_SIZE, alpha);
+    ec_write_bin(puzzle->g_to_the_alpha, RLC_EC_SIZE_COMPRESSED, g_to_the_alpha, 1);
+    cl_qfi_write_bin(puzzle->ctx_alpha, RLC_CL_CIPHERTEXT_SIZE, ctx_alpha->c1);
+    cl_qfi_write_bin(puzzle->ctx_alpha + RLC_CL_CIPHERTEXT_SIZE, RLC_CL_CIPHERTEXT_SIZE, ctx_alpha->c2);
+    cl_qfi_write_bin(puzzle->pi_cldl, RLC_CLDL_PROOF_T1_SIZE, pi_cldl->t1);
+    ec_write_bin(puzzle->pi_cldl + RLC_CLDL_PROOF_T1_SIZE, RLC_CLDL_PROOF_T2_SIZE, pi_cldl->t2, 1);
+    cl_qfi_write_bin(puzzle->pi_cldl + RLC_CLDL_PROOF_T1_SIZE + RLC_CLDL_PROOF_T2_SIZE,
+                     RLC_CLDL_PROOF_T3_SIZE, pi_cldl->t3);
+    cl_int_write_bin(puzzle->pi_cldl + RLC_CLDL_PROOF_T1_SIZE + RLC_CLDL_PROOF_T2_SIZE + RLC_CLDL_PROOF_T3_SIZE,
+                     RLC_CLDL_PROOF_U1_SIZE, pi_cldl->u1);
+    cl_int_write_bin(puzzle->pi_cldl + RLC_CLDL_PROOF_T1_SIZE + RLC_CLDL_PROOF_T2_SIZE + RLC_CLDL_PROOF_T3_SIZE
+                     + RLC_CLDL_PROOF_U1_SIZE, RLC_CLDL_PROOF_U2_SIZE, pi_cldl->u2);
+  } RLC_CATCH_ANY {
+    result_status = RLC_ERR;
+  } RLC_FINALLY {
+    bn_free(q);
+    bn_free(alpha);
+    ec_free(g_to_the_alpha);
+    cl_ciphertext_free(ctx_alpha);
+    zk_proof_cldl_free(pi_cldl);
+    set_avma(av);
+  }
+
+  return result_status;
+}
+
+void *puzzle_producer_run(void *arg) {
+  tumbler_worker_t producer = (tumbler_worker_t) arg;
+  puzzle_st puzzle;
+
+  // Workers fall back to generating puzzles inline, so the tumbler keeps
+  // serving requests without a producer, whether it failed here or could not
+  // be started at all.
+  if (init_thread(&producer->pari_thread) != RLC_OK) {
+    fprintf(stderr, "Error: could not initialize the puzzle producer.\n");
+    return NULL;
+  }
+
+  // Refill the pool only with cycles the workers leave idle.
+#ifdef SCHED_IDLE
+  struct sched_param param = { .sched_priority = 0 };
+  pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+#endif
+
+  // Off the request path the exponentiations cost idle cycles only, so the
+  // reservoir is left to the workers.
+  while (!TERMINATED) {
+    if (puzzle_generate(producer->state, NULL, &puzzle) != RLC_OK) {
+      fprintf(stderr, "Error: could not generate a puzzle.\n");
+      break;
+    }
+
+    // Blocks while the pool is full, and fails once it is closed.
+    if (puzzle_pool_put(producer->state->puzzles, &puzzle) != RLC_OK) {
+      break;
+    }
+  }
+
+  memzero(&puzzle, sizeof(puzzle));
+  clean_thread();
+
+  return NULL;
+}
+
+void *cl_reservoir_refiller_run(void *arg) {
+  tumbler_worker_t refiller = (tumbler_worker_t) arg;
+  cl_randomness_st entry;
+
+  // Encryptions fall back to computing r and its powers online.
+  if (init_thread(&refiller->pari_thread) != RLC_OK) {
+    fprintf(stderr, "Error: could not initialize the CL randomness refiller.\n");
+    return NULL;
+  }
+
+#ifdef SCHED_IDLE
+  struct sched_param param = { .sched_priority = 0 };
+  pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+#endif
+
+  while (!TERMINATED) {
+    if (cl_randomness_generate(&entry, refiller->state->tumbler_cl_pk, refiller->state->cl_params) != RLC_OK) {
+      fprintf(stderr, "Error: could not generate CL randomness.\n");
+      break;
+    }
+
+    // Sleeps once the reservoir is full until it drains to the low watermark.
+    if (cl_reservoir_put(refiller->state->randomness, &entry) != RLC_OK) {
+      break;
+    }
+  }
+
+  memzero(&entry, sizeof(entry));
+  clean_thread();
+
+  return NULL;
+}
+
+int registration_handler(tumbler_state_t state, void *socket, uint8_t *session_id, uint8_t *data, uint32_t data_length) {
+  if (state == NULL || session_id == NULL || data == NULL) {
+    RLC_THROW(ERR_NO_VALID);
+  }
+
+  int result_status = RLC_OK;
 
   pedersen_com_t com;
   pedersen_com_null(com);
@@ -125,32 +558,23 @@ int registration_handler(tumbler_state_t state, void *socket, uint8_t *data) {
       RLC_THROW(ERR_CAUGHT);
     }
 
-    // Build and define the message.
-    char *msg_type = "registration_done";
-    const unsigned msg_type_length = (unsigned) strlen(msg_type) + 1;
+    // Build the message in place, header first.
+    const uint16_t msg_type = MSG_REGISTRATION_DONE;
     const unsigned msg_data_length = 2 * RLC_G1_SIZE_COMPRESSED;
-    const int total_msg_length = msg_type_length + msg_data_length + (2 * sizeof(unsigned));
-    message_new(registration_done_msg, msg_type_length, msg_data_length);
-
-    // Serialize the data for the message.
-    g1_write_bin(registration_done_msg->data, RLC_G1_SIZE_COMPRESSED, sigma_prime->sigma_1, 1);
-    g1_write_bin(registration_done_msg->data + RLC_G1_SIZE_COMPRESSED, RLC_G1_SIZE_COMPRESSED, sigma_prime->sigma_2, 1);
-
-    memcpy(registration_done_msg->type, msg_type, msg_type_length);
-    serialize_message(&serialized_message, registration_done_msg, msg_type_length, msg_data_length);
-
-    // Send the message.
     zmq_msg_t registration_done;
-    int rc = zmq_msg_init_size(&registration_done, total_msg_length);
-    if (rc < 0) {
-      fprintf(stderr, "Error: could not initialize the message (%s).\n", msg_type);
+    uint8_t *msg_data;
+    if (message_build(&registration_done, &msg_data, msg_type, session_id, msg_data_length) != RLC_OK) {
+      fprintf(stderr, "Error: could not initialize the message (%s).\n", message_name(msg_type));
       RLC_THROW(ERR_CAUGHT);
     }
 
-    memcpy(zmq_msg_data(&registration_done), serialized_message, total_msg_length);
-    rc = zmq_msg_send(&registration_done, socket, ZMQ_DONTWAIT);
-    if (rc != total_msg_length) {
-      fprintf(stderr, "Error: could not send the message (%s).\n", msg_type);
+    // Serialize the data for the message.
+    g1_write_bin(msg_data, RLC_G1_SIZE_COMPRESSED, sigma_prime->sigma_1, 1);
+    g1_write_bin(msg_data + RLC_G1_SIZE_COMPRESSED, RLC_G1_SIZE_COMPRESSED, sigma_prime->sigma_2, 1);
+
+    // Send the message.
+    if (message_send(&registration_done, socket, ZMQ_DONTWAIT) != RLC_OK) {
+      fprintf(stderr, "Error: could not send the message (%s).\n", message_name(msg_type));
       RLC_THROW(ERR_CAUGHT);
     }
   } RLC_CATCH_ANY {
@@ -159,222 +583,332 @@ int registration_handler(tumbler_state_t state, void *socket, uint8_t *data) {
     pedersen_com_free(com);
     pedersen_com_zk_proof_free(com_zk_proof);
     ps_signature_free(sigma_prime);
-    if (registration_done_msg != NULL) message_free(registration_done_msg);
-    if (serialized_message != NULL) free(serialized_message);
   }
 
   return result_status;
 }
 
-int promise_init_handler(tumbler_state_t state, void *socket, uint8_t *data) {
-  if (state == NULL || data == NULL) {
+static int promise_done_send(void *socket, const uint8_t *session_id, const tumbler_session_t session) {
+  int result_status = RLC_OK;
+
+  RLC_TRY {
+    // Build the message in place, header first.
+    const uint16_t msg_type = MSG_PROMISE_DONE;
+    const unsigned msg_data_length = (5 * RLC_EC_SIZE_COMPRESSED) + (3 * RLC_BN_SIZE) + (2 * RLC_CL_CIPHERTEXT_SIZE) 
+    + RLC_CLDL_PROOF_T1_SIZE + RLC_CLDL_PROOF_T2_SIZE + RLC_CLDL_PROOF_T3_SIZE + RLC_CLDL_PROOF_U1_SIZE + RLC_CLDL_PROOF_U2_SIZE;
+    zmq_msg_t promise_done;
+    uint8_t *msg_data;
+    if (message_build(&promise_done, &msg_data, msg_type, session_id, msg_data_length) != RLC_OK) {
+      fprintf(stderr, "Error: could not initialize the message (%s).\n", message_name(msg_type));
+      RLC_THROW(ERR_CAUGHT);
+    }
+
+    // Serialize the data for the message.
+    ec_write_bin(msg_data, RLC_EC_SIZE_COMPRESSED, session->g_to_the_alpha, 1);
+    bn_write_bin(msg_data + RLC_EC_SIZE_COMPRESSED, RLC_BN_SIZE, session->sigma_tr->r);
+    bn_write_bin(msg_data + RLC_EC_SIZE_COMPRESSED + RLC_BN_SIZE, RLC_BN_SIZE, session->sigma_tr->s);
+    ec_write_bin(msg_data + RLC_EC_SIZE_COMPRESSED + (2 * RLC_BN_SIZE), RLC_EC_SIZE_COMPRESSED, session->sigma_tr->R, 1);
+    ec_write_bin(msg_data + (2 * RLC_EC_SIZE_COMPRESSED) + (2 * RLC_BN_SIZE), RLC_EC_SIZE_COMPRESSED, session->sigma_tr->pi->a, 1);
+    ec_write_bin(msg_data + (3 * RLC_EC_SIZE_COMPRESSED) + (2 * RLC_BN_SIZE), RLC_EC_SIZE_COMPRESSED, session->sigma_tr->pi->b, 1);
+    bn_write_bin(msg_data + (4 * RLC_EC_SIZE_COMPRESSED) + (2 * RLC_BN_SIZE), RLC_BN_SIZE, session->sigma_tr->pi->z);   
+    memcpy(msg_data + (4 * RLC_EC_SIZE_COMPRESSED) + (3 * RLC_BN_SIZE),
+           session->ctx_alpha, 2 * RLC_CL_CIPHERTEXT_SIZE);
+    memcpy(msg_data + (4 * RLC_EC_SIZE_COMPRESSED) + (3 * RLC_BN_SIZE) + (2 * RLC_CL_CIPHERTEXT_SIZE),
+           session->pi_cldl, RLC_CLDL_PROOF_SIZE);
+
+    // Send the message.
+    if (message_send(&promise_done, socket, ZMQ_DONTWAIT) != RLC_OK) {
+      fprintf(stderr, "Error: could not send the message (%s).\n", message_name(msg_type));
+      RLC_THROW(ERR_CAUGHT);
+    }
+  } RLC_CATCH_ANY {
+    result_status = RLC_ERR;
+  }
+
+  return result_status;
+}
+
+int promise_init_handler(tumbler_state_t state, void *socket, uint8_t *session_id, uint8_t *data, uint32_t data_length) {
+  if (state == NULL || session_id == NULL || data == NULL) {
     RLC_THROW(ERR_NO_VALID);
   }
 
   int result_status = RLC_OK;
 
-  message_t promise_done_msg;
-  uint8_t *serialized_message = NULL;
-
-  bn_t q, tid;
-  zk_proof_cldl_t pi_cldl;
+  bn_t tid;
   ps_signature_t sigma_tid;
+  tumbler_session_t session;
+  tumbler_session_t logged;
+  tumbler_session_t reserved;
+  int found, durable = 0;
+  puzzle_st puzzle;
+  uint8_t serialized_tid[RLC_BN_SIZE];
+  uint8_t record[TUMBLER_SESSION_RECORD_SIZE];
 
-  bn_null(q);
   bn_null(tid);
-  zk_proof_cldl_null(pi_cldl);
   ps_signature_null(sigma_tid);
+  tumbler_session_null(session);
+  tumbler_session_null(logged);
+  tumbler_session_null(reserved);
   
   RLC_TRY {
-    bn_new(q);
+    tumbler_session_new(session);
+    tumbler_session_new(logged);
     bn_new(tid);
-    zk_proof_cldl_new(pi_cldl);
     ps_signature_new(sigma_tid);
 
     // Deserialize the data from the message.
     bn_read_bin(tid, data, RLC_BN_SIZE);
     g1_read_bin(sigma_tid->sigma_1, data + RLC_BN_SIZE, RLC_G1_SIZE_COMPRESSED);
     g1_read_bin(sigma_tid->sigma_2, data + RLC_BN_SIZE + RLC_G1_SIZE_COMPRESSED, RLC_G1_SIZE_COMPRESSED);
-    bn_read_bin(state->sigma_r->r, data + RLC_BN_SIZE + (2 * RLC_G1_SIZE_COMPRESSED), RLC_BN_SIZE);
-    bn_read_bin(state->sigma_r->s, data + (2 * RLC_BN_SIZE) + (2 * RLC_G1_SIZE_COMPRESSED), RLC_BN_SIZE);
-
-    if (ps_verify(sigma_tid, tid, state->tumbler_ps_pk) != RLC_OK) {
-      RLC_THROW(ERR_CAUGHT);
+    bn_read_bin(session->sigma_r->r, data + RLC_BN_SIZE + (2 * RLC_G1_SIZE_COMPRESSED), RLC_BN_SIZE);
+    bn_read_bin(session->sigma_r->s, data + (2 * RLC_BN_SIZE) + (2 * RLC_G1_SIZE_COMPRESSED), RLC_BN_SIZE);
+
+    // A session logged under this id, possibly before a restart, is only
+    // answered again for a retry of the request that made it, which lost its
+    // reply. The token is spent already and nothing is recomputed. A new id is
+    // reserved before any work.
+    if (tumbler_session_reserve(state, session_id, logged, &found) != RLC_OK) {
+      RLC_THROW(ERR_NO_VALID);
     }
 
-    if (cp_ecdsa_ver(state->sigma_r->r, state->sigma_r->s, tx, sizeof(tx), 0, state->bob_ec_pk->pk) != 1) {
-      RLC_THROW(ERR_CAUGHT);
-    }
+    if (found) {
+      if (logged->kind != TUMBLER_SESSION_PROMISE
+      ||  bn_cmp(logged->sigma_r->r, session->sigma_r->r) != RLC_EQ
+      ||  bn_cmp(logged->sigma_r->s, session->sigma_r->s) != RLC_EQ) {
+        fprintf(stderr, "Error: session already exists.\n");
+        RLC_THROW(ERR_NO_VALID);
+      }
 
-    ec_curve_get_ord(q);
-    bn_rand_mod(state->alpha, q);
-    ec_mul_gen(state->g_to_the_alpha, state->alpha);
+      if (promise_done_send(socket, session_id, logged) != RLC_OK) {
+        RLC_THROW(ERR_CAUGHT);
+      }
+    } else {
+      // The placeholder belongs to the table until this request settles it.
+      reserved = logged;
+      tumbler_session_null(logged);
 
-    const unsigned alpha_str_len = bn_size_str(state->alpha, 10);
-    char alpha_str[alpha_str_len];
-    bn_write_str(alpha_str, alpha_str_len, state->alpha, 10);
+      token_check_st token_check = { sigma_tid, &tid, state->tumbler_ps_pk };
+      if (batcher_submit(state->tokens, &token_check) != RLC_OK) {
+        RLC_THROW(ERR_CAUGHT);
+      }
 
-    GEN plain_alpha = strtoi(alpha_str);
-    if (cl_enc(state->ctx_alpha, plain_alpha, state->tumbler_cl_pk, state->cl_params) != RLC_OK) {
-      RLC_THROW(ERR_CAUGHT);
-    }
+      if (cp_ecdsa_ver(session->sigma_r->r, session->sigma_r->s, tx, sizeof(tx), 0, state->bob_ec_pk->pk) != 1) {
+        RLC_THROW(ERR_CAUGHT);
+      }
 
-    if (zk_cldl_prove(pi_cldl, plain_alpha, state->ctx_alpha, state->tumbler_cl_pk, state->cl_params) != RLC_OK) {
-      RLC_THROW(ERR_CAUGHT);
-    }
+      // Only a valid request spends the token, and it stays spent even if the
+      // rest of the promise fails.
+      bn_write_bin(serialized_tid, RLC_BN_SIZE, tid);
+      if (spent_tokens_insert(state->spent_tokens, serialized_tid) != RLC_OK) {
+        fprintf(stderr, "Error: token already redeemed.\n");
+        RLC_THROW(ERR_NO_VALID);
+      }
 
-    if (adaptor_ecdsa_sign(state->sigma_tr, tx, sizeof(tx), state->g_to_the_alpha, state->tumbler_ec_sk) != RLC_OK) {
-      RLC_THROW(ERR_CAUGHT);
+      // The puzzle does not depend on the request, so it normally comes from
+      // the pool. An empty pool means a burst outran the producer, and the
+      // puzzle is encrypted here with randomness from the reservoir.
+      if (puzzle_pool_take(state->puzzles, &puzzle) != RLC_OK
+      &&  puzzle_generate(state, state->randomness, &puzzle) != RLC_OK) {
+        RLC_THROW(ERR_CAUGHT);
+      }
+
+      session->kind = TUMBLER_SESSION_PROMISE;
+      bn_read_bin(session->alpha, puzzle.alpha, RLC_BN_SIZE);
+      ec_read_bin(session->g_to_the_alpha, puzzle.g_to_the_alpha, RLC_EC_SIZE_COMPRESSED);
+      memcpy(session->ctx_alpha, puzzle.ctx_alpha, 2 * RLC_CL_CIPHERTEXT_SIZE);
+      memcpy(session->pi_cldl, puzzle.pi_cldl, RLC_CLDL_PROOF_SIZE);
+
+      if (adaptor_ecdsa_sign(session->sigma_tr, tx, sizeof(tx), session->g_to_the_alpha, state->tumbler_ec_sk) != RLC_OK) {
+        RLC_THROW(ERR_CAUGHT);
+      }
+
+      // The session is on disk before the client hears of it.
+      tumbler_session_write(record, session);
+      if (session_log_append(state->session_log, session_id, record) != RLC_OK) {
+        fprintf(stderr, "Error: could not log the session.\n");
+        RLC_THROW(ERR_CAUGHT);
+      }
+      durable = 1;
+
+      if (promise_done_send(socket, session_id, session) != RLC_OK) {
+        RLC_THROW(ERR_CAUGHT);
+      }
+
+      // Retries that came in meanwhile were turned away, from now on they get
+      // the logged reply.
+      const int rc = tumbler_session_settle(state, session_id, reserved, session);
+      tumbler_session_null(reserved);
+      if (rc != RLC_OK) {
+        fprintf(stderr, "Error: could not store the session.\n");
+        RLC_THROW(ERR_CAUGHT);
+      }
+      tumbler_session_null(session);
+    }
+  } RLC_CATCH_ANY {
+    result_status = RLC_ERR;
+  } RLC_FINALLY {
+    bn_free(tid);
+    ps_signature_free(sigma_tid);
+    memzero(&puzzle, sizeof(puzzle));
+    memzero(record, sizeof(record));
+    // A failed request frees its id for a retry, unless its session is logged
+    // already and answers the retry instead.
+    if (reserved != NULL
+    &&  tumbler_session_settle(state, session_id, reserved, durable ? session : NULL) == RLC_OK
+    &&  durable) {
+      tumbler_session_null(session);
     }
+    if (session != NULL) tumbler_session_free(session);
+    if (logged != NULL) tumbler_session_free(logged);
+  }
 
-    // Build and define the message.
-    char *msg_type = "promise_done";
-    const unsigned msg_type_length = (unsigned) strlen(msg_type) + 1;
-    const unsigned msg_data_length = (5 * RLC_EC_SIZE_COMPRESSED) + (3 * RLC_BN_SIZE) + (2 * RLC_CL_CIPHERTEXT_SIZE) 
-    + RLC_CLDL_PROOF_T1_SIZE + RLC_CLDL_PROOF_T2_SIZE + RLC_CLDL_PROOF_T3_SIZE + RLC_CLDL_PROOF_U1_SIZE + RLC_CLDL_PROOF_U2_SIZE;
-    const int total_msg_length = msg_type_length + msg_data_length + (2 * sizeof(unsigned));
-    message_new(promise_done_msg, msg_type_length, msg_data_length);
+  return result_status;
+}
 
-    // Serialize the data for the message.
-    ec_write_bin(promise_done_msg->data, RLC_EC_SIZE_COMPRESSED, state->g_to_the_alpha, 1);
-    bn_write_bin(promise_done_msg->data + RLC_EC_SIZE_COMPRESSED, RLC_BN_SIZE, state->sigma_tr->r);
-    bn_write_bin(promise_done_msg->data + RLC_EC_SIZE_COMPRESSED + RLC_BN_SIZE, RLC_BN_SIZE, state->sigma_tr->s);
-    ec_write_bin(promise_done_msg->data + RLC_EC_SIZE_COMPRESSED + (2 * RLC_BN_SIZE), RLC_EC_SIZE_COMPRESSED, state->sigma_tr->R, 1);
-    ec_write_bin(promise_done_msg->data + (2 * RLC_EC_SIZE_COMPRESSED) + (2 * RLC_BN_SIZE), RLC_EC_SIZE_COMPRESSED, state->sigma_tr->pi->a, 1);
-    ec_write_bin(promise_done_msg->data + (3 * RLC_EC_SIZE_COMPRESSED) + (2 * RLC_BN_SIZE), RLC_EC_SIZE_COMPRESSED, state->sigma_tr->pi->b, 1);
-    bn_write_bin(promise_done_msg->data + (4 * RLC_EC_SIZE_COMPRESSED) + (2 * RLC_BN_SIZE), RLC_BN_SIZE, state->sigma_tr->pi->z);   
-    memcpy(promise_done_msg->data + (4 * RLC_EC_SIZE_COMPRESSED) + (3 * RLC_BN_SIZE),
-           GENtostr(state->ctx_alpha->c1), RLC_CL_CIPHERTEXT_SIZE);
-    memcpy(promise_done_msg->data + (4 * RLC_EC_SIZE_COMPRESSED) + (3 * RLC_BN_SIZE) + RLC_CL_CIPHERTEXT_SIZE,
-           GENtostr(state->ctx_alpha->c2), RLC_CL_CIPHERTEXT_SIZE);
-    memcpy(promise_done_msg->data + (4 * RLC_EC_SIZE_COMPRESSED) + (3 * RLC_BN_SIZE) + (2 * RLC_CL_CIPHERTEXT_SIZE),
-           GENtostr(pi_cldl->t1), RLC_CLDL_PROOF_T1_SIZE);
-    ec_write_bin(promise_done_msg->data + (4 * RLC_EC_SIZE_COMPRESSED) + (3 * RLC_BN_SIZE) + (2 * RLC_CL_CIPHERTEXT_SIZE) 
-              + RLC_CLDL_PROOF_T1_SIZE, RLC_EC_SIZE_COMPRESSED, pi_cldl->t2, 1);
-    memcpy(promise_done_msg->data + (5 * RLC_EC_SIZE_COMPRESSED) + (3 * RLC_BN_SIZE) + (2 * RLC_CL_CIPHERTEXT_SIZE)
-           + RLC_CLDL_PROOF_T1_SIZE, GENtostr(pi_cldl->t3), RLC_CLDL_PROOF_T3_SIZE);
-    memcpy(promise_done_msg->data + (5 * RLC_EC_SIZE_COMPRESSED) + (3 * RLC_BN_SIZE) + (2 * RLC_CL_CIPHERTEXT_SIZE)
-           + RLC_CLDL_PROOF_T1_SIZE + RLC_CLDL_PROOF_T3_SIZE, GENtostr(pi_cldl->u1), RLC_CLDL_PROOF_U1_SIZE);
-    memcpy(promise_done_msg->data + (5 * RLC_EC_SIZE_COMPRESSED) + (3 * RLC_BN_SIZE) + (2 * RLC_CL_CIPHERTEXT_SIZE)
-           + RLC_CLDL_PROOF_T1_SIZE + RLC_CLDL_PROOF_T3_SIZE + RLC_CLDL_PROOF_U1_SIZE, GENtostr(pi_cldl->u2), RLC_CLDL_PROOF_U2_SIZE);
-
-    memcpy(promise_done_msg->type, msg_type, msg_type_length);
-    serialize_message(&serialized_message, promise_done_msg, msg_type_length, msg_data_length);
+static int payment_done_send(void *socket, const uint8_t *session_id, const tumbler_session_t session) {
+  int result_status = RLC_OK;
 
-    // Send the message.
-    zmq_msg_t promise_done;
-    int rc = zmq_msg_init_size(&promise_done, total_msg_length);
-    if (rc < 0) {
-      fprintf(stderr, "Error: could not initialize the message (%s).\n", msg_type);
+  RLC_TRY {
+    // Build the message in place, header first.
+    const uint16_t msg_type = MSG_PAYMENT_DONE;
+    const unsigned msg_data_length = 2 * RLC_BN_SIZE;
+    zmq_msg_t payment_done;
+    uint8_t *msg_data;
+    if (message_build(&payment_done, &msg_data, msg_type, session_id, msg_data_length) != RLC_OK) {
+      fprintf(stderr, "Error: could not initialize the message (%s).\n", message_name(msg_type));
       RLC_THROW(ERR_CAUGHT);
     }
 
-    memcpy(zmq_msg_data(&promise_done), serialized_message, total_msg_length);
-    rc = zmq_msg_send(&promise_done, socket, ZMQ_DONTWAIT);
-    if (rc != total_msg_length) {
-      fprintf(stderr, "Error: could not send the message (%s).\n", msg_type);
+    // Serialize the data for the message.
+    bn_write_bin(msg_data, RLC_BN_SIZE, session->sigma_s->r);
+    bn_write_bin(msg_data + RLC_BN_SIZE, RLC_BN_SIZE, session->sigma_s->s);
+
+    // Send the message.
+    if (message_send(&payment_done, socket, ZMQ_DONTWAIT) != RLC_OK) {
+      fprintf(stderr, "Error: could not send the message (%s).\n", message_name(msg_type));
       RLC_THROW(ERR_CAUGHT);
     }
   } RLC_CATCH_ANY {
     result_status = RLC_ERR;
-  } RLC_FINALLY {
-    bn_free(q);
-    bn_free(tid);
-    zk_proof_cldl_free(pi_cldl);
-    ps_signature_free(sigma_tid);
-    if (promise_done_msg != NULL) message_free(promise_done_msg);
-    if (serialized_message != NULL) free(serialized_message);
   }
 
   return result_status;
 }
 
-int payment_init_handler(tumbler_state_t state, void *socket, uint8_t *data) {
-  if (state == NULL || data == NULL) {
+int payment_init_handler(tumbler_state_t state, void *socket, uint8_t *session_id, uint8_t *data, uint32_t data_length) {
+  if (state == NULL || session_id == NULL || data == NULL) {
     RLC_THROW(ERR_NO_VALID);
   }
 
   int result_status = RLC_OK;
 
-  uint8_t *serialized_message = NULL;
-  message_t payment_done_msg;
-
   bn_t q, x, gamma_inverse;
   cl_ciphertext_t ctx_alpha_times_beta_times_tau;
+  tumbler_session_t session;
+  tumbler_session_t logged;
+  tumbler_session_t reserved;
+  int found, durable = 0;
+  uint8_t record[TUMBLER_SESSION_RECORD_SIZE];
 
   bn_null(q);
   bn_null(x);
   bn_null(gamma_inverse);
   cl_ciphertext_null(ctx_alpha_times_beta_times_tau);
-  message_null(payment_done_msg);
+  tumbler_session_null(session);
+  tumbler_session_null(logged);
+  tumbler_session_null(reserved);
 
   RLC_TRY {
+    tumbler_session_new(session);
+    tumbler_session_new(logged);
     bn_new(q);
     bn_new(x);
     bn_new(gamma_inverse);
     cl_ciphertext_new(ctx_alpha_times_beta_times_tau);
 
     // Deserialize the data from the message.
-    bn_read_bin(state->sigma_s->r, data, RLC_BN_SIZE);
-    bn_read_bin(state->sigma_s->s, data + RLC_BN_SIZE, RLC_BN_SIZE);
-
-    char ct_str[RLC_CL_CIPHERTEXT_SIZE];
-    memcpy(ct_str, data + (2 * RLC_BN_SIZE), RLC_CL_CIPHERTEXT_SIZE);
-    ctx_alpha_times_beta_times_tau->c1 = gp_read_str(ct_str);
-    memcpy(ct_str, data + (2 * RLC_BN_SIZE) + RLC_CL_CIPHERTEXT_SIZE, RLC_CL_CIPHERTEXT_SIZE);
-    ctx_alpha_times_beta_times_tau->c2 = gp_read_str(ct_str);
-
-    // Decrypt the ciphertext.
-    GEN gamma;
-    if (cl_dec(&gamma, ctx_alpha_times_beta_times_tau, state->tumbler_cl_sk, state->cl_params) != RLC_OK) {
-      RLC_THROW(ERR_CAUGHT);
-    }
-    bn_read_str(state->gamma, GENtostr(gamma), strlen(GENtostr(gamma)), 10);
+    bn_read_bin(session->sigma_s->r, data, RLC_BN_SIZE);
+    bn_read_bin(session->sigma_s->s, data + RLC_BN_SIZE, RLC_BN_SIZE);
 
     ec_curve_get_ord(q);
-    bn_gcd_ext(x, gamma_inverse, NULL, state->gamma, q);
-    if (bn_sign(gamma_inverse) == RLC_NEG) {
-      bn_add(gamma_inverse, gamma_inverse, q);
+
+    // As for promises, a retry of the payment logged under this id gets the
+    // logged reply, without decrypting again. Its pre-signature is the logged
+    // signature times gamma.
+    if (tumbler_session_reserve(state, session_id, logged, &found) != RLC_OK) {
+      RLC_THROW(ERR_NO_VALID);
     }
 
-    bn_mul(state->sigma_s->s, state->sigma_s->s, gamma_inverse);
-    bn_mod(state->sigma_s->s, state->sigma_s->s, q);
+    if (found) {
+      if (logged->kind == TUMBLER_SESSION_PAYMENT) {
+        bn_mul(x, logged->sigma_s->s, logged->gamma);
+        bn_mod(x, x, q);
+        bn_mod(session->sigma_s->s, session->sigma_s->s, q);
+      }
+      if (logged->kind != TUMBLER_SESSION_PAYMENT
+      ||  bn_cmp(logged->sigma_s->r, session->sigma_s->r) != RLC_EQ
+      ||  bn_cmp(x, session->sigma_s->s) != RLC_EQ) {
+        fprintf(stderr, "Error: session already exists.\n");
+        RLC_THROW(ERR_NO_VALID);
+      }
 
-    if (cp_ecdsa_ver(state->sigma_s->r, state->sigma_s->s, tx, sizeof(tx), 0, state->alice_ec_pk->pk) != 1) {
-      RLC_THROW(ERR_CAUGHT);
-    }
+      if (payment_done_send(socket, session_id, logged) != RLC_OK) {
+        RLC_THROW(ERR_CAUGHT);
+      }
+    } else {
+      // The placeholder belongs to the table until this request settles it.
+      reserved = logged;
+      tumbler_session_null(logged);
 
-    if (cp_ecdsa_sig(state->sigma_ts->r, state->sigma_ts->s, tx, sizeof(tx), 0, state->tumbler_ec_sk->sk) != RLC_OK) {
-      RLC_THROW(ERR_CAUGHT);
-    }
+      ctx_alpha_times_beta_times_tau->c1 = cl_qfi_read_bin(data + (2 * RLC_BN_SIZE), RLC_CL_CIPHERTEXT_SIZE, state->cl_params);
+      ctx_alpha_times_beta_times_tau->c2 = cl_qfi_read_bin(data + (2 * RLC_BN_SIZE) + RLC_CL_CIPHERTEXT_SIZE, RLC_CL_CIPHERTEXT_SIZE, state->cl_params);
 
-    // Build and define the message.
-    char *msg_type = "payment_done";
-    const unsigned msg_type_length = (unsigned) strlen(msg_type) + 1;
-    const unsigned msg_data_length = 2 * RLC_BN_SIZE;
-    const int total_msg_length = msg_type_length + msg_data_length + (2 * sizeof(unsigned));
-    message_new(payment_done_msg, msg_type_length, msg_data_length);
+      // Decrypt the ciphertext.
+      GEN gamma;
+      if (cl_dec(&gamma, ctx_alpha_times_beta_times_tau, state->tumbler_cl_sk, state->cl_params) != RLC_OK) {
+        RLC_THROW(ERR_CAUGHT);
+      }
+      cl_int_to_bn(session->gamma, gamma);
 
-    // Serialize the data for the message.
-    bn_write_bin(payment_done_msg->data, RLC_BN_SIZE, state->sigma_s->r);
-    bn_write_bin(payment_done_msg->data + RLC_BN_SIZE, RLC_BN_SIZE, state->sigma_s->s);
+      bn_gcd_ext(x, gamma_inverse, NULL, session->gamma, q);
+      if (bn_sign(gamma_inverse) == RLC_NEG) {
+        bn_add(gamma_inverse, gamma_inverse, q);
+      }
 
-    memcpy(payment_done_msg->type, msg_type, msg_type_length);
-    serialize_message(&serialized_message, payment_done_msg, msg_type_length, msg_data_length);
+      bn_mul(session->sigma_s->s, session->sigma_s->s, gamma_inverse);
+      bn_mod(session->sigma_s->s, session->sigma_s->s, q);
 
-    // Send the message.
-    zmq_msg_t payment_done;
-    int rc = zmq_msg_init_size(&payment_done, total_msg_length);
-    if (rc < 0) {
-      fprintf(stderr, "Error: could not initialize the message (%s).\n", msg_type);
-      RLC_THROW(ERR_CAUGHT);
-    }
+      if (cp_ecdsa_ver(session->sigma_s->r, session->sigma_s->s, tx, sizeof(tx), 0, state->alice_ec_pk->pk) != 1) {
+        RLC_THROW(ERR_CAUGHT);
+      }
 
-    memcpy(zmq_msg_data(&payment_done), serialized_message, total_msg_length);
-    rc = zmq_msg_send(&payment_done, socket, ZMQ_DONTWAIT);
-    if (rc != total_msg_length) {
-      fprintf(stderr, "Error: could not send the message (%s).\n", msg_type);
-      RLC_THROW(ERR_CAUGHT);
+      if (cp_ecdsa_sig(session->sigma_ts->r, session->sigma_ts->s, tx, sizeof(tx), 0, state->tumbler_ec_sk->sk) != RLC_OK) {
+        RLC_THROW(ERR_CAUGHT);
+      }
+
+      // The session is on disk before the client hears of it.
+      session->kind = TUMBLER_SESSION_PAYMENT;
+      tumbler_session_write(record, session);
+      if (session_log_append(state->session_log, session_id, record) != RLC_OK) {
+        fprintf(stderr, "Error: could not log the session.\n");
+        RLC_THROW(ERR_CAUGHT);
+      }
+      durable = 1;
+
+      if (payment_done_send(socket, session_id, session) != RLC_OK) {
+        RLC_THROW(ERR_CAUGHT);
+      }
+
+      // Retries that came in meanwhile were turned away, from now on they get
+      // the logged reply.
+      const int rc = tumbler_session_settle(state, session_id, reserved, session);
+      tumbler_session_null(reserved);
+      if (rc != RLC_OK) {
+        fprintf(stderr, "Error: could not store the session.\n");
+        RLC_THROW(ERR_CAUGHT);
+      }
+      tumbler_session_null(session);
     }
   } RLC_CATCH_ANY {
     result_status = RLC_ERR;
@@ -383,35 +917,106 @@ int payment_init_handler(tumbler_state_t state, void *socket, uint8_t *data) {
     bn_free(x);
     bn_free(gamma_inverse);
     cl_ciphertext_free(ctx_alpha_times_beta_times_tau);
-    if (payment_done_msg != NULL) message_free(payment_done_msg);
-    if (serialized_message != NULL) free(serialized_message);
+    memzero(record, sizeof(record));
+    // A failed request frees its id for a retry, unless its session is logged
+    // already and answers the retry instead.
+    if (reserved != NULL
+    &&  tumbler_session_settle(state, session_id, reserved, durable ? session : NULL) == RLC_OK
+    &&  durable) {
+      tumbler_session_null(session);
+    }
+    if (session != NULL) tumbler_session_free(session);
+    if (logged != NULL) tumbler_session_free(logged);
   }
 
   return result_status;
 }
 
-int main(void)
+static void usage(const char *name) {
+  fprintf(stderr, "Usage: %s [-w batching window in microseconds, 0 to disable]\n", name);
+}
+
+int main(int argc, char *argv[])
 {
+  long window = BATCHER_WINDOW;
+
+  int option;
+  char *end;
+  while ((option = getopt(argc, argv, "w:")) != -1) {
+    switch (option) {
+      case 'w':
+        // Only a whole number will do, strtol() alone reads "abc" as 0.
+        errno = 0;
+        window = strtol(optarg, &end, 10);
+        if (errno != 0 || end == optarg || *end != '\0') {
+          usage(argv[0]);
+          exit(1);
+        }
+        break;
+
+      default:
+        usage(argv[0]);
+        exit(1);
+    }
+  }
+
+  if (window < 0) {
+    usage(argv[0]);
+    exit(1);
+  }
+
   init();
   int result_status = RLC_OK;
+  TERMINATED = 0;
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = termination_handler;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
 
   tumbler_state_t state;
   tumbler_state_null(state);
 
-  // Bind the socket to talk to clients.
+  tumbler_worker_st producer;
+  int producer_started = 0;
+
+  tumbler_worker_st refiller;
+  int refiller_started = 0;
+
+  tumbler_worker_t workers = NULL;
+  long workers_count = sysconf(_SC_NPROCESSORS_ONLN);
+  long workers_started = 0;
+  if (workers_count < 1) {
+    workers_count = 1;
+  }
+
+  // Bind the socket to talk to clients, and the one to hand requests to workers.
   void *context = zmq_ctx_new();
   if (!context) {
     fprintf(stderr, "Error: could not create a context.\n");
     exit(1);
   }
   
-  void *socket = zmq_socket(context, ZMQ_REP);
-  if (!socket) {
+  void *frontend = zmq_socket(context, ZMQ_ROUTER);
+  if (!frontend) {
+    fprintf(stderr, "Error: could not create a socket.\n");
+    exit(1);
+  }
+
+  int rc = zmq_bind(frontend, TUMBLER_ENDPOINT);
+  if (rc != 0) {
+    fprintf(stderr, "Error: could not bind the socket.\n");
+    exit(1);
+  }
+
+  void *backend = zmq_socket(context, ZMQ_DEALER);
+  if (!backend) {
     fprintf(stderr, "Error: could not create a socket.\n");
     exit(1);
   }
 
-  int rc = zmq_bind(socket, TUMBLER_ENDPOINT);
+  rc = zmq_bind(backend, TUMBLER_WORKERS_ENDPOINT);
   if (rc != 0) {
     fprintf(stderr, "Error: could not bind the socket.\n");
     exit(1);
@@ -419,6 +1024,14 @@ int main(void)
 
   RLC_TRY {
     tumbler_state_new(state);
+    // A batch never waits for more checks than there are workers, and without
+    // a window every check is verified on its own.
+    const size_t batch_capacity = window > 0 ? (size_t) workers_count : 1;
+    batcher_new(state->tokens, batch_capacity, window, &state->busy_workers, verify_tokens, verify_token);
+
+    if (read_tables_from_file(state->cl_params) != RLC_OK) {
+      RLC_THROW(ERR_CAUGHT);
+    }
 
     if (generate_cl_params(state->cl_params) != RLC_OK) {
       RLC_THROW(ERR_CAUGHT);
@@ -435,18 +1048,122 @@ int main(void)
       RLC_THROW(ERR_CAUGHT);
     }
 
-    while (1) {
-      if (receive_message(state, socket) != RLC_OK) {
-        RLC_THROW(ERR_CAUGHT);
+    if (spent_tokens_open(state->spent_tokens, TUMBLER_SPENT_TOKENS_FILE) != RLC_OK) {
+      RLC_THROW(ERR_CAUGHT);
+    }
+
+    // Sessions logged before a restart come back with their CL work done.
+    if (session_log_open(state->session_log, TUMBLER_SESSION_LOG_FILE, tumbler_session_restore, state) != RLC_OK) {
+      RLC_THROW(ERR_CAUGHT);
+    }
+
+    // The CL public key is fixed for the lifetime of the tumbler.
+    if (cl_public_key_precompute(state->tumbler_cl_pk, state->cl_params) != RLC_OK) {
+      RLC_THROW(ERR_CAUGHT);
+    }
+
+    workers = calloc(workers_count, sizeof(tumbler_worker_st));
+    if (workers == NULL) {
+      RLC_THROW(ERR_NO_MEMORY);
+    }
+
+    // Only the main thread handles signals, the workers watch TERMINATED.
+    sigset_t signals, previous_signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, &previous_signals);
+
+    for (long i = 0; i < workers_count; i++) {
+      workers[i].state = state;
+      workers[i].context = context;
+      pari_thread_alloc(&workers[i].pari_thread, PARI_STACK_SIZE, NULL);
+      if (pthread_create(&workers[i].thread, NULL, worker_run, &workers[i]) != 0) {
+        pari_thread_free(&workers[i].pari_thread);
+        break;
       }
+      workers_started++;
+    }
+
+    producer.state = state;
+    producer.context = context;
+    pari_thread_alloc(&producer.pari_thread, PARI_STACK_SIZE, NULL);
+    if (pthread_create(&producer.thread, NULL, puzzle_producer_run, &producer) != 0) {
+      pari_thread_free(&producer.pari_thread);
+    } else {
+      producer_started = 1;
+    }
+
+    refiller.state = state;
+    refiller.context = context;
+    pari_thread_alloc(&refiller.pari_thread, PARI_STACK_SIZE, NULL);
+    if (pthread_create(&refiller.thread, NULL, cl_reservoir_refiller_run, &refiller) != 0) {
+      pari_thread_free(&refiller.pari_thread);
+    } else {
+      refiller_started = 1;
+    }
+    pthread_sigmask(SIG_SETMASK, &previous_signals, NULL);
+
+    // Neither helper is needed to serve requests: without the producer workers
+    // generate puzzles inline, and without the refiller those inline puzzles
+    // are encrypted with fresh randomness. Both only cost latency, so the
+    // tumbler runs on without them.
+    if (!producer_started) {
+      fprintf(stderr, "Warning: could not start the puzzle producer, puzzles are generated inline.\n");
+    }
+
+    if (!refiller_started) {
+      fprintf(stderr, "Warning: could not start the CL randomness refiller, encryptions sample their own.\n");
+    }
+
+    if (workers_started < workers_count) {
+      fprintf(stderr, "Error: could not start the workers.\n");
+      RLC_THROW(ERR_CAUGHT);
+    }
+    printf("Started %ld workers.\n\n", workers_started);
+
+    // Shuttle requests between clients and workers until interrupted.
+    rc = zmq_proxy(frontend, backend, NULL);
+    if (rc != 0 && !TERMINATED) {
+      fprintf(stderr, "Error: the proxy stopped unexpectedly.\n");
+      RLC_THROW(ERR_CAUGHT);
     }
   } RLC_CATCH_ANY {
     result_status = RLC_ERR;
   } RLC_FINALLY {
+    TERMINATED = 1;
+    if (state != NULL) puzzle_pool_close(state->puzzles);
+    if (state != NULL) cl_reservoir_close(state->randomness);
+    if (producer_started) {
+      pthread_join(producer.thread, NULL);
+      pari_thread_free(&producer.pari_thread);
+    }
+    if (refiller_started) {
+      pthread_join(refiller.thread, NULL);
+      pari_thread_free(&refiller.pari_thread);
+    }
+    for (long i = 0; i < workers_started; i++) {
+      pthread_join(workers[i].thread, NULL);
+      pari_thread_free(&workers[i].pari_thread);
+    }
+    if (workers != NULL) free(workers);
+    if (state != NULL) {
+      cl_reservoir_stats_st stats;
+      cl_reservoir_stats(state->randomness, &stats);
+      printf("CL randomness: %llu produced, %llu taken, %llu misses, %llu refills, %zu left.\n",
+             (unsigned long long) stats.produced, (unsigned long long) stats.taken,
+             (unsigned long long) stats.misses, (unsigned long long) stats.refills, stats.size);
+    }
     tumbler_state_free(state);
   }
 
-  rc = zmq_close(socket);
+  rc = zmq_close(frontend);
+  if (rc != 0) {
+    fprintf(stderr, "Error: could not close the socket.\n");
+    exit(1);
+  }
+
+  rc = zmq_close(backend);
   if (rc != 0) {
     fprintf(stderr, "Error: could not close the socket.\n");
     exit(1);
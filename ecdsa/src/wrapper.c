@@ -1,12 +1,42 @@
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+static double timeval_to_sec(struct timeval tv) {
+	return tv.tv_sec + tv.tv_usec / 1E6;
+}
+
+// Reaps a party and prints the CPU time it consumed against the wall-clock
+// time elapsed until it was reaped. An idle party blocked on its socket should
+// be close to 0%, while a busy-polling one sits at 100%.
+static void report_utilisation(const char *name, pid_t pid, struct timespec start_time) {
+	int status;
+	struct rusage usage;
+	struct timespec stop_time;
+
+	if (wait4(pid, &status, 0, &usage) == -1) {
+		fprintf(stderr, "Error: failed to wait for %s.\n", name);
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &stop_time);
+
+	double wall_time = (stop_time.tv_sec - start_time.tv_sec) + (stop_time.tv_nsec - start_time.tv_nsec) / 1E9;
+	double user_time = timeval_to_sec(usage.ru_utime);
+	double system_time = timeval_to_sec(usage.ru_stime);
+	printf("%s: user %.3f sec, system %.3f sec, wall %.3f sec, CPU utilisation %.1f%%\n",
+				 name, user_time, system_time, wall_time, 100.0 * (user_time + system_time) / wall_time);
+}
+
 int main(int argc, char *argv[]) {
 	pid_t alice, bob, tumbler;
+	struct timespec start_time;
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
 
 	tumbler = fork();
 	if (tumbler == 0) {
@@ -35,9 +65,10 @@ int main(int argc, char *argv[]) {
 		fprintf(stderr, "Error: failed to fork Bob.\n");
 		exit(1);
 	} else if (bob > 0) {
-		int status;
-		waitpid(bob, &status, 0);
+		report_utilisation("Bob", bob, start_time);
 		kill(tumbler, SIGINT);
+		report_utilisation("Alice", alice, start_time);
+		report_utilisation("Tumbler", tumbler, start_time);
 	} else {
 		char *args[] = { "./bob", NULL };
 		char *env[] = { NULL };
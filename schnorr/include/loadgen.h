@@ -0,0 +1,164 @@
+#ifndef A2L_SCHNORR_INCLUDE_LOADGEN
+#define A2L_SCHNORR_INCLUDE_LOADGEN
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "relic/relic.h"
+#include "pari/pari.h"
+#include "protocol.h"
+#include "session.h"
+#include "types.h"
+#include "util.h"
+
+#define LOADGEN_TUMBLER_ENDPOINT "tcp://localhost:8181"
+#define LOADGEN_MAX_CLIENTS 65536
+#define LOADGEN_MAX_WORKERS 256
+#define LOADGEN_WORKERS 4
+#define LOADGEN_PAYMENTS 8 // per client and concurrency level
+#define LOADGEN_TIMEOUT 60000 // in milliseconds, for each step of a payment
+#define LOADGEN_POLL_INTERVAL 100 // in milliseconds, between timeout sweeps
+
+// Latencies are recorded in microseconds into log-linear buckets: exact below
+// 2^LOADGEN_HISTOGRAM_SUB_BITS, then that many sub-buckets per power of two.
+#define LOADGEN_HISTOGRAM_SUB_BITS 3
+#define LOADGEN_HISTOGRAM_BUCKETS (64 << LOADGEN_HISTOGRAM_SUB_BITS)
+
+typedef enum {
+  PHASE_REGISTRATION,
+  PHASE_PROMISE,
+  PHASE_PUZZLE_SOLVE,
+  PHASE_PAYMENT,
+} phase_t;
+
+#define TOTAL_PHASES (PHASE_PAYMENT + 1)
+
+static const char *phase_names[] = {
+  "registration",
+  "promise",
+  "puzzle_solve",
+  "payment",
+};
+
+typedef struct {
+  uint64_t counts[LOADGEN_HISTOGRAM_BUCKETS];
+  uint64_t total;
+  long long sum;
+  long long max;
+} histogram_st;
+
+// Shared by every worker and only read once the workers are running. Every
+// simulated Alice uses Alice's keys and every Bob uses Bob's.
+typedef struct {
+  const char *endpoint;
+  long timeout;
+  unsigned payments;
+  unsigned workers;
+  party_t alice;
+  party_t bob;
+} loadgen_config_st;
+
+typedef loadgen_config_st *loadgen_config_t;
+
+#define loadgen_config_null(config) config = NULL;
+
+#define loadgen_config_new(config)                        \
+  do {                                                    \
+    config = malloc(sizeof(loadgen_config_st));           \
+    if (config == NULL) {                                 \
+      RLC_THROW(ERR_NO_MEMORY);                           \
+    }                                                     \
+    (config)->endpoint = LOADGEN_TUMBLER_ENDPOINT;        \
+    (config)->timeout = LOADGEN_TIMEOUT;                  \
+    (config)->payments = LOADGEN_PAYMENTS;                \
+    (config)->workers = LOADGEN_WORKERS;                  \
+    party_new((config)->alice);                           \
+    party_new((config)->bob);                             \
+  } while (0)
+
+#define loadgen_config_free(config)                       \
+  do {                                                    \
+    party_free((config)->alice);                          \
+    party_free((config)->bob);                            \
+    free(config);                                         \
+    config = NULL;                                        \
+  } while (0)
+
+// Where a payment is, named after the message it waits for. Each step only
+// sends, so a payment never has more than one message in flight.
+typedef enum {
+  STEP_IDLE,
+  STEP_REGISTRATION, // Alice waits for her token
+  STEP_TOKEN_SHARE,  // Bob waits for the token
+  STEP_PROMISE,      // Bob waits for the promise
+  STEP_PUZZLE_SHARE, // Alice waits for the puzzle
+  STEP_PAYMENT,      // Alice waits for the solution
+  STEP_SOLUTION,     // Bob waits for the solution
+  STEP_DONE,
+} step_t;
+
+// One client, i.e. an Alice and a Bob paying each other over and over. Both
+// session identifiers lead to it from the worker's table.
+typedef struct {
+  alice_state_t alice;
+  bob_state_t bob;
+  step_t step;
+  unsigned remaining; // payments left to start
+  long long start_time;
+  long long phase_start_time;
+  long long deadline;
+  long long phase_times[TOTAL_PHASES];
+} loadgen_session_st;
+
+typedef loadgen_session_st *loadgen_session_t;
+
+#define loadgen_session_null(session) session = NULL;
+
+#define loadgen_session_new(session)                      \
+  do {                                                    \
+    session = malloc(sizeof(loadgen_session_st));         \
+    if (session == NULL) {                                \
+      RLC_THROW(ERR_NO_MEMORY);                           \
+    }                                                     \
+    alice_state_new((session)->alice);                    \
+    bob_state_new((session)->bob);                        \
+    (session)->step = STEP_IDLE;                          \
+    (session)->remaining = 0;                             \
+  } while (0)
+
+#define loadgen_session_free(session)                     \
+  do {                                                    \
+    alice_state_free((session)->alice);                   \
+    bob_state_free((session)->bob);                       \
+    free(session);                                        \
+    session = NULL;                                       \
+  } while (0)
+
+// A thread running many clients at once. All of them share one connection to
+// the tumbler, and the Alices and Bobs talk over an in-process pair.
+typedef struct {
+  loadgen_config_t config;
+  void *context;
+  char endpoint[64]; // of the in-process pair
+  unsigned clients;
+  struct pari_thread pari_thread;
+  pthread_t thread;
+  void *tumbler; // DEALER, replies are told apart by session identifier
+  void *alice;   // DEALER, Alice's end of the pair
+  void *bob;     // DEALER, Bob's end of the pair
+  session_table_t sessions; // does not own the clients
+  unsigned active;
+  unsigned completed;
+  unsigned failed;
+  histogram_st histograms[TOTAL_PHASES];
+} loadgen_worker_st;
+
+typedef loadgen_worker_st *loadgen_worker_t;
+
+void *worker_run(void *arg);
+
+int payment_start(loadgen_worker_t worker, loadgen_session_t session);
+int payment_advance(loadgen_worker_t worker, loadgen_session_t session);
+void payment_end(loadgen_worker_t worker, loadgen_session_t session, int result);
+
+#endif // A2L_SCHNORR_INCLUDE_LOADGEN
\ No newline at end of file
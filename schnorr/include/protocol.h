@@ -0,0 +1,223 @@
+#ifndef A2L_SCHNORR_INCLUDE_PROTOCOL
+#define A2L_SCHNORR_INCLUDE_PROTOCOL
+
+#include <stddef.h>
+#include <string.h>
+#include "relic/relic.h"
+#include "zmq.h"
+#include "cl_pow_pool.h"
+#include "types.h"
+#include "util.h"
+
+// What Alice or Bob loads once and every one of their payments reads: their
+// keys, the tumbler's and the CL parameters. The pool is only started by a
+// party that re-randomizes.
+typedef struct {
+  ec_secret_key_t ec_sk;
+  ec_public_key_t ec_pk;
+  ec_public_key_t tumbler_ec_pk;
+  ps_public_key_t tumbler_ps_pk;
+  cl_public_key_t tumbler_cl_pk;
+  cl_params_t cl_params;
+  cl_pow_pool_t pow_pool;
+} party_st;
+
+typedef party_st *party_t;
+
+#define party_null(party) party = NULL;
+
+#define party_new(party)                                    \
+  do {                                                      \
+    party = malloc(sizeof(party_st));                       \
+    if (party == NULL) {                                    \
+      RLC_THROW(ERR_NO_MEMORY);                             \
+    }                                                       \
+    ec_secret_key_new((party)->ec_sk);                      \
+    ec_public_key_new((party)->ec_pk);                      \
+    ec_public_key_new((party)->tumbler_ec_pk);              \
+    ps_public_key_new((party)->tumbler_ps_pk);              \
+    cl_public_key_new((party)->tumbler_cl_pk);              \
+    cl_params_new((party)->cl_params);                      \
+    cl_pow_pool_new((party)->pow_pool);                     \
+  } while (0)
+
+#define party_free(party)                                   \
+  do {                                                      \
+    cl_pow_pool_free((party)->pow_pool);                    \
+    ec_secret_key_free((party)->ec_sk);                     \
+    ec_public_key_free((party)->ec_pk);                     \
+    ec_public_key_free((party)->tumbler_ec_pk);             \
+    ps_public_key_free((party)->tumbler_ps_pk);             \
+    cl_public_key_free((party)->tumbler_cl_pk);             \
+    cl_params_free((party)->cl_params);                     \
+    free(party);                                            \
+    party = NULL;                                           \
+  } while (0)
+
+// One payment as Alice sees it. The puzzle stays in its wire encoding between
+// steps, so no PARI object outlives the step that made it and the caller can
+// reset the PARI stack after each one.
+typedef struct {
+  party_t party; // not owned
+  uint8_t session_id[RLC_SESSION_ID_SIZE];
+  commit_t com;
+  ec_t g_to_the_alpha_times_beta;
+  ec_t g_to_the_alpha_times_beta_times_tau;
+  uint8_t ctx_alpha_times_beta[2 * RLC_CL_CIPHERTEXT_SIZE];
+  schnorr_signature_t sigma_hat_s;
+  schnorr_signature_t sigma_s;
+  bn_t tau;
+  bn_t tau_inverse;
+  bn_t alpha_hat;
+  bn_t tid;
+  ps_signature_t sigma_tid;
+  pedersen_com_t pcom;
+  pedersen_decom_t pdecom;
+  unsigned registration_completed;
+  unsigned puzzle_shared;
+  unsigned puzzle_solved;
+} alice_state_st;
+
+typedef alice_state_st *alice_state_t;
+
+#define alice_state_null(state) state = NULL;
+
+#define alice_state_new(state)                              \
+  do {                                                      \
+    state = malloc(sizeof(alice_state_st));                 \
+    if (state == NULL) {                                    \
+      RLC_THROW(ERR_NO_MEMORY);                             \
+    }                                                       \
+    (state)->party = NULL;                                  \
+    commit_new((state)->com);                               \
+    ec_new((state)->g_to_the_alpha_times_beta);             \
+    ec_new((state)->g_to_the_alpha_times_beta_times_tau);   \
+    schnorr_signature_new((state)->sigma_hat_s);            \
+    schnorr_signature_new((state)->sigma_s);                \
+    bn_new((state)->tau);                                   \
+    bn_new((state)->tau_inverse);                           \
+    bn_new((state)->alpha_hat);                             \
+    bn_new((state)->tid);                                   \
+    ps_signature_new((state)->sigma_tid);                   \
+    pedersen_com_new((state)->pcom);                        \
+    pedersen_decom_new((state)->pdecom);                    \
+    (state)->registration_completed = 0;                    \
+    (state)->puzzle_shared = 0;                             \
+    (state)->puzzle_solved = 0;                             \
+  } while (0)
+
+#define alice_state_free(state)                             \
+  do {                                                      \
+    commit_free((state)->com);                              \
+    ec_free((state)->g_to_the_alpha_times_beta);            \
+    ec_free((state)->g_to_the_alpha_times_beta_times_tau);  \
+    schnorr_signature_free((state)->sigma_hat_s);           \
+    schnorr_signature_free((state)->sigma_s);               \
+    bn_free((state)->tau);                                  \
+    bn_free((state)->tau_inverse);                          \
+    bn_free((state)->alpha_hat);                            \
+    bn_free((state)->tid);                                  \
+    ps_signature_free((state)->sigma_tid);                  \
+    pedersen_com_free((state)->pcom);                       \
+    pedersen_decom_free((state)->pdecom);                   \
+    free(state);                                            \
+    state = NULL;                                           \
+  } while (0)
+
+// One payment as Bob sees it, with the promise kept in its wire encoding for
+// the same reason as Alice's puzzle.
+typedef struct {
+  party_t party; // not owned
+  uint8_t session_id[RLC_SESSION_ID_SIZE];       // names the promise at the tumbler
+  uint8_t alice_session_id[RLC_SESSION_ID_SIZE]; // names the payment at Alice
+  commit_t com;
+  ec_t g_to_the_alpha;
+  uint8_t ctx_alpha[2 * RLC_CL_CIPHERTEXT_SIZE];
+  schnorr_signature_t sigma_r;
+  schnorr_signature_t sigma_t;
+  bn_t beta;
+  bn_t beta_inverse;
+  bn_t tid;
+  ps_signature_t sigma_tid;
+  unsigned token_received;
+  unsigned promise_completed;
+  unsigned puzzle_shared;
+  unsigned puzzle_solved;
+} bob_state_st;
+
+typedef bob_state_st *bob_state_t;
+
+#define bob_state_null(state) state = NULL;
+
+#define bob_state_new(state)                                \
+  do {                                                      \
+    state = malloc(sizeof(bob_state_st));                   \
+    if (state == NULL) {                                    \
+      RLC_THROW(ERR_NO_MEMORY);                             \
+    }                                                       \
+    (state)->party = NULL;                                  \
+    commit_new((state)->com);                               \
+    ec_new((state)->g_to_the_alpha);                        \
+    schnorr_signature_new((state)->sigma_r);                \
+    schnorr_signature_new((state)->sigma_t);                \
+    bn_new((state)->beta);                                  \
+    bn_new((state)->beta_inverse);                          \
+    bn_new((state)->tid);                                   \
+    ps_signature_new((state)->sigma_tid);                   \
+    (state)->token_received = 0;                            \
+    (state)->promise_completed = 0;                         \
+    (state)->puzzle_shared = 0;                             \
+    (state)->puzzle_solved = 0;                             \
+  } while (0)
+
+#define bob_state_free(state)                               \
+  do {                                                      \
+    commit_free((state)->com);                              \
+    ec_free((state)->g_to_the_alpha);                       \
+    schnorr_signature_free((state)->sigma_r);               \
+    schnorr_signature_free((state)->sigma_t);               \
+    bn_free((state)->beta);                                 \
+    bn_free((state)->beta_inverse);                         \
+    bn_free((state)->tid);                                  \
+    ps_signature_free((state)->sigma_tid);                  \
+    free(state);                                            \
+    state = NULL;                                           \
+  } while (0)
+
+typedef int (*alice_msg_handler_t)(alice_state_t, void*, uint8_t*, uint32_t);
+typedef int (*bob_msg_handler_t)(bob_state_t, void*, uint8_t*, uint32_t);
+
+// A handler and the least data it reads, checked before it is called.
+typedef struct {
+  alice_msg_handler_t handler;
+  uint32_t min_length;
+} alice_msg_handler_st;
+
+typedef struct {
+  bob_msg_handler_t handler;
+  uint32_t min_length;
+} bob_msg_handler_st;
+
+int party_load(party_t party, const char *key_file_prefix);
+
+const alice_msg_handler_st *alice_get_message_handler(const uint16_t opcode);
+const bob_msg_handler_st *bob_get_message_handler(const uint16_t opcode);
+int alice_handle_message(alice_state_t state, void *socket, const message_st *msg);
+int bob_handle_message(bob_state_t state, void *socket, const message_st *msg);
+
+int registration(alice_state_t state, void *socket);
+int registration_done_handler(alice_state_t state, void *socket, uint8_t *data, uint32_t data_length);
+int token_share(alice_state_t state, void *socket);
+int puzzle_share_handler(alice_state_t state, void *socket, uint8_t *data, uint32_t data_length);
+int payment_init(alice_state_t state, void *socket);
+int payment_done_handler(alice_state_t state, void *socket, uint8_t *data, uint32_t data_length);
+int puzzle_solution_share(alice_state_t state, void *socket);
+
+int token_share_handler(bob_state_t state, void *socket, uint8_t *data, uint32_t data_length);
+int promise_init(bob_state_t state, void *socket);
+int promise_done_handler(bob_state_t state, void *socket, uint8_t *data, uint32_t data_length);
+int puzzle_share(bob_state_t state, void *socket);
+int puzzle_share_done_handler(bob_state_t state, void *socket, uint8_t *data, uint32_t data_length);
+int puzzle_solution_share_handler(bob_state_t state, void *socket, uint8_t *data, uint32_t data_length);
+
+#endif // A2L_SCHNORR_INCLUDE_PROTOCOL
@@ -0,0 +1,91 @@
+#ifndef A2L_SCHNORR_INCLUDE_SPENT_TOKENS
+#define A2L_SCHNORR_INCLUDE_SPENT_TOKENS
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "relic/relic.h"
+#include "types.h"
+
+#define SPENT_TOKENS_INITIAL_CAPACITY 1024
+#define SPENT_TOKENS_MAX_RECORDS ((size_t) UINT32_MAX - 1) // slots hold record indices
+#define SPENT_TOKENS_LOG_GROWTH 65536 // in records
+#define SPENT_TOKENS_HEADER_SIZE 64 // in bytes
+#define SPENT_TOKENS_MAGIC "A2LSPENT"
+
+// One 512-bit block per lookup, 8 filter bits per table slot.
+#define SPENT_TOKENS_BLOOM_BLOCK_WORDS 8
+#define SPENT_TOKENS_BLOOM_SLOTS_PER_BLOCK 64
+#define SPENT_TOKENS_BLOOM_HASHES 7
+
+// The tids of redeemed tokens. The log file is the source of truth: every tid
+// is appended to it before it counts as spent, and the hash set and the Bloom
+// filter are rebuilt from it on open. Slots hold a record index plus one, so
+// the set costs four bytes per slot and the tids themselves stay in the log.
+// Syncs are group-committed like those of the session log: concurrent inserts
+// share one msync of their records and one of the count.
+typedef struct {
+  int fd;
+  uint8_t *log; // whole address range reserved, the file grows beneath it
+  size_t log_records;
+  size_t count;
+  size_t durable; // records covered by the count on disk
+  int syncing;
+  int failed;
+  uint32_t *slots;
+  size_t capacity;
+  uint64_t *bloom;
+  size_t bloom_blocks;
+  uint64_t key[2];
+  pthread_mutex_t lock;
+  pthread_cond_t synced;
+} spent_tokens_st;
+
+typedef spent_tokens_st *spent_tokens_t;
+
+#define spent_tokens_null(index) index = NULL;
+
+#define spent_tokens_new(index)                                             \
+  do {                                                                      \
+    index = malloc(sizeof(spent_tokens_st));                                \
+    if (index == NULL) {                                                    \
+      RLC_THROW(ERR_NO_MEMORY);                                             \
+    }                                                                       \
+    (index)->fd = -1;                                                       \
+    (index)->log = NULL;                                                    \
+    (index)->log_records = 0;                                               \
+    (index)->count = 0;                                                     \
+    (index)->durable = 0;                                                   \
+    (index)->syncing = 0;                                                   \
+    (index)->failed = 0;                                                    \
+    (index)->capacity = SPENT_TOKENS_INITIAL_CAPACITY;                      \
+    (index)->bloom_blocks = (index)->capacity                               \
+                          / SPENT_TOKENS_BLOOM_SLOTS_PER_BLOCK;             \
+    (index)->slots = calloc((index)->capacity, sizeof(uint32_t));           \
+    (index)->bloom = calloc((index)->bloom_blocks                           \
+                          * SPENT_TOKENS_BLOOM_BLOCK_WORDS,                 \
+                            sizeof(uint64_t));                              \
+    if ((index)->slots == NULL || (index)->bloom == NULL) {                 \
+      RLC_THROW(ERR_NO_MEMORY);                                             \
+    }                                                                       \
+    rand_bytes((uint8_t *) (index)->key, sizeof((index)->key));             \
+    pthread_mutex_init(&(index)->lock, NULL);                               \
+    pthread_cond_init(&(index)->synced, NULL);                              \
+  } while (0)
+
+#define spent_tokens_free(index)                                            \
+  do {                                                                      \
+    spent_tokens_close(index);                                              \
+    free((index)->slots);                                                   \
+    free((index)->bloom);                                                   \
+    pthread_mutex_destroy(&(index)->lock);                                  \
+    pthread_cond_destroy(&(index)->synced);                                 \
+    free(index);                                                            \
+    index = NULL;                                                           \
+  } while (0)
+
+int spent_tokens_open(spent_tokens_t index, const char *path);
+void spent_tokens_close(spent_tokens_t index);
+int spent_tokens_insert(spent_tokens_t index, const uint8_t *tid);
+
+#endif // A2L_SCHNORR_INCLUDE_SPENT_TOKENS
@@ -3,6 +3,8 @@
 
 #include <stddef.h>
 #include "relic/relic.h"
+#include "zmq.h"
+#include "cl_params.h"
 #include "types.h"
 
 #define RLC_EC_SIZE_COMPRESSED 33
@@ -10,14 +12,41 @@
 #define RLC_G2_SIZE_COMPRESSED 65
 #define RLC_CL_SECRET_KEY_SIZE 290
 #define RLC_CL_PUBLIC_KEY_SIZE 1070
-#define RLC_CL_CIPHERTEXT_SIZE 1070
-#define RLC_CLDL_PROOF_T1_SIZE 1070
+
+// Integers go on the wire as a sign byte, a 16-bit big-endian length and the
+// big-endian magnitude, padded to a fixed slot. A form only carries (a, b).
+// The slots follow the CL security level, see cl_params_gen.c.
+#define RLC_CL_INT_HEADER_SIZE 3
+#define RLC_CL_QFI_COEFF_SIZE CL_QFI_COEFF_BYTES // reduced forms of discriminant q^2 * Delta_K
+#define RLC_CL_QFI_SIZE (2 * (RLC_CL_INT_HEADER_SIZE + RLC_CL_QFI_COEFF_SIZE))
+#define RLC_CL_CIPHERTEXT_SIZE RLC_CL_QFI_SIZE
+#define RLC_CLDL_PROOF_T1_SIZE RLC_CL_QFI_SIZE
 #define RLC_CLDL_PROOF_T2_SIZE 33
-#define RLC_CLDL_PROOF_T3_SIZE 1070
-#define RLC_CLDL_PROOF_U1_SIZE 315
-#define RLC_CLDL_PROOF_U2_SIZE 80
+#define RLC_CLDL_PROOF_T3_SIZE RLC_CL_QFI_SIZE
+#define RLC_CLDL_PROOF_U1_SIZE (RLC_CL_INT_HEADER_SIZE + RLC_CEIL(CL_EXPONENT_BITS, 8))
+#define RLC_CLDL_PROOF_U2_SIZE (RLC_CL_INT_HEADER_SIZE + RLC_BN_SIZE)
+#define RLC_CLDL_PROOF_SIZE (RLC_CLDL_PROOF_T1_SIZE + RLC_CLDL_PROOF_T2_SIZE + RLC_CLDL_PROOF_T3_SIZE \
+                           + RLC_CLDL_PROOF_U1_SIZE + RLC_CLDL_PROOF_U2_SIZE)
+
+// Fixed-base tables hold base^(2^(w * i)) and cover exponents of up to the
+// given number of bits, which includes the proof response u1.
+#define CL_FIXED_BASE_WINDOW 5
+#define CL_FIXED_BASE_BITS (RLC_CEIL(CL_EXPONENT_BITS, 64) * 64)
+#define CL_FIXED_BASE_ROWS ((CL_FIXED_BASE_BITS + CL_FIXED_BASE_WINDOW - 1) / CL_FIXED_BASE_WINDOW)
+
+// Window width of the simultaneous exponentiation, 2^w - 1 powers per base.
+#define CL_MULTI_POW_WINDOW 4
 
 #define CLOCK_PRECISION 1E9
+#define PARI_STACK_SIZE 10000000 // in bytes
+#define RECEIVE_TIMEOUT 1000 // in milliseconds
+
+// Every message starts with a fixed header, multi-byte fields little-endian:
+// magic (2 bytes), version (1), reserved (1), opcode (2), data length (4) and
+// the session identifier, followed by the data.
+#define MESSAGE_MAGIC 0xA21C
+#define MESSAGE_VERSION 1
+#define MESSAGE_HEADER_SIZE (10 + RLC_SESSION_ID_SIZE)
 
 #define ALICE_KEY_FILE_PREFIX "alice"
 #define BOB_KEY_FILE_PREFIX "bob"
@@ -28,16 +57,25 @@ static uint8_t tx[2] = { 116, 120 }; // "tx"
 
 int init();
 int clean();
+int init_thread(struct pari_thread *pari_thread);
+int clean_thread();
 
 void memzero(void *ptr, size_t len);
 long long cpucycles(void);
 long long ttimer(void);
-
-void serialize_message(uint8_t **serialized,
-											 const message_t message,
-											 const unsigned msg_type_length,
-											 const unsigned msg_data_length);
-void deserialize_message(message_t *deserialized_message, const uint8_t *serialized);
+int wait_for_message(void *socket, long timeout);
+int reply_pending(void *socket);
+
+int message_build(zmq_msg_t *message,
+									uint8_t **data,
+									const uint16_t opcode,
+									const uint8_t *session_id,
+									const uint32_t data_length);
+int message_send(zmq_msg_t *message, void *socket, int flags);
+int message_send_dealer(zmq_msg_t *message, void *socket, int flags);
+int message_send_error(void *socket, const uint8_t *session_id);
+int message_parse(message_st *parsed, zmq_msg_t *message);
+const char *message_name(const uint16_t opcode);
 
 int generate_keys_and_write_to_file(const cl_params_t params);
 int read_keys_from_file_alice_bob(const char *name,
@@ -54,12 +92,37 @@ int read_keys_from_file_tumbler(ec_secret_key_t tumbler_ec_sk,
 																cl_public_key_t tumbler_cl_pk,
 																ec_public_key_t alice_ec_pk,
 																ec_public_key_t bob_ec_pk);
+int read_tables_from_file(cl_params_t params);
+
+size_t cl_int_size(const GEN x);
+void cl_int_write_bin(uint8_t *bin, size_t len, const GEN x);
+GEN cl_int_read_bin(const uint8_t *bin, size_t len);
+void cl_qfi_write_bin(uint8_t *bin, size_t len, const GEN form);
+GEN cl_qfi_read_bin(const uint8_t *bin, size_t len, const cl_params_t params);
+size_t cl_forms_size(const GEN forms);
+void cl_forms_write_bin(uint8_t *bin, size_t len, const GEN forms);
+GEN cl_forms_read_bin(const uint8_t *bin, size_t len);
+GEN cl_int_from_bn(const bn_t x);
+void cl_int_to_bn(bn_t x, const GEN y);
+
+GEN cl_fixed_base_precompute(const GEN base, const GEN L);
+int cl_fixed_base_matches(const GEN table, const GEN base);
+GEN cl_fixed_base_pow(const GEN table, const GEN exponent, const GEN L);
+GEN cl_multi_pow(const GEN bases, const GEN exponents, const GEN L);
+int cl_public_key_precompute(cl_public_key_t public_key, const cl_params_t params);
+GEN cl_public_key_pow(const cl_public_key_t public_key, const GEN exponent, const cl_params_t params);
 
 int generate_cl_params(cl_params_t params);
 int cl_enc(cl_ciphertext_t ciphertext,
 					 const GEN plaintext,
 					 const cl_public_key_t public_key,
 					 const cl_params_t params);
+int cl_enc_precomputed(cl_ciphertext_t ciphertext,
+					   const GEN plaintext,
+					   const GEN r,
+					   const GEN g_q_to_the_r,
+					   const GEN pk_to_the_r,
+					   const cl_params_t params);
 int cl_dec(GEN *plaintext,
 					 const cl_ciphertext_t ciphertext,
 					 const cl_secret_key_t secret_key,
@@ -73,6 +136,10 @@ int ps_unblind(ps_signature_t signature,
 int ps_verify(const ps_signature_t signature,
 							bn_t message,
 						 	const ps_public_key_t public_key);
+int ps_batch_verify(const ps_signature_t *signatures,
+										bn_t *messages,
+										size_t n,
+										const ps_public_key_t public_key);
 
 int adaptor_schnorr_sign(schnorr_signature_t signature,
 												 uint8_t *msg,
@@ -84,6 +151,15 @@ int adaptor_schnorr_preverify(schnorr_signature_t signature,
 															size_t len,
 															const ec_t Y,
 															const ec_public_key_t public_key);
+int schnorr_sign(schnorr_signature_t signature,
+								 uint8_t *msg,
+								 size_t len,
+								 const ec_secret_key_t secret_key);
+int schnorr_batch_verify(const schnorr_signature_t *signatures,
+												 const ec_public_key_t *public_keys,
+												 uint8_t *const *msgs,
+												 const size_t *lens,
+												 size_t n);
 
 int pedersen_commit(pedersen_com_t com,
 										pedersen_decom_t decom,
@@ -109,6 +185,12 @@ int zk_cldl_verify(const zk_proof_cldl_t proof,
 									 const cl_ciphertext_t ciphertext,
 									 const cl_public_key_t public_key,
 									 const cl_params_t params);
+int zk_cldl_batch_verify(const zk_proof_cldl_t *proofs,
+												 const ec_t *Qs,
+												 const cl_ciphertext_t *ciphertexts,
+												 size_t n,
+												 const cl_public_key_t public_key,
+												 const cl_params_t params);
 int zk_dlog_prove(zk_proof_t proof, const ec_t h, const bn_t w);
 int zk_dlog_verify(const zk_proof_t proof, const ec_t h);
 
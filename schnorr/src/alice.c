@@ -1,713 +1,300 @@
+#include <getopt.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include "relic/relic.h"
 #include "pari/pari.h"
 #include "zmq.h"
 #include "alice.h"
+#include "protocol.h"
 #include "types.h"
 #include "util.h"
 
-unsigned REGISTRATION_COMPLETED;
-unsigned PUZZLE_SHARED;
-unsigned PUZZLE_SOLVED;
-
-int get_message_type(char *key) {
-  for (size_t i = 0; i < TOTAL_MESSAGES; i++) {
-    symstruct_t sym = msg_lookuptable[i];
-    if (strcmp(sym.key, key) == 0) {
-      return sym.code;
-    }
+static void *alice_client_socket(void *context, int type, const char *endpoint) {
+  void *socket = zmq_socket(context, type);
+  if (!socket) {
+    fprintf(stderr, "Error: could not create a socket.\n");
+    return NULL;
   }
-  return -1;
-}
 
-msg_handler_t get_message_handler(char *key) {
-  switch (get_message_type(key))
-  {
-    case REGISTRATION_DONE:
-      return registration_done_handler;
-    
-    case PUZZLE_SHARE:
-      return puzzle_share_handler;
-
-    case PAYMENT_DONE:
-      return payment_done_handler;
-
-    default:
-      fprintf(stderr, "Error: invalid message type.\n");
-      exit(1);
+  const int rc = type == ZMQ_REP ? zmq_bind(socket, endpoint) : zmq_connect(socket, endpoint);
+  if (rc != 0) {
+    fprintf(stderr, "Error: could not %s the socket to %s.\n", type == ZMQ_REP ? "bind" : "connect", endpoint);
+    zmq_close(socket);
+    return NULL;
   }
-}
-
-int handle_message(alice_state_t state, void *socket, zmq_msg_t message) {
-  int result_status = RLC_OK;
 
-  message_t msg;
-  message_null(msg);
+  return socket;
+}
 
-  RLC_TRY {
-    printf("Received message size: %ld bytes\n", zmq_msg_size(&message));
-    deserialize_message(&msg, (uint8_t *) zmq_msg_data(&message));
+int alice_client_open(alice_client_t client, void *context) {
+  printf("Connecting to Tumbler and Bob...\n\n");
+  client->tumbler = alice_client_socket(context, ZMQ_DEALER, TUMBLER_ENDPOINT);
+  client->bob = alice_client_socket(context, ZMQ_DEALER, BOB_ENDPOINT);
+  client->listener = alice_client_socket(context, ZMQ_REP, ALICE_ENDPOINT);
 
-    printf("Executing %s...\n", msg->type);
-    msg_handler_t msg_handler = get_message_handler(msg->type);
-    if (msg_handler(state, socket, msg->data) != RLC_OK) {
-      RLC_THROW(ERR_CAUGHT);
-    }
-    printf("Finished executing %s.\n\n", msg->type);
-  } RLC_CATCH_ANY {
-    result_status = RLC_ERR;
-  } RLC_FINALLY {
-    if (msg != NULL) message_free(msg);
+  if (client->tumbler == NULL || client->bob == NULL || client->listener == NULL) {
+    alice_client_close(client);
+    return RLC_ERR;
   }
-
-  return result_status;
+  return RLC_OK;
 }
 
-int receive_message(alice_state_t state, void *socket) {
-  int result_status = RLC_OK;
-
-  zmq_msg_t message;
-
-  RLC_TRY {
-    int rc = zmq_msg_init(&message);
-    if (rc != 0) {
-      fprintf(stderr, "Error: could not initialize the message.\n");
-      RLC_THROW(ERR_CAUGHT);
-    }
-
-    rc = zmq_msg_recv(&message, socket, ZMQ_DONTWAIT);
-    if (rc != -1 && handle_message(state, socket, message) != RLC_OK) {
-      RLC_THROW(ERR_CAUGHT);
+void alice_client_close(alice_client_t client) {
+  void **sockets[] = { &client->tumbler, &client->bob, &client->listener };
+  for (size_t i = 0; i < sizeof(sockets) / sizeof(sockets[0]); i++) {
+    if (*sockets[i] != NULL) {
+      if (zmq_close(*sockets[i]) != 0) {
+        fprintf(stderr, "Error: could not close the socket.\n");
+      }
+      *sockets[i] = NULL;
     }
-  } RLC_CATCH_ANY {
-    result_status = RLC_ERR;
-  } RLC_FINALLY {
-    zmq_msg_close(&message);
   }
-
-  return result_status;
 }
 
-int registration(alice_state_t state, void *socket) {
-  if (state == NULL) {
-    RLC_THROW(ERR_NO_VALID);
-  }
-  
+int handle_message(alice_client_t client, void *socket, zmq_msg_t message) {
   int result_status = RLC_OK;
-  uint8_t *serialized_message = NULL;
-  
-  message_t registration_msg;
-  message_null(registration_msg);
 
-  bn_t q;
-  bn_null(q);
-
-  pedersen_com_zk_proof_t com_zk_proof;
-  pedersen_com_zk_proof_null(com_zk_proof);
+  message_st msg;
+  const uint8_t *session_id = NULL;
 
   RLC_TRY {
-    bn_new(q);
-    pedersen_com_zk_proof_new(com_zk_proof);
-
-    ec_curve_get_ord(q);
-    bn_rand_mod(state->tid, q);
-
-    if (pedersen_commit(state->pcom, state->pdecom, state->tumbler_ps_pk->Y_1, state->tid) != RLC_OK) {
-      RLC_THROW(ERR_CAUGHT);
-    }
-
-    if (zk_pedersen_com_prove(com_zk_proof, state->tumbler_ps_pk->Y_1, state->pcom, state->pdecom) != RLC_OK) {
+    printf("Received message size: %ld bytes\n", zmq_msg_size(&message));
+    if (message_parse(&msg, &message) != RLC_OK) {
+      fprintf(stderr, "Error: malformed message.\n");
       RLC_THROW(ERR_CAUGHT);
     }
+    session_id = msg.session_id;
 
-    // Build and define the message.
-    char *msg_type = "registration";
-    const unsigned msg_type_length = (unsigned) strlen(msg_type) + 1;
-    const unsigned msg_data_length = (2 * RLC_G1_SIZE_COMPRESSED) + (2 * RLC_BN_SIZE);
-    const int total_msg_length = msg_type_length + msg_data_length + (2 * sizeof(unsigned));
-    message_new(registration_msg, msg_type_length, msg_data_length);
-    
-    // Serialize the message.
-    g1_write_bin(registration_msg->data, RLC_G1_SIZE_COMPRESSED, state->pcom->c, 1);
-    g1_write_bin(registration_msg->data + RLC_G1_SIZE_COMPRESSED, RLC_G1_SIZE_COMPRESSED, com_zk_proof->c->c, 1);
-    bn_write_bin(registration_msg->data + (2 * RLC_G1_SIZE_COMPRESSED), RLC_BN_SIZE, com_zk_proof->u);
-    bn_write_bin(registration_msg->data + (2 * RLC_G1_SIZE_COMPRESSED) + RLC_BN_SIZE, RLC_BN_SIZE, com_zk_proof->v);
-
-    memcpy(registration_msg->type, msg_type, msg_type_length);
-    serialize_message(&serialized_message, registration_msg, msg_type_length, msg_data_length);
-
-    // Send the message.
-    zmq_msg_t registration;
-    int rc = zmq_msg_init_size(&registration, total_msg_length);
-    if (rc < 0) {
-      fprintf(stderr, "Error: could not initialize the message (%s).\n", msg_type);
+    alice_state_t state = session_get(client->payments, msg.session_id);
+    if (state == NULL) {
+      fprintf(stderr, "Error: unknown session.\n");
       RLC_THROW(ERR_CAUGHT);
     }
 
-    memcpy(zmq_msg_data(&registration), serialized_message, total_msg_length);
-    rc = zmq_msg_send(&registration, socket, ZMQ_DONTWAIT);
-    if (rc != total_msg_length) {
-      fprintf(stderr, "Error: could not send the message (%s).\n", msg_type);
+    printf("Executing %s...\n", message_name(msg.opcode));
+    if (alice_handle_message(state, socket, &msg) != RLC_OK) {
       RLC_THROW(ERR_CAUGHT);
     }
+    printf("Finished executing %s.\n\n", message_name(msg.opcode));
   } RLC_CATCH_ANY {
     result_status = RLC_ERR;
-  } RLC_FINALLY {
-    bn_free(q);
-    pedersen_com_zk_proof_free(com_zk_proof);
-    if (registration_msg != NULL) message_free(registration_msg);
-    if (serialized_message != NULL) free(serialized_message);
+    // Bob blocks until his puzzle share is answered, and the listener takes no
+    // other request before it has replied, so a failed one gets an error.
+    if (socket == client->listener && reply_pending(socket)
+    &&  message_send_error(socket, session_id) != RLC_OK) {
+      fprintf(stderr, "Error: could not send the error reply.\n");
+    }
   }
 
   return result_status;
 }
 
-int registration_done_handler(alice_state_t state, void *socket, uint8_t *data) {
-  if (state == NULL || data == NULL) {
-    RLC_THROW(ERR_NO_VALID);
-  }
-
+int receive_message(alice_client_t client, void *socket) {
   int result_status = RLC_OK;
 
-  bn_t q, t;
-  bn_null(q);
-  bn_null(t);
+  zmq_msg_t message;
 
   RLC_TRY {
-    bn_new(q);
-    bn_new(t);
-
-    // Deserialize the data from the message.
-    g1_read_bin(state->sigma_tid->sigma_1, data, RLC_G1_SIZE_COMPRESSED);
-    g1_read_bin(state->sigma_tid->sigma_2, data + RLC_G1_SIZE_COMPRESSED, RLC_G1_SIZE_COMPRESSED);
-
-    if (ps_unblind(state->sigma_tid, state->pdecom) != RLC_OK) {
-      RLC_THROW(ERR_CAUGHT);
-    }
-
-    if (ps_verify(state->sigma_tid, state->tid, state->tumbler_ps_pk) != RLC_OK) {
+    int rc = zmq_msg_init(&message);
+    if (rc != 0) {
+      fprintf(stderr, "Error: could not initialize the message.\n");
       RLC_THROW(ERR_CAUGHT);
     }
-    
-    g1_get_ord(q);
-    bn_rand_mod(t, q);
 
-    g1_mul(state->sigma_tid->sigma_1, state->sigma_tid->sigma_1, t);
-    g1_mul(state->sigma_tid->sigma_2, state->sigma_tid->sigma_2, t);
-    REGISTRATION_COMPLETED = 1;
-  } RLC_CATCH_ANY {
-    result_status = RLC_ERR;
-  } RLC_FINALLY {
-    bn_new(q);
-    bn_new(t);
-  }
-
-  return result_status;
-}
-
-int token_share(alice_state_t state, void *socket) {
-  if (state == NULL) {
-    RLC_THROW(ERR_NO_VALID);
-  }
-
-  int result_status = RLC_OK;
-  uint8_t *serialized_message = NULL;
-
-  message_t token_share_msg;
-  message_null(token_share_msg);
-
-  RLC_TRY {
-    // Build and define the message.
-    char *msg_type = "token_share";
-    const unsigned msg_type_length = (unsigned) strlen(msg_type) + 1;
-    const unsigned msg_data_length = RLC_BN_SIZE + (2 * RLC_G1_SIZE_COMPRESSED);
-    const int total_msg_length = msg_type_length + msg_data_length + (2 * sizeof(unsigned));
-    message_new(token_share_msg, msg_type_length, msg_data_length);
-    
-    // Serialize the data for the message.
-    bn_write_bin(token_share_msg->data, RLC_BN_SIZE, state->tid);
-    g1_write_bin(token_share_msg->data + RLC_BN_SIZE, RLC_G1_SIZE_COMPRESSED, state->sigma_tid->sigma_1, 1);
-    g1_write_bin(token_share_msg->data + RLC_BN_SIZE + RLC_G1_SIZE_COMPRESSED, RLC_G1_SIZE_COMPRESSED, state->sigma_tid->sigma_2, 1);
-
-    // Serialize the message.
-    memcpy(token_share_msg->type, msg_type, msg_type_length);
-    serialize_message(&serialized_message, token_share_msg, msg_type_length, msg_data_length);
-
-    // Send the message.
-    zmq_msg_t token_share;
-    int rc = zmq_msg_init_size(&token_share, total_msg_length);
+    rc = wait_for_message(socket, RECEIVE_TIMEOUT);
     if (rc < 0) {
-      fprintf(stderr, "Error: could not initialize the message (%s).\n", msg_type);
+      fprintf(stderr, "Error: could not poll the socket.\n");
       RLC_THROW(ERR_CAUGHT);
     }
 
-    memcpy(zmq_msg_data(&token_share), serialized_message, total_msg_length);
-    rc = zmq_msg_send(&token_share, socket, ZMQ_DONTWAIT);
-    if (rc != total_msg_length) {
-      fprintf(stderr, "Error: could not send the message (%s).\n", msg_type);
-      RLC_THROW(ERR_CAUGHT);
+    if (rc > 0) {
+      rc = zmq_msg_recv(&message, socket, 0);
+      if (rc == 0 && zmq_msg_more(&message)) {
+        // On a DEALER socket the reply follows an empty delimiter frame.
+        rc = zmq_msg_recv(&message, socket, 0);
+      }
+      if (rc < 0) {
+        fprintf(stderr, "Error: could not receive the message.\n");
+        RLC_THROW(ERR_CAUGHT);
+      }
+
+      if (handle_message(client, socket, message) != RLC_OK) {
+        RLC_THROW(ERR_CAUGHT);
+      }
     }
   } RLC_CATCH_ANY {
     result_status = RLC_ERR;
   } RLC_FINALLY {
-    if (token_share_msg != NULL) message_free(token_share_msg);
-    if (serialized_message != NULL) free(serialized_message);
+    zmq_msg_close(&message);
   }
 
   return result_status;
 }
 
-int puzzle_share_handler(alice_state_t state, void *socket, uint8_t *data) {
-  if (state == NULL || data == NULL) {
+// Runs one payment over the client's connections under a fresh session
+// identifier. The state is in the payments table while the payment runs, so
+// replies, which carry the identifier, find it.
+int run_payment(alice_client_t client, alice_state_t state) {
+  if (client == NULL || state == NULL) {
     RLC_THROW(ERR_NO_VALID);
   }
 
   int result_status = RLC_OK;
+  int listed = 0;
 
-  uint8_t *serialized_message = NULL;
-  message_t puzzle_share_done_msg;
+  long long start_time, stop_time, total_time;
 
   RLC_TRY {
-    // Deserialize the data from the message.
-    ec_read_bin(state->g_to_the_alpha_times_beta, data, RLC_EC_SIZE_COMPRESSED);
-    
-    char ctx_str[RLC_CL_CIPHERTEXT_SIZE];
-    memcpy(ctx_str, data + RLC_EC_SIZE_COMPRESSED, RLC_CL_CIPHERTEXT_SIZE);
-    state->ctx_alpha_times_beta->c1 = gp_read_str(ctx_str);
-    memzero(ctx_str, RLC_CL_CIPHERTEXT_SIZE);
-    memcpy(ctx_str, data + RLC_EC_SIZE_COMPRESSED + RLC_CL_CIPHERTEXT_SIZE, RLC_CL_CIPHERTEXT_SIZE);
-    state->ctx_alpha_times_beta->c2 = gp_read_str(ctx_str);
-
-    // Build and define the message.
-    char *msg_type = "puzzle_share_done";
-    const unsigned msg_type_length = (unsigned) strlen(msg_type) + 1;
-    const unsigned msg_data_length = 0;
-    const int total_msg_length = msg_type_length + msg_data_length + (2 * sizeof(unsigned));
-    message_new(puzzle_share_done_msg, msg_type_length, msg_data_length);
-    
-    // Serialize the message.
-    memcpy(puzzle_share_done_msg->type, msg_type, msg_type_length);
-    serialize_message(&serialized_message, puzzle_share_done_msg, msg_type_length, msg_data_length);
-
-    // Send the message.
-    zmq_msg_t promise_share_done;
-    int rc = zmq_msg_init_size(&promise_share_done, total_msg_length);
-    if (rc < 0) {
-      fprintf(stderr, "Error: could not initialize the message (%s).\n", msg_type);
-      RLC_THROW(ERR_CAUGHT);
-    }
+    rand_bytes(state->session_id, RLC_SESSION_ID_SIZE);
+    state->registration_completed = 0;
+    state->puzzle_shared = 0;
+    state->puzzle_solved = 0;
 
-    memcpy(zmq_msg_data(&promise_share_done), serialized_message, total_msg_length);
-    rc = zmq_msg_send(&promise_share_done, socket, ZMQ_DONTWAIT);
-    if (rc != total_msg_length) {
-      fprintf(stderr, "Error: could not send the message (%s).\n", msg_type);
+    if (session_put(client->payments, state->session_id, state) != RLC_OK) {
       RLC_THROW(ERR_CAUGHT);
     }
-
-    PUZZLE_SHARED = 1;
-  } RLC_CATCH_ANY {
-    result_status = RLC_ERR;
-  } RLC_FINALLY {
-    if (puzzle_share_done_msg != NULL) message_free(puzzle_share_done_msg);
-    if (serialized_message != NULL) free(serialized_message);
-  }
-
-  return result_status;
-}
-
-int payment_init(alice_state_t state, void *socket) {
-  if (state == NULL) {
-    RLC_THROW(ERR_NO_VALID);
-  }
-
-  int result_status = RLC_OK;
-  uint8_t *serialized_message = NULL;
-
-  message_t payment_init_msg;
-  message_null(payment_init_msg);
-
-  cl_ciphertext_t ctx_alpha_times_beta_times_tau;
-  bn_t q;
-
-  cl_ciphertext_null(ctx_alpha_times_beta_times_tau);
-  bn_null(q);
-
-  RLC_TRY {
-    cl_ciphertext_new(ctx_alpha_times_beta_times_tau);
-    bn_new(q);
-    ec_curve_get_ord(q);
-
-    // Homomorphically randomize the challenge ciphertext.
-    uint64_t start_time, stop_time, total_time;
+    listed = 1;
 
     start_time = ttimer();
-    GEN tau_prime = randomi(state->cl_params->bound);
-    bn_read_str(state->tau, GENtostr(tau_prime), strlen(GENtostr(tau_prime)), 10);
-    bn_mod(state->tau, state->tau, q);
-    ec_mul(state->g_to_the_alpha_times_beta_times_tau, state->g_to_the_alpha_times_beta, state->tau);
-
-    const unsigned tau_str_len = bn_size_str(state->tau, 10);
-    char tau_str[tau_str_len];
-    bn_write_str(tau_str, tau_str_len, state->tau, 10);
-
-    GEN plain_tau = strtoi(tau_str);
-    ctx_alpha_times_beta_times_tau->c1 = nupow(state->ctx_alpha_times_beta->c1, plain_tau, NULL);
-    ctx_alpha_times_beta_times_tau->c2 = nupow(state->ctx_alpha_times_beta->c2, plain_tau, NULL);
+    if (registration(state, client->tumbler) != RLC_OK) {
+      RLC_THROW(ERR_CAUGHT);
+    }
 
+    while (!state->registration_completed) {
+      if (receive_message(client, client->tumbler) != RLC_OK) {
+        RLC_THROW(ERR_CAUGHT);
+      }
+    }
     stop_time = ttimer();
     total_time = stop_time - start_time;
-    printf("Re-randomization time: %.5f sec\n", total_time / CLOCK_PRECISION);
+    printf("\nRegistration time: %.5f sec\n", total_time / CLOCK_PRECISION);
 
-    if (adaptor_schnorr_sign(state->sigma_hat_s,
-                             tx,
-                             sizeof(tx),
-                             state->g_to_the_alpha_times_beta_times_tau,
-                             state->alice_ec_sk) != RLC_OK) {
+    if (token_share(state, client->bob) != RLC_OK) {
       RLC_THROW(ERR_CAUGHT);
     }
+    stop_time = ttimer();
+    total_time = stop_time - start_time;
+    printf("Registration time plus token share: %.5f sec\n", total_time / CLOCK_PRECISION);
 
-    // Build and define the message.
-    char *msg_type = "payment_init";
-    const unsigned msg_type_length = (unsigned) strlen(msg_type) + 1;
-    const unsigned msg_data_length = (2 * RLC_BN_SIZE) + (2 * RLC_CL_CIPHERTEXT_SIZE);
-    const int total_msg_length = msg_type_length + msg_data_length + (2 * sizeof(unsigned));
-    message_new(payment_init_msg, msg_type_length, msg_data_length);
-
-    // Serialize the data for the message.
-    bn_write_bin(payment_init_msg->data, RLC_BN_SIZE, state->sigma_hat_s->e);
-    bn_write_bin(payment_init_msg->data + RLC_BN_SIZE, RLC_BN_SIZE, state->sigma_hat_s->s);
-    memcpy(payment_init_msg->data + (2 * RLC_BN_SIZE),
-           GENtostr(ctx_alpha_times_beta_times_tau->c1), RLC_CL_CIPHERTEXT_SIZE);
-    memcpy(payment_init_msg->data + (2 * RLC_BN_SIZE) + RLC_CL_CIPHERTEXT_SIZE,
-           GENtostr(ctx_alpha_times_beta_times_tau->c2), RLC_CL_CIPHERTEXT_SIZE);
-
-    // Serialize the message.
-    memcpy(payment_init_msg->type, msg_type, msg_type_length);
-    serialize_message(&serialized_message, payment_init_msg, msg_type_length, msg_data_length);
-
-    // Send the message.
-    zmq_msg_t payment_init;
-    int rc = zmq_msg_init_size(&payment_init, total_msg_length);
-    if (rc < 0) {
-      fprintf(stderr, "Error: could not initialize the message (%s).\n", msg_type);
-      RLC_THROW(ERR_CAUGHT);
+    while (!state->puzzle_shared) {
+      if (receive_message(client, client->listener) != RLC_OK) {
+        RLC_THROW(ERR_CAUGHT);
+      }
     }
 
-    memcpy(zmq_msg_data(&payment_init), serialized_message, total_msg_length);
-    rc = zmq_msg_send(&payment_init, socket, ZMQ_DONTWAIT);
-    if (rc != total_msg_length) {
-      fprintf(stderr, "Error: could not send the message (%s).\n", msg_type);
+    start_time = ttimer();
+    if (payment_init(state, client->tumbler) != RLC_OK) {
       RLC_THROW(ERR_CAUGHT);
     }
-  } RLC_CATCH_ANY {
-    result_status = RLC_ERR;
-  } RLC_FINALLY {
-    cl_ciphertext_free(ctx_alpha_times_beta_times_tau);
-    bn_free(q);
-    if (payment_init_msg != NULL) message_free(payment_init_msg);
-    if (serialized_message != NULL) free(serialized_message);
-  }
-
-  return result_status;
-}
-
-int payment_done_handler(alice_state_t state, void *socket, uint8_t *data) {
-  if (state == NULL || data == NULL) {
-    RLC_THROW(ERR_NO_VALID);
-  }
-
-  int result_status = RLC_OK;
-
-  bn_t q, x, tau_inverse, gamma;
-  ec_t g_to_the_gamma;
-
-  bn_null(q);
-  bn_null(x);
-  bn_null(tau_inverse);
-  bn_null(gamma);
-  ec_null(g_to_the_gamma);
-
-  RLC_TRY {
-    bn_new(q);
-    bn_new(x);
-    bn_new(tau_inverse);
-    bn_new(gamma);
-    ec_new(g_to_the_gamma);
-
-    ec_curve_get_ord(q);
-
-    // Deserialize the data from the message.
-    bn_read_bin(state->sigma_s->e, data, RLC_BN_SIZE);
-    bn_read_bin(state->sigma_s->s, data + RLC_BN_SIZE, RLC_BN_SIZE);
-
-    // Extract the secret value.
-		bn_sub(gamma, state->sigma_s->s, state->sigma_hat_s->s);
-		bn_mod(gamma, gamma, q);
 
-    // Verify the extracted secret.
-    ec_mul_gen(g_to_the_gamma, gamma);
-    if (ec_cmp(state->g_to_the_alpha_times_beta_times_tau, g_to_the_gamma) != RLC_EQ) {
-      RLC_THROW(ERR_CAUGHT);
+    while (!state->puzzle_solved) {
+      if (receive_message(client, client->tumbler) != RLC_OK) {
+        RLC_THROW(ERR_CAUGHT);
+      }
     }
+    stop_time = ttimer();
+    total_time = stop_time - start_time;
+    printf("\nPuzzle solver time: %.5f sec\n", total_time / CLOCK_PRECISION);
 
-    // Derandomize the extracted secret.
-    bn_gcd_ext(x, tau_inverse, NULL, state->tau, q);
-    if (bn_sign(tau_inverse) == RLC_NEG) {
-      bn_add(tau_inverse, tau_inverse, q);
+    if (puzzle_solution_share(state, client->bob) != RLC_OK) {
+      RLC_THROW(ERR_CAUGHT);
     }
-
-    bn_mul(state->alpha_hat, gamma, tau_inverse);
-    bn_mod(state->alpha_hat, state->alpha_hat, q);
-
-    PUZZLE_SOLVED = 1;
+    stop_time = ttimer();
+    total_time = stop_time - start_time;
+    printf("Puzzle solver and solution share time: %.5f sec\n", total_time / CLOCK_PRECISION);
   } RLC_CATCH_ANY {
     result_status = RLC_ERR;
   } RLC_FINALLY {
-    bn_free(q);
-    bn_free(x);
-    bn_free(tau_inverse);
-    ec_free(g_to_the_gamma);
+    if (listed) session_remove(client->payments, state->session_id);
   }
 
   return result_status;
 }
 
-int puzzle_solution_share(alice_state_t state, void *socket) {
-  if (state == NULL) {
-    RLC_THROW(ERR_NO_VALID);
-  }
-
-  int result_status = RLC_OK;
-  uint8_t *serialized_message = NULL;
+static void usage(const char *name) {
+  fprintf(stderr, "Usage: %s [-n payments]\n", name);
+}
 
-  message_t puzzle_solution_share_msg;
-  message_null(puzzle_solution_share_msg);
+int main(int argc, char *argv[])
+{
+  unsigned payments = 1;
 
-  RLC_TRY {
-    // Build and define the message.
-    char *msg_type = "puzzle_solution_share";
-    const unsigned msg_type_length = (unsigned) strlen(msg_type) + 1;
-    const unsigned msg_data_length = RLC_BN_SIZE;
-    const int total_msg_length = msg_type_length + msg_data_length + (2 * sizeof(unsigned));
-    message_new(puzzle_solution_share_msg, msg_type_length, msg_data_length);
-    
-    // Serialize the data for the message.
-    bn_write_bin(puzzle_solution_share_msg->data, RLC_BN_SIZE, state->alpha_hat);
-
-    // Serialize the message.
-    memcpy(puzzle_solution_share_msg->type, msg_type, msg_type_length);
-    serialize_message(&serialized_message, puzzle_solution_share_msg, msg_type_length, msg_data_length);
-
-    // Send the message.
-    zmq_msg_t puzzle_solution_share;
-    int rc = zmq_msg_init_size(&puzzle_solution_share, total_msg_length);
-    if (rc < 0) {
-      fprintf(stderr, "Error: could not initialize the message (%s).\n", msg_type);
-      RLC_THROW(ERR_CAUGHT);
-    }
+  int option;
+  while ((option = getopt(argc, argv, "n:")) != -1) {
+    switch (option) {
+      case 'n':
+        payments = (unsigned) strtoul(optarg, NULL, 10);
+        break;
 
-    memcpy(zmq_msg_data(&puzzle_solution_share), serialized_message, total_msg_length);
-    rc = zmq_msg_send(&puzzle_solution_share, socket, ZMQ_DONTWAIT);
-    if (rc != total_msg_length) {
-      fprintf(stderr, "Error: could not send the message (%s).\n", msg_type);
-      RLC_THROW(ERR_CAUGHT);
+      default:
+        usage(argv[0]);
+        exit(1);
     }
-  } RLC_CATCH_ANY {
-    result_status = RLC_ERR;
-  } RLC_FINALLY {
-    if (puzzle_solution_share_msg != NULL) message_free(puzzle_solution_share_msg);
-    if (serialized_message != NULL) free(serialized_message);
   }
 
-  return result_status;
-}
+  if (payments < 1) {
+    usage(argv[0]);
+    exit(1);
+  }
 
-int main(void)
-{
   init();
   int result_status = RLC_OK;
-  REGISTRATION_COMPLETED = 0;
-  PUZZLE_SHARED = 0;
-  PUZZLE_SOLVED = 0;
-
-  long long start_time, stop_time, total_time;
 
+  party_t party;
   alice_state_t state;
+  alice_client_t client;
+  party_null(party);
   alice_state_null(state);
+  alice_client_null(client);
 
-  // Socket to talk to other parties.
+  // Context for the connections to the other parties.
   void *context = zmq_ctx_new();
   if (!context) {
     fprintf(stderr, "Error: could not create a context.\n");
     exit(1);
   }
 
-  printf("Connecting to Tumbler...\n\n");
-  void *socket = zmq_socket(context, ZMQ_REQ);
-  if (!socket) {
-    fprintf(stderr, "Error: could not create a socket.\n");
-    exit(1);
-  }
-
-  int rc = zmq_connect(socket, TUMBLER_ENDPOINT);
-  if (rc != 0) {
-    fprintf(stderr, "Error: could not bind the socket.\n");
-    exit(1);
-  }
-
   RLC_TRY {
-    alice_state_new(state);
-
-    if (generate_cl_params(state->cl_params) != RLC_OK) {
-      RLC_THROW(ERR_CAUGHT);
-    }
-
-    if (read_keys_from_file_alice_bob(ALICE_KEY_FILE_PREFIX,
-                                      state->alice_ec_sk,
-                                      state->alice_ec_pk,
-                                      state->tumbler_ec_pk,
-                                      state->tumbler_ps_pk,
-                                      state->tumbler_cl_pk) != RLC_OK) {
+    alice_client_new(client);
+    if (alice_client_open(client, context) != RLC_OK) {
       RLC_THROW(ERR_CAUGHT);
     }
 
-    start_time = ttimer();
-    if (registration(state, socket) != RLC_OK) {
+    party_new(party);
+    if (party_load(party, ALICE_KEY_FILE_PREFIX) != RLC_OK) {
       RLC_THROW(ERR_CAUGHT);
     }
 
-    while (!REGISTRATION_COMPLETED) {
-      if (receive_message(state, socket) != RLC_OK) {
-        RLC_THROW(ERR_CAUGHT);
-      }
-    }
-    stop_time = ttimer();
-    total_time = stop_time - start_time;
-    printf("\nRegistration time: %.5f sec\n", total_time / CLOCK_PRECISION);
-
-    rc = zmq_close(socket);
-    if (rc != 0) {
-      fprintf(stderr, "Error: could not close the socket.\n");
-      exit(1);
-    }
-
-    printf("Connecting to Bob...\n\n");
-    socket = zmq_socket(context, ZMQ_REQ);
-    if (!socket) {
-      fprintf(stderr, "Error: could not create a socket.\n");
-      exit(1);
-    }
-
-    rc = zmq_connect(socket, BOB_ENDPOINT);
-    if (rc != 0) {
-      fprintf(stderr, "Error: could not connect to Bob.\n");
-      exit(1);
-    }
-
-    if (token_share(state, socket) != RLC_OK) {
+    if (cl_pow_pool_start(party->pow_pool, party->cl_params) != RLC_OK) {
+      fprintf(stderr, "Error: could not start the CL exponentiation pool.\n");
       RLC_THROW(ERR_CAUGHT);
     }
-    stop_time = ttimer();
-    total_time = stop_time - start_time;
-    printf("Registration time plus token share: %.5f sec\n", total_time / CLOCK_PRECISION);
-
-    rc = zmq_close(socket);
-    if (rc != 0) {
-      fprintf(stderr, "Error: could not close the socket.\n");
-      exit(1);
-    }
-
-    socket = zmq_socket(context, ZMQ_REP);
-    if (!socket) {
-      fprintf(stderr, "Error: could not create a socket.\n");
-      exit(1);
-    }
 
-    rc = zmq_bind(socket, ALICE_ENDPOINT);
-    if (rc != 0) {
-      fprintf(stderr, "Error: could not bind the socket.\n");
-      exit(1);
-    }
-
-    while (!PUZZLE_SHARED) {
-      if (receive_message(state, socket) != RLC_OK) {
-        RLC_THROW(ERR_CAUGHT);
-      }
-    }
-
-    rc = zmq_close(socket);
-    if (rc != 0) {
-      fprintf(stderr, "Error: could not close the socket.\n");
-      exit(1);
-    }
-
-    printf("Connecting to Tumbler...\n\n");
-    socket = zmq_socket(context, ZMQ_REQ);
-    if (!socket) {
-      fprintf(stderr, "Error: could not create a socket.\n");
-      exit(1);
-    }
-
-    rc = zmq_connect(socket, TUMBLER_ENDPOINT);
-    if (rc != 0) {
-      fprintf(stderr, "Error: could not connect to Tumbler.\n");
-      exit(1);
-    }
+    alice_state_new(state);
+    state->party = party;
 
-    start_time = ttimer();
-    if (payment_init(state, socket) != RLC_OK) {
-      RLC_THROW(ERR_CAUGHT);
-    }
+    // Payments run one after another, since Bob serves one at a time, but all
+    // of them go over the same connections.
+    for (unsigned i = 0; i < payments; i++) {
+      pari_sp av = avma;
+      const int rc = run_payment(client, state);
+      set_avma(av);
 
-    while (!PUZZLE_SOLVED) {
-      if (receive_message(state, socket) != RLC_OK) {
+      if (rc != RLC_OK) {
         RLC_THROW(ERR_CAUGHT);
       }
     }
-    stop_time = ttimer();
-    total_time = stop_time - start_time;
-    printf("\nPuzzle solver time: %.5f sec\n", total_time / CLOCK_PRECISION);
-
-    rc = zmq_close(socket);
-    if (rc != 0) {
-      fprintf(stderr, "Error: could not close the socket.\n");
-      exit(1);
-    }
-
-    printf("Connecting to Bob...\n\n");
-    socket = zmq_socket(context, ZMQ_REQ);
-    if (!socket) {
-      fprintf(stderr, "Error: could not create a socket.\n");
-      exit(1);
-    }
-
-    rc = zmq_connect(socket, BOB_ENDPOINT);
-    if (rc != 0) {
-      fprintf(stderr, "Error: could not connect to Bob.\n");
-      exit(1);
-    }
-
-    if (puzzle_solution_share(state, socket) != RLC_OK) {
-      RLC_THROW(ERR_CAUGHT);
-    }
-    stop_time = ttimer();
-    total_time = stop_time - start_time;
-    printf("Puzzle solver and solution share time: %.5f sec\n", total_time / CLOCK_PRECISION);
   } RLC_CATCH_ANY {
     result_status = RLC_ERR;
   } RLC_FINALLY {
-    alice_state_free(state);
-  }
-
-  rc = zmq_close(socket);
-  if (rc != 0) {
-    fprintf(stderr, "Error: could not close the socket.\n");
-    exit(1);
+    if (client != NULL) alice_client_free(client);
+    if (state != NULL) alice_state_free(state);
+    if (party != NULL) party_free(party);
   }
 
-  rc = zmq_ctx_destroy(context);
+  int rc = zmq_ctx_destroy(context);
   if (rc != 0) {
     fprintf(stderr, "Error: could not destroy the context.\n");
     exit(1);
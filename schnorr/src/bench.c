@@ -0,0 +1,486 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "relic/relic.h"
+#include "pari/pari.h"
+#include "bench.h"
+#include "types.h"
+#include "util.h"
+
+static int compare_long_long(const void *a, const void *b) {
+  const long long x = *(const long long *) a;
+  const long long y = *(const long long *) b;
+  return (x > y) - (x < y);
+}
+
+static long long percentile(const long long *sorted, size_t n, unsigned p) {
+  size_t rank = (p * n + 99) / 100;
+  return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+int bench_run(const bench_t *bench, bench_state_t state) {
+  int result_status = RLC_OK;
+  const size_t n = bench->iterations;
+  pari_sp av = avma;
+
+  long long *times = malloc(n * sizeof(long long));
+  long long *cycles = malloc(n * sizeof(long long));
+
+  RLC_TRY {
+    if (times == NULL || cycles == NULL) {
+      RLC_THROW(ERR_NO_MEMORY);
+    }
+
+    // One untimed run to warm up caches and lazily built tables.
+    if (bench->run(state) != RLC_OK) {
+      RLC_THROW(ERR_CAUGHT);
+    }
+    set_avma(av);
+
+    long long total_time = 0, total_cycles = 0;
+    for (size_t i = 0; i < n; i++) {
+      long long start_time = ttimer();
+      long long start_cycles = cpucycles();
+      int rc = bench->run(state);
+      cycles[i] = cpucycles() - start_cycles;
+      times[i] = ttimer() - start_time;
+      set_avma(av);
+
+      if (rc != RLC_OK) {
+        RLC_THROW(ERR_CAUGHT);
+      }
+      total_time += times[i];
+      total_cycles += cycles[i];
+    }
+
+    qsort(times, n, sizeof(long long), compare_long_long);
+    printf("%d,%s,%zu,%.1f,%lld,%lld,%lld,%lld\n",
+           CL_SECURITY_LEVEL,
+           bench->name,
+           n,
+           n * CLOCK_PRECISION / total_time,
+           total_time / (long long) n,
+           percentile(times, n, 50),
+           percentile(times, n, 99),
+           total_cycles / (long long) n);
+    fflush(stdout);
+  } RLC_CATCH_ANY {
+    fprintf(stderr, "Error: benchmark %s failed.\n", bench->name);
+    result_status = RLC_ERR;
+  } RLC_FINALLY {
+    free(times);
+    free(cycles);
+    set_avma(av);
+  }
+
+  return result_status;
+}
+
+// Conversions between RELIC and PARI integers, the string path is kept only as
+// a baseline for the limb-level one.
+static int bench_bn_to_gen_str(bench_state_t state) {
+  const unsigned len = bn_size_str(state->tau, 10);
+  char str[len];
+  bn_write_str(str, len, state->tau, 10);
+  strtoi(str);
+  return RLC_OK;
+}
+
+static int bench_bn_to_gen_limb(bench_state_t state) {
+  cl_int_from_bn(state->tau);
+  return RLC_OK;
+}
+
+static int bench_gen_to_bn_str(bench_state_t state) {
+  char *str = GENtostr(state->plain_tau);
+  bn_read_str(state->scratch, str, strlen(str), 10);
+  pari_free(str);
+  return RLC_OK;
+}
+
+static int bench_gen_to_bn_limb(bench_state_t state) {
+  cl_int_to_bn(state->scratch, state->plain_tau);
+  return RLC_OK;
+}
+
+static int bench_cl_enc(bench_state_t state) {
+  return cl_enc(state->scratch_ctx, state->plain_alpha, state->cl_pk, state->cl_params);
+}
+
+// Only the online part: the same randomness goes back in before every take.
+static int bench_cl_enc_reservoir(bench_state_t state) {
+  if (cl_reservoir_put(state->reservoir, &state->randomness) != RLC_OK) {
+    return RLC_ERR;
+  }
+  return cl_enc_from_reservoir(state->scratch_ctx, state->plain_alpha, state->reservoir, state->cl_pk, state->cl_params);
+}
+
+static int bench_cl_randomness_generate(bench_state_t state) {
+  return cl_randomness_generate(&state->randomness, state->cl_pk, state->cl_params);
+}
+
+// Re-randomizing a ciphertext by a blinding factor, as Alice and Bob do, with
+// both exponentiations inline and then split with a pool thread.
+static int bench_cl_rerandomize(bench_state_t state) {
+  return cl_ciphertext_pow(state->scratch_ctx, state->ctx_alpha, state->alpha, NULL, state->cl_params);
+}
+
+static int bench_cl_rerandomize_pool(bench_state_t state) {
+  return cl_ciphertext_pow(state->scratch_ctx, state->ctx_alpha, state->alpha, state->pow_pool, state->cl_params);
+}
+
+static int bench_cl_dec(bench_state_t state) {
+  GEN plaintext;
+  return cl_dec(&plaintext, state->ctx_alpha, state->cl_sk, state->cl_params);
+}
+
+static int bench_zk_cldl_prove(bench_state_t state) {
+  return zk_cldl_prove(state->scratch_cldl, state->plain_alpha, state->ctx_alpha, state->cl_pk, state->cl_params);
+}
+
+static int bench_zk_cldl_verify(bench_state_t state) {
+  return zk_cldl_verify(state->pi_cldl, state->g_to_the_alpha, state->ctx_alpha, state->cl_pk, state->cl_params);
+}
+
+// Bob verifies against the tumbler key as read from file, without its table.
+static int bench_zk_cldl_verify_no_table(bench_state_t state) {
+  GEN pk_table = state->cl_pk->pk_table;
+  state->cl_pk->pk_table = NULL;
+  const int result_status = zk_cldl_verify(state->pi_cldl, state->g_to_the_alpha, state->ctx_alpha, state->cl_pk, state->cl_params);
+  state->cl_pk->pk_table = pk_table;
+  return result_status;
+}
+
+static int bench_zk_cldl_batch_verify(bench_state_t state) {
+  zk_proof_cldl_t proofs[BENCH_CLDL_BATCH];
+  cl_ciphertext_t ciphertexts[BENCH_CLDL_BATCH];
+  ec_t Qs[BENCH_CLDL_BATCH];
+
+  for (size_t i = 0; i < BENCH_CLDL_BATCH; i++) {
+    proofs[i] = state->pi_cldl;
+    ciphertexts[i] = state->ctx_alpha;
+    ec_null(Qs[i]);
+    ec_new(Qs[i]);
+    ec_copy(Qs[i], state->g_to_the_alpha);
+  }
+
+  const int result_status = zk_cldl_batch_verify(proofs, (const ec_t *) Qs, ciphertexts, BENCH_CLDL_BATCH,
+                                                 state->cl_pk, state->cl_params);
+  for (size_t i = 0; i < BENCH_CLDL_BATCH; i++) {
+    ec_free(Qs[i]);
+  }
+  return result_status;
+}
+
+static int bench_pedersen_commit(bench_state_t state) {
+  return pedersen_commit(state->scratch_pcom, state->scratch_pdecom, state->ps_pk->Y_1, state->tid);
+}
+
+static int bench_zk_pedersen_com_prove(bench_state_t state) {
+  return zk_pedersen_com_prove(state->scratch_com_zk_proof, state->ps_pk->Y_1, state->pcom, state->pdecom);
+}
+
+static int bench_zk_pedersen_com_verify(bench_state_t state) {
+  return zk_pedersen_com_verify(state->com_zk_proof, state->ps_pk->Y_1, state->pcom);
+}
+
+static int bench_ps_blind_sign(bench_state_t state) {
+  return ps_blind_sign(state->scratch_sigma, state->pcom, state->ps_sk);
+}
+
+static int bench_ps_verify(bench_state_t state) {
+  return ps_verify(state->sigma_tid, state->tid, state->ps_pk);
+}
+
+static int bench_ps_batch_verify(bench_state_t state) {
+  int result_status = RLC_OK;
+
+  ps_signature_t signatures[BENCH_SIGNATURE_BATCH];
+  bn_t tids[BENCH_SIGNATURE_BATCH];
+
+  for (size_t i = 0; i < BENCH_SIGNATURE_BATCH; i++) {
+    bn_null(tids[i]);
+  }
+
+  RLC_TRY {
+    for (size_t i = 0; i < BENCH_SIGNATURE_BATCH; i++) {
+      signatures[i] = state->sigma_tid;
+      bn_new(tids[i]);
+      bn_copy(tids[i], state->tid);
+    }
+
+    if (ps_batch_verify(signatures, tids, BENCH_SIGNATURE_BATCH, state->ps_pk) != RLC_OK) {
+      RLC_THROW(ERR_CAUGHT);
+    }
+  } RLC_CATCH_ANY {
+    result_status = RLC_ERR;
+  } RLC_FINALLY {
+    for (size_t i = 0; i < BENCH_SIGNATURE_BATCH; i++) {
+      bn_free(tids[i]);
+    }
+  }
+
+  return result_status;
+}
+
+static int bench_adaptor_sign(bench_state_t state) {
+  return adaptor_schnorr_sign(state->scratch_sigma_hat, tx, sizeof(tx), state->g_to_the_alpha, state->ec_sk);
+}
+
+static int bench_adaptor_preverify(bench_state_t state) {
+  return adaptor_schnorr_preverify(state->sigma_hat, tx, sizeof(tx), state->g_to_the_alpha, state->ec_pk) == 1 ? RLC_OK : RLC_ERR;
+}
+
+static int bench_schnorr_verify(bench_state_t state) {
+  return cp_ecss_ver(state->sigma->e, state->sigma->s, tx, sizeof(tx), state->ec_pk->pk) == 1 ? RLC_OK : RLC_ERR;
+}
+
+static int bench_schnorr_batch_verify(bench_state_t state) {
+  schnorr_signature_t signatures[BENCH_SIGNATURE_BATCH];
+  ec_public_key_t public_keys[BENCH_SIGNATURE_BATCH];
+  uint8_t *msgs[BENCH_SIGNATURE_BATCH];
+  size_t lens[BENCH_SIGNATURE_BATCH];
+
+  for (size_t i = 0; i < BENCH_SIGNATURE_BATCH; i++) {
+    signatures[i] = state->sigma;
+    public_keys[i] = state->ec_pk;
+    msgs[i] = tx;
+    lens[i] = sizeof(tx);
+  }
+
+  return schnorr_batch_verify(signatures, public_keys, msgs, lens, BENCH_SIGNATURE_BATCH);
+}
+
+static int bench_zk_dlog_prove(bench_state_t state) {
+  return zk_dlog_prove(state->scratch_zk_proof, state->g_to_the_alpha, state->alpha);
+}
+
+static int bench_zk_dlog_verify(bench_state_t state) {
+  return zk_dlog_verify(state->pi_dlog, state->g_to_the_alpha);
+}
+
+static int bench_zk_dhtuple_prove(bench_state_t state) {
+  return zk_dhtuple_prove(state->scratch_zk_proof, state->g_to_the_alpha, state->u, state->v, state->alpha);
+}
+
+static int bench_zk_dhtuple_verify(bench_state_t state) {
+  return zk_dhtuple_verify(state->pi_dhtuple, state->g_to_the_alpha, state->u, state->v);
+}
+
+static int bench_cl_ciphertext_write(bench_state_t state) {
+  cl_qfi_write_bin(state->serialized_ctx, RLC_CL_CIPHERTEXT_SIZE, state->ctx_alpha->c1);
+  cl_qfi_write_bin(state->serialized_ctx + RLC_CL_CIPHERTEXT_SIZE, RLC_CL_CIPHERTEXT_SIZE, state->ctx_alpha->c2);
+  return RLC_OK;
+}
+
+static int bench_cl_ciphertext_read(bench_state_t state) {
+  GEN c1 = cl_qfi_read_bin(state->serialized_ctx, RLC_CL_CIPHERTEXT_SIZE, state->cl_params);
+  GEN c2 = cl_qfi_read_bin(state->serialized_ctx + RLC_CL_CIPHERTEXT_SIZE, RLC_CL_CIPHERTEXT_SIZE, state->cl_params);
+  return c1 != NULL && c2 != NULL ? RLC_OK : RLC_ERR;
+}
+
+// A reply as a handler sends it: the header and the data go straight into the
+// ZMQ buffer.
+static int bench_message_build(bench_state_t state) {
+  zmq_msg_t msg;
+  uint8_t *msg_data;
+  if (message_build(&msg, &msg_data, MSG_PROMISE_DONE, state->session_id, state->msg_data_length) != RLC_OK) {
+    return RLC_ERR;
+  }
+  memcpy(msg_data, state->msg_data, state->msg_data_length);
+  zmq_msg_close(&msg);
+  return RLC_OK;
+}
+
+static int bench_message_parse(bench_state_t state) {
+  message_st msg;
+  return message_parse(&msg, &state->msg);
+}
+
+static const bench_t BENCHES[] = {
+  { "bn_to_gen_str", bench_bn_to_gen_str, BENCH_FAST_ITERATIONS },
+  { "bn_to_gen_limb", bench_bn_to_gen_limb, BENCH_FAST_ITERATIONS },
+  { "gen_to_bn_str", bench_gen_to_bn_str, BENCH_FAST_ITERATIONS },
+  { "gen_to_bn_limb", bench_gen_to_bn_limb, BENCH_FAST_ITERATIONS },
+  { "cl_enc", bench_cl_enc, BENCH_SLOW_ITERATIONS },
+  { "cl_enc_reservoir", bench_cl_enc_reservoir, BENCH_ITERATIONS },
+  { "cl_randomness_generate", bench_cl_randomness_generate, BENCH_SLOW_ITERATIONS },
+  { "cl_rerandomize", bench_cl_rerandomize, BENCH_SLOW_ITERATIONS },
+  { "cl_rerandomize_pool", bench_cl_rerandomize_pool, BENCH_SLOW_ITERATIONS },
+  { "cl_dec", bench_cl_dec, BENCH_SLOW_ITERATIONS },
+  { "zk_cldl_prove", bench_zk_cldl_prove, BENCH_SLOW_ITERATIONS },
+  { "zk_cldl_verify", bench_zk_cldl_verify, BENCH_SLOW_ITERATIONS },
+  { "zk_cldl_verify_no_table", bench_zk_cldl_verify_no_table, BENCH_SLOW_ITERATIONS },
+  { "zk_cldl_batch_verify", bench_zk_cldl_batch_verify, BENCH_SLOW_ITERATIONS },
+  { "pedersen_commit", bench_pedersen_commit, BENCH_ITERATIONS },
+  { "zk_pedersen_com_prove", bench_zk_pedersen_com_prove, BENCH_ITERATIONS },
+  { "zk_pedersen_com_verify", bench_zk_pedersen_com_verify, BENCH_ITERATIONS },
+  { "ps_blind_sign", bench_ps_blind_sign, BENCH_ITERATIONS },
+  { "ps_verify", bench_ps_verify, BENCH_ITERATIONS },
+  { "ps_batch_verify", bench_ps_batch_verify, BENCH_ITERATIONS },
+  { "adaptor_schnorr_sign", bench_adaptor_sign, BENCH_ITERATIONS },
+  { "adaptor_schnorr_preverify", bench_adaptor_preverify, BENCH_ITERATIONS },
+  { "schnorr_verify", bench_schnorr_verify, BENCH_ITERATIONS },
+  { "schnorr_batch_verify", bench_schnorr_batch_verify, BENCH_ITERATIONS },
+  { "zk_dlog_prove", bench_zk_dlog_prove, BENCH_ITERATIONS },
+  { "zk_dlog_verify", bench_zk_dlog_verify, BENCH_ITERATIONS },
+  { "zk_dhtuple_prove", bench_zk_dhtuple_prove, BENCH_ITERATIONS },
+  { "zk_dhtuple_verify", bench_zk_dhtuple_verify, BENCH_ITERATIONS },
+  { "cl_ciphertext_write", bench_cl_ciphertext_write, BENCH_FAST_ITERATIONS },
+  { "cl_ciphertext_read", bench_cl_ciphertext_read, BENCH_FAST_ITERATIONS },
+  { "message_build", bench_message_build, BENCH_FAST_ITERATIONS },
+  { "message_parse", bench_message_parse, BENCH_FAST_ITERATIONS },
+};
+
+int bench_setup(bench_state_t state) {
+  int result_status = RLC_OK;
+
+  bn_t q, x, y, r;
+  bn_null(q);
+  bn_null(x);
+  bn_null(y);
+  bn_null(r);
+
+  RLC_TRY {
+    bn_new(q);
+    bn_new(x);
+    bn_new(y);
+    bn_new(r);
+
+    if (generate_cl_params(state->cl_params) != RLC_OK
+    ||  cl_pow_pool_start(state->pow_pool, state->cl_params) != RLC_OK) {
+      RLC_THROW(ERR_CAUGHT);
+    }
+
+    // Keys are generated in memory so the suite does not depend on key files.
+    state->cl_sk->sk = gclone(randomi(state->cl_params->bound));
+    state->cl_pk->pk = gclone(cl_fixed_base_pow(state->cl_params->g_q_table, state->cl_sk->sk, state->cl_params->L));
+    if (cl_public_key_precompute(state->cl_pk, state->cl_params) != RLC_OK
+    ||  cl_randomness_generate(&state->randomness, state->cl_pk, state->cl_params) != RLC_OK) {
+      RLC_THROW(ERR_CAUGHT);
+    }
+
+    ec_curve_get_ord(q);
+    bn_rand_mod(state->ec_sk->sk, q);
+    ec_mul_gen(state->ec_pk->pk, state->ec_sk->sk);
+
+    pc_get_ord(q);
+    bn_rand_mod(x, q);
+    bn_rand_mod(y, q);
+    g1_mul_gen(state->ps_sk->X_1, x);
+    g1_mul_gen(state->ps_pk->Y_1, y);
+    g2_mul_gen(state->ps_pk->X_2, x);
+    g2_mul_gen(state->ps_pk->Y_2, y);
+
+    // The statement shared by the CLDL, adaptor and discrete log proofs.
+    ec_curve_get_ord(q);
+    bn_rand_mod(state->alpha, q);
+    ec_mul_gen(state->g_to_the_alpha, state->alpha);
+    state->plain_alpha = cl_int_from_bn(state->alpha);
+
+    bn_rand_mod(r, q);
+    ec_mul_gen(state->u, r);
+    ec_mul(state->v, state->u, state->alpha);
+
+    state->plain_tau = randomi(state->cl_params->bound);
+    cl_int_to_bn(state->tau, state->plain_tau);
+
+    // Reference inputs for the verifiers and decryption.
+    if (cl_enc(state->ctx_alpha, state->plain_alpha, state->cl_pk, state->cl_params) != RLC_OK
+    ||  zk_cldl_prove(state->pi_cldl, state->plain_alpha, state->ctx_alpha, state->cl_pk, state->cl_params) != RLC_OK
+    ||  zk_dlog_prove(state->pi_dlog, state->g_to_the_alpha, state->alpha) != RLC_OK
+    ||  zk_dhtuple_prove(state->pi_dhtuple, state->g_to_the_alpha, state->u, state->v, state->alpha) != RLC_OK
+    ||  adaptor_schnorr_sign(state->sigma_hat, tx, sizeof(tx), state->g_to_the_alpha, state->ec_sk) != RLC_OK
+    ||  schnorr_sign(state->sigma, tx, sizeof(tx), state->ec_sk) != RLC_OK) {
+      RLC_THROW(ERR_CAUGHT);
+    }
+
+    pc_get_ord(q);
+    bn_rand_mod(state->tid, q);
+    if (pedersen_commit(state->pcom, state->pdecom, state->ps_pk->Y_1, state->tid) != RLC_OK
+    ||  zk_pedersen_com_prove(state->com_zk_proof, state->ps_pk->Y_1, state->pcom, state->pdecom) != RLC_OK
+    ||  ps_blind_sign(state->sigma_tid, state->pcom, state->ps_sk) != RLC_OK
+    ||  ps_unblind(state->sigma_tid, state->pdecom) != RLC_OK) {
+      RLC_THROW(ERR_CAUGHT);
+    }
+
+    // The largest message of the protocol, a promise with its CLDL proof.
+    state->msg_data_length = (2 * RLC_EC_SIZE_COMPRESSED) + (2 * RLC_BN_SIZE) + (2 * RLC_CL_CIPHERTEXT_SIZE)
+    + RLC_CLDL_PROOF_T1_SIZE + RLC_CLDL_PROOF_T2_SIZE + RLC_CLDL_PROOF_T3_SIZE + RLC_CLDL_PROOF_U1_SIZE + RLC_CLDL_PROOF_U2_SIZE;
+    state->msg_data = malloc(state->msg_data_length);
+    if (state->msg_data == NULL) {
+      RLC_THROW(ERR_NO_MEMORY);
+    }
+    rand_bytes(state->session_id, RLC_SESSION_ID_SIZE);
+    rand_bytes(state->msg_data, state->msg_data_length);
+
+    uint8_t *msg_data;
+    zmq_msg_close(&state->msg);
+    if (message_build(&state->msg, &msg_data, MSG_PROMISE_DONE, state->session_id, state->msg_data_length) != RLC_OK) {
+      RLC_THROW(ERR_NO_MEMORY);
+    }
+    memcpy(msg_data, state->msg_data, state->msg_data_length);
+
+    if (bench_cl_ciphertext_write(state) != RLC_OK
+    ||  bench_cl_ciphertext_read(state) != RLC_OK) {
+      RLC_THROW(ERR_CAUGHT);
+    }
+
+    // Both conversion paths must agree, otherwise their numbers are meaningless.
+    const unsigned len = bn_size_str(state->tau, 10);
+    char str[len];
+    bn_write_str(str, len, state->tau, 10);
+    if (!equalii(strtoi(str), cl_int_from_bn(state->tau))) {
+      RLC_THROW(ERR_CAUGHT);
+    }
+  } RLC_CATCH_ANY {
+    result_status = RLC_ERR;
+  } RLC_FINALLY {
+    bn_free(q);
+    bn_free(x);
+    bn_free(y);
+    bn_free(r);
+  }
+
+  return result_status;
+}
+
+int main(int argc, char *argv[])
+{
+  init();
+  int result_status = RLC_OK;
+
+  // An optional argument restricts the run to benchmarks with that prefix.
+  const char *filter = argc > 1 ? argv[1] : "";
+
+  bench_state_t state;
+  bench_state_null(state);
+
+  RLC_TRY {
+    bench_state_new(state);
+
+    if (bench_setup(state) != RLC_OK) {
+      fprintf(stderr, "Error: could not set up the benchmarks.\n");
+      RLC_THROW(ERR_CAUGHT);
+    }
+
+    printf("cl_level,operation,iterations,ops_per_sec,mean_ns,p50_ns,p99_ns,mean_cycles\n");
+    for (size_t i = 0; i < sizeof(BENCHES) / sizeof(bench_t); i++) {
+      if (strncmp(BENCHES[i].name, filter, strlen(filter)) != 0) {
+        continue;
+      }
+
+      if (bench_run(&BENCHES[i], state) != RLC_OK) {
+        result_status = RLC_ERR;
+      }
+    }
+  } RLC_CATCH_ANY {
+    result_status = RLC_ERR;
+  } RLC_FINALLY {
+    if (state != NULL) bench_state_free(state);
+  }
+
+  clean();
+
+  return result_status;
+}
@@ -0,0 +1,228 @@
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "relic/relic.h"
+#include "pari/pari.h"
+#include "cl_pow_pool.h"
+#include "types.h"
+#include "util.h"
+
+static void cl_pow_job_run(cl_pow_job_st *job, const cl_params_t params) {
+  pari_sp av = avma;
+
+  RLC_TRY {
+    GEN base = cl_qfi_read_bin(job->base, sizeof(job->base), params);
+    GEN exponent = cl_int_read_bin(job->exponent, sizeof(job->exponent));
+    if (base == NULL || exponent == NULL) {
+      RLC_THROW(ERR_NO_VALID);
+    }
+
+    cl_qfi_write_bin(job->result, sizeof(job->result), nupow(base, exponent, params->L));
+    job->status = RLC_OK;
+  } RLC_CATCH_ANY {
+    job->status = RLC_ERR;
+  } RLC_FINALLY {
+    set_avma(av);
+  }
+}
+
+static void *cl_pow_pool_run(void *arg) {
+  cl_pow_pool_t pool = (cl_pow_pool_t) arg;
+  size_t index;
+
+  // Stacks are allocated before their thread is created, so the k-th thread to
+  // get here always finds the k-th one ready.
+  pthread_mutex_lock(&pool->lock);
+  index = pool->attached++;
+  pthread_mutex_unlock(&pool->lock);
+
+  // Without PARI the thread cannot take jobs, so it closes the pool and fails
+  // the ones already queued. Callers then do both halves themselves.
+  if (init_thread(&pool->pari_threads[index]) != RLC_OK) {
+    fprintf(stderr, "Error: could not initialize a CL exponentiation thread.\n");
+    pthread_mutex_lock(&pool->lock);
+    pool->closed = 1;
+    while (pool->size > 0) {
+      pool->queue[pool->head]->done = 1;
+      pool->head = (pool->head + 1) % CL_POW_POOL_QUEUE;
+      pool->size--;
+    }
+    pthread_cond_broadcast(&pool->done);
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    while (pool->size == 0 && !pool->closed) {
+      pthread_cond_wait(&pool->wake, &pool->lock);
+    }
+
+    // Queued jobs are finished even after closing, their callers wait on them.
+    if (pool->size > 0) {
+      cl_pow_job_st *job = pool->queue[pool->head];
+      pool->head = (pool->head + 1) % CL_POW_POOL_QUEUE;
+      pool->size--;
+      pthread_mutex_unlock(&pool->lock);
+
+      cl_pow_job_run(job, pool->params);
+
+      pthread_mutex_lock(&pool->lock);
+      job->done = 1;
+      pthread_cond_broadcast(&pool->done);
+      continue;
+    }
+
+    if (pool->closed) {
+      break;
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  clean_thread();
+
+  return NULL;
+}
+
+int cl_pow_pool_start(cl_pow_pool_t pool, const cl_params_t params) {
+  pool->params = params;
+
+  for (size_t i = 0; i < CL_POW_POOL_THREADS; i++) {
+    pari_thread_alloc(&pool->pari_threads[i], PARI_STACK_SIZE, NULL);
+    if (pthread_create(&pool->threads[i], NULL, cl_pow_pool_run, pool) != 0) {
+      pari_thread_free(&pool->pari_threads[i]);
+      break;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->started++;
+    pthread_mutex_unlock(&pool->lock);
+  }
+
+  return pool->started == CL_POW_POOL_THREADS ? RLC_OK : RLC_ERR;
+}
+
+void cl_pow_pool_stop(cl_pow_pool_t pool) {
+  pthread_mutex_lock(&pool->lock);
+  pool->closed = 1;
+  pthread_cond_broadcast(&pool->wake);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (size_t i = 0; i < pool->started; i++) {
+    pthread_join(pool->threads[i], NULL);
+    pari_thread_free(&pool->pari_threads[i]);
+  }
+  pool->started = 0;
+}
+
+int cl_pow_pool_submit(cl_pow_pool_t pool, cl_pow_job_st *job) {
+  pthread_mutex_lock(&pool->lock);
+  if (pool->closed || pool->started < CL_POW_POOL_THREADS || pool->size == CL_POW_POOL_QUEUE) {
+    pthread_mutex_unlock(&pool->lock);
+    return RLC_ERR;
+  }
+
+  job->status = RLC_ERR;
+  job->done = 0;
+  pool->queue[(pool->head + pool->size) % CL_POW_POOL_QUEUE] = job;
+  pool->size++;
+  pthread_cond_signal(&pool->wake);
+  pthread_mutex_unlock(&pool->lock);
+
+  return RLC_OK;
+}
+
+int cl_pow_pool_wait(cl_pow_pool_t pool, cl_pow_job_st *job) {
+  pthread_mutex_lock(&pool->lock);
+  while (!job->done) {
+    pthread_cond_wait(&pool->done, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  return job->status;
+}
+
+// Samples a blinding factor the way the protocol always has, reduced mod q,
+// and inverts it while it is at hand.
+int cl_blinding_factor_sample(bn_t factor, bn_t inverse, const cl_params_t params) {
+  int result_status = RLC_OK;
+  pari_sp av = avma;
+
+  bn_t x, q;
+
+  bn_null(x);
+  bn_null(q);
+
+  RLC_TRY {
+    bn_new(x);
+    bn_new(q);
+
+    ec_curve_get_ord(q);
+
+    cl_int_to_bn(factor, randomi(params->bound));
+    bn_mod(factor, factor, q);
+
+    bn_gcd_ext(x, inverse, NULL, factor, q);
+    if (bn_sign(inverse) == RLC_NEG) {
+      bn_add(inverse, inverse, q);
+    }
+  } RLC_CATCH_ANY {
+    result_status = RLC_ERR;
+  } RLC_FINALLY {
+    bn_free(x);
+    bn_free(q);
+    set_avma(av);
+  }
+
+  return result_status;
+}
+
+// Raises both halves of a ciphertext to the same exponent, c2 on a pool thread
+// while the caller does c1. Without a free thread both are done inline.
+int cl_ciphertext_pow(cl_ciphertext_t result,
+                      const cl_ciphertext_t ciphertext,
+                      const bn_t exponent,
+                      cl_pow_pool_t pool,
+                      const cl_params_t params) {
+  int result_status = RLC_OK;
+  int submitted = 0;
+  cl_pow_job_st job;
+
+  RLC_TRY {
+    GEN plain_exponent = cl_int_from_bn(exponent);
+
+    if (pool != NULL) {
+      cl_qfi_write_bin(job.base, sizeof(job.base), ciphertext->c2);
+      cl_int_write_bin(job.exponent, sizeof(job.exponent), plain_exponent);
+      submitted = cl_pow_pool_submit(pool, &job) == RLC_OK;
+    }
+
+    result->c1 = nupow(ciphertext->c1, plain_exponent, params->L);
+
+    if (submitted) {
+      submitted = 0;
+      if (cl_pow_pool_wait(pool, &job) != RLC_OK) {
+        RLC_THROW(ERR_CAUGHT);
+      }
+      result->c2 = cl_qfi_read_bin(job.result, sizeof(job.result), params);
+      if (result->c2 == NULL) {
+        RLC_THROW(ERR_NO_VALID);
+      }
+    } else {
+      result->c2 = nupow(ciphertext->c2, plain_exponent, params->L);
+    }
+  } RLC_CATCH_ANY {
+    result_status = RLC_ERR;
+  } RLC_FINALLY {
+    // The job lives on this stack, so it cannot be left with a pool thread.
+    if (submitted) {
+      cl_pow_pool_wait(pool, &job);
+    }
+    memzero(&job, sizeof(job));
+  }
+
+  return result_status;
+}
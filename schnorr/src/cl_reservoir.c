@@ -0,0 +1,136 @@
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "relic/relic.h"
+#include "pari/pari.h"
+#include "cl_reservoir.h"
+#include "types.h"
+#include "util.h"
+
+int cl_reservoir_put(cl_reservoir_t reservoir, const cl_randomness_st *entry) {
+  pthread_mutex_lock(&reservoir->lock);
+  if (reservoir->size == reservoir->capacity) {
+    while (reservoir->size > reservoir->low_watermark && !reservoir->closed) {
+      pthread_cond_wait(&reservoir->drained, &reservoir->lock);
+    }
+    if (!reservoir->closed) {
+      reservoir->stats.refills++;
+    }
+  }
+
+  if (reservoir->closed) {
+    pthread_mutex_unlock(&reservoir->lock);
+    return RLC_ERR;
+  }
+
+  const size_t tail = (reservoir->head + reservoir->size) % reservoir->capacity;
+  memcpy(&reservoir->entries[tail], entry, sizeof(cl_randomness_st));
+  reservoir->size++;
+  reservoir->stats.produced++;
+  pthread_mutex_unlock(&reservoir->lock);
+
+  return RLC_OK;
+}
+
+int cl_reservoir_take(cl_reservoir_t reservoir, cl_randomness_st *entry) {
+  pthread_mutex_lock(&reservoir->lock);
+  if (reservoir->size == 0) {
+    reservoir->stats.misses++;
+    pthread_mutex_unlock(&reservoir->lock);
+    return RLC_ERR;
+  }
+
+  // Each r encrypts once, so its slot is wiped on the way out.
+  memcpy(entry, &reservoir->entries[reservoir->head], sizeof(cl_randomness_st));
+  memzero(&reservoir->entries[reservoir->head], sizeof(cl_randomness_st));
+  reservoir->head = (reservoir->head + 1) % reservoir->capacity;
+  reservoir->size--;
+  reservoir->stats.taken++;
+  if (reservoir->size == reservoir->low_watermark) {
+    pthread_cond_signal(&reservoir->drained);
+  }
+  pthread_mutex_unlock(&reservoir->lock);
+
+  return RLC_OK;
+}
+
+void cl_reservoir_close(cl_reservoir_t reservoir) {
+  pthread_mutex_lock(&reservoir->lock);
+  reservoir->closed = 1;
+  pthread_cond_broadcast(&reservoir->drained);
+  pthread_mutex_unlock(&reservoir->lock);
+}
+
+void cl_reservoir_stats(cl_reservoir_t reservoir, cl_reservoir_stats_st *stats) {
+  pthread_mutex_lock(&reservoir->lock);
+  memcpy(stats, &reservoir->stats, sizeof(cl_reservoir_stats_st));
+  stats->size = reservoir->size;
+  pthread_mutex_unlock(&reservoir->lock);
+}
+
+// Overwrites the limbs of r before the stack it lives on is given back.
+static void cl_randomness_erase(GEN r) {
+  if (r != NULL && signe(r) != 0) {
+    memzero(r + 2, (lgefint(r) - 2) * sizeof(long));
+  }
+}
+
+int cl_randomness_generate(cl_randomness_st *entry,
+                           const cl_public_key_t public_key,
+                           const cl_params_t params) {
+  int result_status = RLC_OK;
+  pari_sp av = avma;
+  GEN r = NULL;
+
+  RLC_TRY {
+    r = randomi(params->bound);
+    cl_int_write_bin(entry->r, sizeof(entry->r), r);
+    cl_qfi_write_bin(entry->g_q_to_the_r, sizeof(entry->g_q_to_the_r),
+                     cl_fixed_base_pow(params->g_q_table, r, params->L));
+    cl_qfi_write_bin(entry->pk_to_the_r, sizeof(entry->pk_to_the_r),
+                     cl_public_key_pow(public_key, r, params));
+  } RLC_CATCH_ANY {
+    memzero(entry, sizeof(cl_randomness_st));
+    result_status = RLC_ERR;
+  } RLC_FINALLY {
+    cl_randomness_erase(r);
+    set_avma(av);
+  }
+
+  return result_status;
+}
+
+// Encrypts with randomness from the reservoir, which leaves f^plaintext and one
+// composition online. An empty reservoir falls back to cl_enc().
+int cl_enc_from_reservoir(cl_ciphertext_t ciphertext,
+                          const GEN plaintext,
+                          cl_reservoir_t reservoir,
+                          const cl_public_key_t public_key,
+                          const cl_params_t params) {
+  int result_status = RLC_OK;
+  cl_randomness_st entry;
+
+  if (reservoir == NULL || cl_reservoir_take(reservoir, &entry) != RLC_OK) {
+    return cl_enc(ciphertext, plaintext, public_key, params);
+  }
+
+  RLC_TRY {
+    GEN r = cl_int_read_bin(entry.r, sizeof(entry.r));
+    GEN g_q_to_the_r = cl_qfi_read_bin(entry.g_q_to_the_r, sizeof(entry.g_q_to_the_r), params);
+    GEN pk_to_the_r = cl_qfi_read_bin(entry.pk_to_the_r, sizeof(entry.pk_to_the_r), params);
+    if (r == NULL || g_q_to_the_r == NULL || pk_to_the_r == NULL) {
+      RLC_THROW(ERR_NO_VALID);
+    }
+
+    if (cl_enc_precomputed(ciphertext, plaintext, r, g_q_to_the_r, pk_to_the_r, params) != RLC_OK) {
+      RLC_THROW(ERR_CAUGHT);
+    }
+  } RLC_CATCH_ANY {
+    result_status = RLC_ERR;
+  } RLC_FINALLY {
+    memzero(&entry, sizeof(entry));
+  }
+
+  return result_status;
+}
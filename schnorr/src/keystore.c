@@ -0,0 +1,228 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "relic/relic.h"
+#include "keystore.h"
+#include "util.h"
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t count;
+  uint64_t size;
+  uint64_t checksum;
+} keystore_header_st;
+
+typedef struct {
+  uint32_t tag;
+  uint32_t reserved;
+  uint64_t offset;
+  uint64_t length;
+} keystore_directory_st;
+
+// FNV-1a, only meant to catch a truncated or damaged file.
+static uint64_t keystore_checksum(const uint8_t *data, size_t len) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < len; i++) {
+    h ^= data[i];
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+static size_t keystore_align(size_t offset) {
+  return (offset + KEYSTORE_ALIGNMENT - 1) / KEYSTORE_ALIGNMENT * KEYSTORE_ALIGNMENT;
+}
+
+static const keystore_directory_st *keystore_directory(const keystore_t store) {
+  return (const keystore_directory_st *) (store->map + KEYSTORE_HEADER_SIZE);
+}
+
+static int keystore_write_all(int fd, const uint8_t *data, size_t len) {
+  while (len > 0) {
+    ssize_t rc = write(fd, data, len);
+    if (rc < 0 && errno == EINTR) {
+      continue;
+    }
+    if (rc <= 0) {
+      return RLC_ERR;
+    }
+    data += rc;
+    len -= (size_t) rc;
+  }
+  return RLC_OK;
+}
+
+int keystore_probe(const char *path) {
+  char magic[sizeof(((keystore_header_st *) NULL)->magic)];
+
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    return 0;
+  }
+  const int found = fread(magic, 1, sizeof(magic), file) == sizeof(magic)
+                 && memcmp(magic, KEYSTORE_MAGIC, sizeof(magic)) == 0;
+  fclose(file);
+
+  return found;
+}
+
+int keystore_open(keystore_t store, const char *path) {
+  int result_status = RLC_OK;
+  int fd = -1;
+
+  RLC_TRY {
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+      RLC_THROW(ERR_NO_FILE);
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0) {
+      RLC_THROW(ERR_NO_READ);
+    }
+    if ((size_t) file_stat.st_size < KEYSTORE_HEADER_SIZE) {
+      RLC_THROW(ERR_NO_VALID);
+    }
+
+    uint8_t *map = mmap(NULL, (size_t) file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+      RLC_THROW(ERR_NO_MEMORY);
+    }
+    store->map = map;
+    store->size = (size_t) file_stat.st_size;
+
+    const keystore_header_st *header = (const keystore_header_st *) store->map;
+    if (memcmp(header->magic, KEYSTORE_MAGIC, sizeof(header->magic)) != 0
+    ||  header->version != KEYSTORE_VERSION
+    ||  header->size != store->size
+    ||  header->count > KEYSTORE_MAX_ENTRIES
+    ||  KEYSTORE_HEADER_SIZE + header->count * sizeof(keystore_directory_st) > store->size
+    ||  header->checksum != keystore_checksum(store->map + KEYSTORE_HEADER_SIZE, store->size - KEYSTORE_HEADER_SIZE)) {
+      RLC_THROW(ERR_NO_VALID);
+    }
+
+    // Once the directory is checked, keystore_get can hand out entries as is.
+    const keystore_directory_st *directory = keystore_directory(store);
+    for (uint32_t i = 0; i < header->count; i++) {
+      if (directory[i].offset > store->size || directory[i].length > store->size - directory[i].offset) {
+        RLC_THROW(ERR_NO_VALID);
+      }
+    }
+  } RLC_CATCH_ANY {
+    fprintf(stderr, "Error: could not open the key store %s.\n", path);
+    keystore_close(store);
+    result_status = RLC_ERR;
+  } RLC_FINALLY {
+    // The mapping stays valid without the descriptor.
+    if (fd >= 0) close(fd);
+  }
+
+  return result_status;
+}
+
+void keystore_close(keystore_t store) {
+  if (store->map != NULL) {
+    munmap(store->map, store->size);
+    store->map = NULL;
+    store->size = 0;
+  }
+}
+
+const uint8_t *keystore_get(const keystore_t store, uint32_t tag, size_t *length) {
+  const keystore_header_st *header = (const keystore_header_st *) store->map;
+  const keystore_directory_st *directory = keystore_directory(store);
+
+  for (uint32_t i = 0; i < header->count; i++) {
+    if (directory[i].tag == tag) {
+      *length = (size_t) directory[i].length;
+      return store->map + directory[i].offset;
+    }
+  }
+  return NULL;
+}
+
+int keystore_write(const char *path, const keystore_entry_st *entries, size_t count) {
+  int result_status = RLC_OK;
+  int fd = -1;
+
+  keystore_header_st header;
+  keystore_directory_st directory[KEYSTORE_MAX_ENTRIES];
+  uint8_t *file = NULL;
+  size_t size = 0;
+
+  const size_t temporary_file_length = strlen(path) + 8;
+  char temporary_file_name[temporary_file_length];
+  snprintf(temporary_file_name, temporary_file_length, "%s.tmp", path);
+
+  RLC_TRY {
+    if (count > KEYSTORE_MAX_ENTRIES) {
+      RLC_THROW(ERR_NO_BUFFER);
+    }
+
+    // Lay the entries out first, the checksum covers the whole file.
+    size = keystore_align(KEYSTORE_HEADER_SIZE + count * sizeof(keystore_directory_st));
+    for (size_t i = 0; i < count; i++) {
+      directory[i].tag = entries[i].tag;
+      directory[i].reserved = 0;
+      directory[i].offset = size;
+      directory[i].length = entries[i].length;
+      size = keystore_align(size + entries[i].length);
+    }
+
+    file = calloc(size, 1);
+    if (file == NULL) {
+      RLC_THROW(ERR_NO_MEMORY);
+    }
+
+    memcpy(file + KEYSTORE_HEADER_SIZE, directory, count * sizeof(keystore_directory_st));
+    for (size_t i = 0; i < count; i++) {
+      memcpy(file + directory[i].offset, entries[i].data, entries[i].length);
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, KEYSTORE_MAGIC, sizeof(header.magic));
+    header.version = KEYSTORE_VERSION;
+    header.count = (uint32_t) count;
+    header.size = size;
+    header.checksum = keystore_checksum(file + KEYSTORE_HEADER_SIZE, size - KEYSTORE_HEADER_SIZE);
+    memcpy(file, &header, sizeof(header));
+
+    // Key files hold secrets, and a reader must never see half of one.
+    fd = open(temporary_file_name, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+      RLC_THROW(ERR_NO_FILE);
+    }
+    if (keystore_write_all(fd, file, size) != RLC_OK || fsync(fd) != 0) {
+      RLC_THROW(ERR_NO_BUFFER);
+    }
+    if (close(fd) != 0) {
+      fd = -1;
+      RLC_THROW(ERR_NO_BUFFER);
+    }
+    fd = -1;
+
+    if (rename(temporary_file_name, path) != 0) {
+      RLC_THROW(ERR_NO_FILE);
+    }
+  } RLC_CATCH_ANY {
+    fprintf(stderr, "Error: could not write the key store %s.\n", path);
+    if (fd >= 0) close(fd);
+    unlink(temporary_file_name);
+    result_status = RLC_ERR;
+  } RLC_FINALLY {
+    if (file != NULL) {
+      memzero(file, size);
+      free(file);
+    }
+  }
+
+  return result_status;
+}
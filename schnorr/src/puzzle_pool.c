@@ -0,0 +1,50 @@
+#include <pthread.h>
+#include <stddef.h>
+#include <string.h>
+#include "relic/relic.h"
+#include "puzzle_pool.h"
+#include "util.h"
+
+int puzzle_pool_put(puzzle_pool_t pool, const puzzle_st *puzzle) {
+  pthread_mutex_lock(&pool->lock);
+  while (pool->size == pool->capacity && !pool->closed) {
+    pthread_cond_wait(&pool->not_full, &pool->lock);
+  }
+
+  if (pool->closed) {
+    pthread_mutex_unlock(&pool->lock);
+    return RLC_ERR;
+  }
+
+  const size_t tail = (pool->head + pool->size) % pool->capacity;
+  memcpy(&pool->puzzles[tail], puzzle, sizeof(puzzle_st));
+  pool->size++;
+  pthread_mutex_unlock(&pool->lock);
+
+  return RLC_OK;
+}
+
+int puzzle_pool_take(puzzle_pool_t pool, puzzle_st *puzzle) {
+  pthread_mutex_lock(&pool->lock);
+  if (pool->size == 0) {
+    pthread_mutex_unlock(&pool->lock);
+    return RLC_ERR;
+  }
+
+  // Each alpha is handed out once, so its slot is wiped on the way out.
+  memcpy(puzzle, &pool->puzzles[pool->head], sizeof(puzzle_st));
+  memzero(&pool->puzzles[pool->head], sizeof(puzzle_st));
+  pool->head = (pool->head + 1) % pool->capacity;
+  pool->size--;
+  pthread_cond_signal(&pool->not_full);
+  pthread_mutex_unlock(&pool->lock);
+
+  return RLC_OK;
+}
+
+void puzzle_pool_close(puzzle_pool_t pool) {
+  pthread_mutex_lock(&pool->lock);
+  pool->closed = 1;
+  pthread_cond_broadcast(&pool->not_full);
+  pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,173 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "relic/relic.h"
+#include "session.h"
+#include "types.h"
+
+static uint64_t session_mix(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return x;
+}
+
+// Session identifiers are chosen by the clients, so the hash is keyed to keep
+// them from steering entries into a single probe sequence.
+static size_t session_hash(const session_table_t table, const uint8_t *id) {
+  uint64_t lo, hi;
+  memcpy(&lo, id, sizeof(uint64_t));
+  memcpy(&hi, id + sizeof(uint64_t), sizeof(uint64_t));
+  return (size_t) (session_mix(lo ^ table->key[0]) ^ session_mix(hi ^ table->key[1]));
+}
+
+static size_t session_find(const session_table_t table, const uint8_t *id) {
+  const size_t mask = table->capacity - 1;
+  size_t i = session_hash(table, id) & mask;
+
+  while (table->entries[i].data != NULL) {
+    if (memcmp(table->entries[i].id, id, RLC_SESSION_ID_SIZE) == 0) {
+      return i;
+    }
+    i = (i + 1) & mask;
+  }
+  return table->capacity;
+}
+
+static void session_delete_at(session_table_t table, size_t hole) {
+  const size_t mask = table->capacity - 1;
+  size_t j = hole;
+
+  table->entries[hole].data = NULL;
+  while (1) {
+    j = (j + 1) & mask;
+    if (table->entries[j].data == NULL) {
+      break;
+    }
+
+    // Shift the entry back unless its home slot lies between the hole and j.
+    size_t home = session_hash(table, table->entries[j].id) & mask;
+    if (((j - home) & mask) >= ((j - hole) & mask)) {
+      table->entries[hole] = table->entries[j];
+      table->entries[j].data = NULL;
+      hole = j;
+    }
+  }
+  table->size--;
+}
+
+static int session_rehash(session_table_t table, size_t capacity, long long now) {
+  session_entry_st *old_entries = table->entries;
+  const size_t old_capacity = table->capacity;
+
+  session_entry_st *entries = calloc(capacity, sizeof(session_entry_st));
+  if (entries == NULL) {
+    return RLC_ERR;
+  }
+
+  table->entries = entries;
+  table->capacity = capacity;
+  table->size = 0;
+
+  for (size_t i = 0; i < old_capacity; i++) {
+    session_entry_st *entry = &old_entries[i];
+    if (entry->data == NULL) {
+      continue;
+    }
+
+    if (entry->expiry <= now) {
+      if (table->data_free != NULL) {
+        table->data_free(entry->data);
+      }
+      continue;
+    }
+
+    size_t j = session_hash(table, entry->id) & (capacity - 1);
+    while (entries[j].data != NULL) {
+      j = (j + 1) & (capacity - 1);
+    }
+    entries[j] = *entry;
+    table->size++;
+  }
+
+  free(old_entries);
+  return RLC_OK;
+}
+
+void *session_get(const session_table_t table, const uint8_t *id) {
+  size_t i = session_find(table, id);
+  if (i == table->capacity) {
+    return NULL;
+  }
+  return table->entries[i].data;
+}
+
+int session_put(session_table_t table, const uint8_t *id, void *data) {
+  return session_put_until(table, id, data, (long long) time(NULL) + SESSION_TIMEOUT);
+}
+
+// Stores a session that expires at a given time rather than SESSION_TIMEOUT
+// from now, e.g. one restored from a log.
+int session_put_until(session_table_t table, const uint8_t *id, void *data, long long expiry) {
+  if (data == NULL || session_find(table, id) != table->capacity) {
+    return RLC_ERR;
+  }
+
+  // Keep the load factor under 3/4, reclaiming expired sessions before growing.
+  long long now = (long long) time(NULL);
+  if (4 * (table->size + 1) > 3 * table->capacity) {
+    if (session_expire(table, now) == 0 || 2 * (table->size + 1) > table->capacity) {
+      if (session_rehash(table, 2 * table->capacity, now) != RLC_OK) {
+        return RLC_ERR;
+      }
+    }
+  }
+
+  const size_t mask = table->capacity - 1;
+  size_t i = session_hash(table, id) & mask;
+  while (table->entries[i].data != NULL) {
+    i = (i + 1) & mask;
+  }
+
+  memcpy(table->entries[i].id, id, RLC_SESSION_ID_SIZE);
+  table->entries[i].data = data;
+  table->entries[i].expiry = expiry;
+  table->size++;
+
+  return RLC_OK;
+}
+
+void *session_remove(session_table_t table, const uint8_t *id) {
+  size_t i = session_find(table, id);
+  if (i == table->capacity) {
+    return NULL;
+  }
+
+  void *data = table->entries[i].data;
+  session_delete_at(table, i);
+  return data;
+}
+
+size_t session_expire(session_table_t table, long long now) {
+  const size_t size = table->size;
+  if (session_rehash(table, table->capacity, now) != RLC_OK) {
+    return 0;
+  }
+  return size - table->size;
+}
+
+void session_table_clear(session_table_t table) {
+  for (size_t i = 0; i < table->capacity; i++) {
+    if (table->entries[i].data != NULL) {
+      if (table->data_free != NULL) {
+        table->data_free(table->entries[i].data);
+      }
+      table->entries[i].data = NULL;
+    }
+  }
+  table->size = 0;
+}
@@ -0,0 +1,235 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+#include "relic/relic.h"
+#include "session_log.h"
+#include "util.h"
+
+// FNV-1a, only meant to catch entries that did not make it to disk whole.
+static uint64_t session_log_checksum(const uint8_t *entry, size_t len) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < len; i++) {
+    h ^= entry[i];
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+static void session_log_encode(const session_log_t wal, uint8_t *entry, const uint8_t *id,
+                               const uint8_t *record, long long now) {
+  const int64_t written = (int64_t) now;
+  const size_t checksum_offset = wal->entry_size - sizeof(uint64_t);
+
+  memcpy(entry, id, RLC_SESSION_ID_SIZE);
+  memcpy(entry + RLC_SESSION_ID_SIZE, &written, sizeof(int64_t));
+  memcpy(entry + RLC_SESSION_ID_SIZE + sizeof(int64_t), record, wal->record_size);
+
+  const uint64_t checksum = session_log_checksum(entry, checksum_offset);
+  memcpy(entry + checksum_offset, &checksum, sizeof(uint64_t));
+}
+
+// Reads a segment back, stopping at the first entry that fails its checksum.
+// Whatever follows it is the tail of an interrupted flush and is cut off.
+static int session_log_replay_segment(session_log_t wal, int segment, long long now,
+                                      session_log_replay_t replay, void *arg, long long *first) {
+  const size_t checksum_offset = wal->entry_size - sizeof(uint64_t);
+  uint8_t entry[wal->entry_size];
+  off_t offset = 0;
+  int result_status = RLC_OK;
+
+  *first = -1;
+  if (lseek(wal->fd[segment], 0, SEEK_SET) != 0) {
+    return RLC_ERR;
+  }
+
+  while (1) {
+    size_t got = 0;
+    while (got < wal->entry_size) {
+      ssize_t rc = read(wal->fd[segment], entry + got, wal->entry_size - got);
+      if (rc < 0 && errno == EINTR) {
+        continue;
+      }
+      if (rc <= 0) {
+        break;
+      }
+      got += (size_t) rc;
+    }
+
+    uint64_t checksum;
+    memcpy(&checksum, entry + checksum_offset, sizeof(uint64_t));
+    if (got < wal->entry_size || checksum != session_log_checksum(entry, checksum_offset)) {
+      break;
+    }
+
+    int64_t written;
+    memcpy(&written, entry + RLC_SESSION_ID_SIZE, sizeof(int64_t));
+    if (*first < 0) {
+      *first = (long long) written;
+    }
+
+    if ((long long) written + SESSION_TIMEOUT > now
+    &&  replay(arg, entry, (long long) written, entry + RLC_SESSION_ID_SIZE + sizeof(int64_t)) != RLC_OK) {
+      result_status = RLC_ERR;
+      break;
+    }
+    offset += (off_t) wal->entry_size;
+  }
+
+  if (result_status == RLC_OK && ftruncate(wal->fd[segment], offset) != 0) {
+    result_status = RLC_ERR;
+  }
+  memzero(entry, wal->entry_size);
+
+  return result_status;
+}
+
+// Called without the lock, the flush in progress owns the files.
+static int session_log_write(session_log_t wal, const uint8_t *entries, size_t n) {
+  const long long now = (long long) time(NULL);
+  if (now - wal->rotated >= SESSION_TIMEOUT) {
+    const int next = (wal->active + 1) % SESSION_LOG_SEGMENTS;
+    if (ftruncate(wal->fd[next], 0) != 0) {
+      return RLC_ERR;
+    }
+    wal->active = next;
+    wal->rotated = now;
+  }
+
+  const int fd = wal->fd[wal->active];
+  size_t left = n * wal->entry_size;
+  while (left > 0) {
+    ssize_t rc = write(fd, entries, left);
+    if (rc < 0 && errno == EINTR) {
+      continue;
+    }
+    if (rc <= 0) {
+      return RLC_ERR;
+    }
+    entries += rc;
+    left -= (size_t) rc;
+  }
+
+  if (fdatasync(fd) != 0) {
+    return RLC_ERR;
+  }
+  return RLC_OK;
+}
+
+// Called with the lock held, which is released while the entries are written.
+static void session_log_flush(session_log_t wal) {
+  uint8_t *entries = wal->buffer;
+  const size_t n = wal->buffered;
+  const uint64_t appended = wal->appended;
+
+  wal->buffer = wal->spare;
+  wal->spare = entries;
+  wal->buffered = 0;
+  wal->flushing = 1;
+  pthread_mutex_unlock(&wal->lock);
+
+  const int rc = session_log_write(wal, entries, n);
+  memzero(entries, n * wal->entry_size);
+
+  pthread_mutex_lock(&wal->lock);
+  wal->flushing = 0;
+  if (rc == RLC_OK) {
+    wal->durable = appended;
+  } else {
+    // After a failed sync nothing says what reached the disk, so the log
+    // refuses every later append instead of acknowledging it.
+    wal->failed = 1;
+  }
+  pthread_cond_broadcast(&wal->flushed);
+}
+
+int session_log_open(session_log_t wal, const char *path, session_log_replay_t replay, void *arg) {
+  int result_status = RLC_OK;
+  const long long now = (long long) time(NULL);
+  long long first[SESSION_LOG_SEGMENTS];
+
+  RLC_TRY {
+    const size_t segment_file_length = strlen(path) + 16;
+    char segment_file_name[segment_file_length];
+
+    for (int i = 0; i < SESSION_LOG_SEGMENTS; i++) {
+      snprintf(segment_file_name, segment_file_length, "%s.%d", path, i);
+      wal->fd[i] = open(segment_file_name, O_RDWR | O_CREAT | O_APPEND, 0600);
+      if (wal->fd[i] < 0) {
+        RLC_THROW(ERR_NO_FILE);
+      }
+
+      if (session_log_replay_segment(wal, i, now, replay, arg, &first[i]) != RLC_OK) {
+        RLC_THROW(ERR_NO_READ);
+      }
+    }
+
+    // Segments are used in turn, so the active one is the one whose first
+    // entry is the most recent. Counting its age from that entry only delays
+    // the next rotation.
+    wal->active = 0;
+    for (int i = 1; i < SESSION_LOG_SEGMENTS; i++) {
+      if (first[i] > first[wal->active]) {
+        wal->active = i;
+      }
+    }
+    wal->rotated = first[wal->active] < 0 ? now : first[wal->active];
+  } RLC_CATCH_ANY {
+    fprintf(stderr, "Error: could not open the session log %s.\n", path);
+    result_status = RLC_ERR;
+  }
+
+  return result_status;
+}
+
+void session_log_close(session_log_t wal) {
+  for (int i = 0; i < SESSION_LOG_SEGMENTS; i++) {
+    if (wal->fd[i] >= 0) {
+      close(wal->fd[i]);
+      wal->fd[i] = -1;
+    }
+  }
+}
+
+int session_log_append(session_log_t wal, const uint8_t *id, const uint8_t *record) {
+  const long long now = (long long) time(NULL);
+
+  pthread_mutex_lock(&wal->lock);
+  while (wal->buffered == SESSION_LOG_BUFFER_ENTRIES && !wal->failed) {
+    if (wal->flushing) {
+      pthread_cond_wait(&wal->flushed, &wal->lock);
+    } else {
+      session_log_flush(wal);
+    }
+  }
+
+  if (wal->failed) {
+    pthread_mutex_unlock(&wal->lock);
+    return RLC_ERR;
+  }
+
+  session_log_encode(wal, wal->buffer + wal->buffered * wal->entry_size, id, record, now);
+  wal->buffered++;
+  const uint64_t appended = ++wal->appended;
+
+  // Whoever finds the files idle flushes for everyone who appended so far.
+  while (wal->durable < appended && !wal->failed) {
+    if (wal->flushing) {
+      pthread_cond_wait(&wal->flushed, &wal->lock);
+    } else {
+      session_log_flush(wal);
+    }
+  }
+
+  const int result_status = wal->durable >= appended ? RLC_OK : RLC_ERR;
+  pthread_mutex_unlock(&wal->lock);
+
+  return result_status;
+}
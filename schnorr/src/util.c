@@ -1,3 +1,4 @@
+#include <errno.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -5,10 +6,13 @@
 #include <time.h>
 #include "relic/relic.h"
 #include "pari/pari.h"
+#include "zmq.h"
+#include "cl_params_constants.h"
+#include "keystore.h"
 #include "types.h"
 #include "util.h"
 
-int init() {
+static int init_relic() {
 	if (core_init() != RLC_OK) {
 		core_clean();
 		return RLC_ERR;
@@ -28,8 +32,16 @@ int init() {
 	// Set the secp256k1 curve, which is used in Bitcoin.
 	ep_param_set(SECG_K256);
 
+	return RLC_OK;
+}
+
+int init() {
+	if (init_relic() != RLC_OK) {
+		return RLC_ERR;
+	}
+
 	// Initialize the PARI stack (in bytes) and randomness.
-	pari_init(10000000, 2);
+	pari_init(PARI_STACK_SIZE, 2);
 	setrand(getwalltime());
 	
 	return RLC_OK;
@@ -40,6 +52,27 @@ int clean() {
 	return core_clean();
 }
 
+int init_thread(struct pari_thread *pari_thread) {
+	// The RELIC context is thread-local, so each thread sets up its own groups.
+	if (init_relic() != RLC_OK) {
+		return RLC_ERR;
+	}
+
+	// Attach the PARI stack allocated by the spawning thread. Threads started in
+	// the same instant would share a wall-clock seed, so seed from RELIC instead.
+	ulong seed;
+	pari_thread_start(pari_thread);
+	rand_bytes((uint8_t *) &seed, sizeof(seed));
+	setrand(utoi(seed));
+
+	return RLC_OK;
+}
+
+int clean_thread() {
+	pari_thread_close();
+	return core_clean();
+}
+
 void memzero(void *ptr, size_t len) {
   typedef void *(*memset_t)(void *, int, size_t);
   static volatile memset_t memset_func = memset;
@@ -59,45 +92,146 @@ long long ttimer(void) {
 	return (long long) (time.tv_sec * CLOCK_PRECISION + time.tv_nsec);
 }
 
-void serialize_message(uint8_t **serialized,
-						const message_t message,
-						const unsigned msg_type_length,
-						const unsigned msg_data_length) {
-	*serialized = malloc(msg_type_length + msg_data_length + (2 * sizeof(unsigned)));
-	if (*serialized == NULL) {
-		RLC_THROW(ERR_NO_MEMORY);
+int wait_for_message(void *socket, long timeout) {
+	zmq_pollitem_t items[] = { { socket, 0, ZMQ_POLLIN, 0 } };
+
+	// Block until the socket is readable, the timeout expires or a signal arrives.
+	int rc = zmq_poll(items, 1, timeout);
+	if (rc < 0) {
+		return zmq_errno() == EINTR ? 0 : -1;
 	}
+	return (items[0].revents & ZMQ_POLLIN) ? 1 : 0;
+}
 
-	memcpy(*serialized, &msg_type_length, sizeof(unsigned));
-	memcpy(*serialized + sizeof(unsigned), message->type, msg_type_length);
-	
-	if (msg_data_length > 0) {
-		memcpy(*serialized + sizeof(unsigned) + msg_type_length, &msg_data_length, sizeof(unsigned));
-		memcpy(*serialized + (2 * sizeof(unsigned)) + msg_type_length, message->data, msg_data_length);
-	} else {
-		memset(*serialized + sizeof(unsigned) + msg_type_length, 0, sizeof(unsigned));
+// A REP socket can only send once it has received, and until it has replied.
+int reply_pending(void *socket) {
+	int events = 0;
+	size_t size = sizeof(events);
+	if (zmq_getsockopt(socket, ZMQ_EVENTS, &events, &size) != 0) {
+		return 1;
+	}
+	return (events & ZMQ_POLLOUT) != 0;
+}
+
+static const char *message_names[MSG_OPCODES] = {
+	[MSG_REGISTRATION] = "registration",
+	[MSG_REGISTRATION_DONE] = "registration_done",
+	[MSG_TOKEN_SHARE] = "token_share",
+	[MSG_PROMISE_INIT] = "promise_init",
+	[MSG_PROMISE_DONE] = "promise_done",
+	[MSG_PUZZLE_SHARE] = "puzzle_share",
+	[MSG_PUZZLE_SHARE_DONE] = "puzzle_share_done",
+	[MSG_PAYMENT_INIT] = "payment_init",
+	[MSG_PAYMENT_DONE] = "payment_done",
+	[MSG_PUZZLE_SOLUTION_SHARE] = "puzzle_solution_share",
+	[MSG_ERROR] = "error",
+};
+
+static void write_le16(uint8_t *buffer, uint16_t value) {
+	buffer[0] = (uint8_t) value;
+	buffer[1] = (uint8_t) (value >> 8);
+}
+
+static void write_le32(uint8_t *buffer, uint32_t value) {
+	write_le16(buffer, (uint16_t) value);
+	write_le16(buffer + 2, (uint16_t) (value >> 16));
+}
+
+static uint16_t read_le16(const uint8_t *buffer) {
+	return (uint16_t) (buffer[0] | (buffer[1] << 8));
+}
+
+static uint32_t read_le32(const uint8_t *buffer) {
+	return (uint32_t) read_le16(buffer) | ((uint32_t) read_le16(buffer + 2) << 16);
+}
+
+int message_build(zmq_msg_t *message,
+									uint8_t **data,
+									const uint16_t opcode,
+									const uint8_t *session_id,
+									const uint32_t data_length) {
+	if (zmq_msg_init_size(message, MESSAGE_HEADER_SIZE + data_length) != 0) {
+		return RLC_ERR;
 	}
+
+	// The header is written straight into the buffer ZMQ sends from, the
+	// caller serializes the data behind it.
+	uint8_t *buffer = (uint8_t *) zmq_msg_data(message);
+	write_le16(buffer, MESSAGE_MAGIC);
+	buffer[2] = MESSAGE_VERSION;
+	buffer[3] = 0;
+	write_le16(buffer + 4, opcode);
+	write_le32(buffer + 6, data_length);
+	memcpy(buffer + 10, session_id, RLC_SESSION_ID_SIZE);
+	*data = buffer + MESSAGE_HEADER_SIZE;
+
+	return RLC_OK;
 }
 
-void deserialize_message(message_t *deserialized_message, const uint8_t *serialized) {
-	unsigned msg_type_length;
-	memcpy(&msg_type_length, serialized, sizeof(unsigned));
-	unsigned msg_data_length;
-	memcpy(&msg_data_length, serialized + sizeof(unsigned) + msg_type_length, sizeof(unsigned));
+int message_send(zmq_msg_t *message, void *socket, int flags) {
+	const size_t size = zmq_msg_size(message);
+	if (zmq_msg_send(message, socket, flags) != (int) size) {
+		// ZMQ only takes the buffer over once it is sent.
+		zmq_msg_close(message);
+		return RLC_ERR;
+	}
+	return RLC_OK;
+}
 
-	message_null(*deserialized_message);
-	message_new(*deserialized_message, msg_type_length, msg_data_length);
+// A DEALER socket talks to REP peers, which expect the empty delimiter frame
+// a REQ socket would have put in front of the message.
+int message_send_dealer(zmq_msg_t *message, void *socket, int flags) {
+	if (zmq_send(socket, NULL, 0, flags | ZMQ_SNDMORE) != 0) {
+		zmq_msg_close(message);
+		return RLC_ERR;
+	}
+	return message_send(message, socket, flags);
+}
 
-	memcpy((*deserialized_message)->type, serialized + sizeof(unsigned), msg_type_length);
-	if (msg_data_length > 0) {
-		memcpy((*deserialized_message)->data, serialized + (2 * sizeof(unsigned)) + msg_type_length, msg_data_length);
+// An error carries no data. Without a session, as for a request that could not
+// be parsed, the identifier is all zeros.
+int message_send_error(void *socket, const uint8_t *session_id) {
+	static const uint8_t no_session[RLC_SESSION_ID_SIZE];
+	zmq_msg_t message;
+	uint8_t *data;
+
+	if (message_build(&message, &data, MSG_ERROR, session_id != NULL ? session_id : no_session, 0) != RLC_OK) {
+		return RLC_ERR;
 	}
+	return message_send(&message, socket, 0);
+}
+
+int message_parse(message_st *parsed, zmq_msg_t *message) {
+	uint8_t *buffer = (uint8_t *) zmq_msg_data(message);
+	const size_t size = zmq_msg_size(message);
+
+	if (size < MESSAGE_HEADER_SIZE
+	||  read_le16(buffer) != MESSAGE_MAGIC
+	||  buffer[2] != MESSAGE_VERSION
+	||  read_le32(buffer + 6) != size - MESSAGE_HEADER_SIZE) {
+		return RLC_ERR;
+	}
+
+	parsed->opcode = read_le16(buffer + 4);
+	parsed->data_length = read_le32(buffer + 6);
+	parsed->session_id = buffer + 10;
+	parsed->data = buffer + MESSAGE_HEADER_SIZE;
+
+	return RLC_OK;
+}
+
+const char *message_name(const uint16_t opcode) {
+	if (opcode >= MSG_OPCODES || message_names[opcode] == NULL) {
+		return "unknown";
+	}
+	return message_names[opcode];
 }
 
 int generate_keys_and_write_to_file(const cl_params_t params) {
 	int result_status = RLC_OK;
+	pari_sp av = avma;
 
-	GEN cl_sk_tumbler, cl_pk_tumbler;
+	GEN cl_sk_tumbler, cl_pk_tumbler, cl_pk_table;
 
 	bn_t q, x, y, ec_sk_alice, ec_sk_bob, ec_sk_tumbler;
 	ec_t ec_pk_alice, ec_pk_bob, ec_pk_tumbler;
@@ -107,8 +241,17 @@ int generate_keys_and_write_to_file(const cl_params_t params) {
 
 	uint8_t serialized_ec_sk[RLC_BN_SIZE];
 	uint8_t serialized_ec_pk[RLC_EC_SIZE_COMPRESSED];
-	uint8_t serialized_g1[RLC_G1_SIZE_COMPRESSED];
-	uint8_t serialized_g2[RLC_G2_SIZE_COMPRESSED];
+	uint8_t serialized_g1_x_1[RLC_G1_SIZE_COMPRESSED];
+	uint8_t serialized_g1_y_1[RLC_G1_SIZE_COMPRESSED];
+	uint8_t serialized_g2_x_2[RLC_G2_SIZE_COMPRESSED];
+	uint8_t serialized_g2_y_2[RLC_G2_SIZE_COMPRESSED];
+	uint8_t serialized_cl_level[sizeof(uint32_t)];
+
+	size_t cl_sk_length = 0, cl_pk_length = 0, cl_pk_table_length = 0, g_q_table_length = 0;
+	uint8_t *serialized_cl_sk = NULL;
+	uint8_t *serialized_cl_pk = NULL;
+	uint8_t *serialized_cl_pk_table = NULL;
+	uint8_t *serialized_g_q_table = NULL;
 
 	bn_null(q);
 	bn_null(x);
@@ -151,7 +294,8 @@ int generate_keys_and_write_to_file(const cl_params_t params) {
 
 		// Compute CL encryption secret/public key pair for the tumbler.
 		cl_sk_tumbler = randomi(params->bound);
-		cl_pk_tumbler = nupow(params->g_q, cl_sk_tumbler, NULL);
+		cl_pk_tumbler = cl_fixed_base_pow(params->g_q_table, cl_sk_tumbler, params->L);
+		cl_pk_table = cl_fixed_base_precompute(cl_pk_tumbler, params->L);
 
 		// Compute PS secret/public key pair for the tumbler.
 		pc_get_ord(q);
@@ -166,13 +310,13 @@ int generate_keys_and_write_to_file(const cl_params_t params) {
 		// Create the filenames for the keys.
 		unsigned alice_key_file_length = strlen(ALICE_KEY_FILE_PREFIX) + strlen(KEY_FILE_EXTENSION) + 10;
 		char *alice_key_file_name = malloc(alice_key_file_length);
-		
+
 		unsigned bob_key_file_length = strlen(BOB_KEY_FILE_PREFIX) + strlen(KEY_FILE_EXTENSION) + 10;
 		char *bob_key_file_name = malloc(bob_key_file_length);
-		
+
 		unsigned tumbler_key_file_length = strlen(TUMBLER_KEY_FILE_PREFIX) + strlen(KEY_FILE_EXTENSION) + 10;
 		char *tumbler_key_file_name = malloc(tumbler_key_file_length);
-		
+
 		if (alice_key_file_name == NULL || bob_key_file_name == NULL || tumbler_key_file_name == NULL) {
 			RLC_THROW(ERR_CAUGHT);
 		}
@@ -181,65 +325,75 @@ int generate_keys_and_write_to_file(const cl_params_t params) {
 		snprintf(bob_key_file_name, bob_key_file_length, "../keys/%s.%s", BOB_KEY_FILE_PREFIX, KEY_FILE_EXTENSION);
 		snprintf(tumbler_key_file_name, tumbler_key_file_length, "../keys/%s.%s", TUMBLER_KEY_FILE_PREFIX, KEY_FILE_EXTENSION);
 
-		// Write Alice's keys to a file.
-		FILE *file = fopen(alice_key_file_name, "wb");
-		if (file == NULL) {
-			RLC_THROW(ERR_NO_FILE);
-		}
-
+		// Write Alice's keys to a key store.
 		bn_write_bin(serialized_ec_sk, RLC_BN_SIZE, ec_sk_alice);
-		fwrite(serialized_ec_sk, sizeof(uint8_t), RLC_BN_SIZE, file);
 		ec_write_bin(serialized_ec_pk, RLC_EC_SIZE_COMPRESSED, ec_pk_alice, 1);
-		fwrite(serialized_ec_pk, sizeof(uint8_t), RLC_EC_SIZE_COMPRESSED, file);
 
-		memzero(serialized_ec_sk, RLC_BN_SIZE);
-		memzero(serialized_ec_pk, RLC_EC_SIZE_COMPRESSED);
-
-		fclose(file);
-
-		// Write Bob's keys to a file.
-		file = fopen(bob_key_file_name, "wb");
-		if (file == NULL) {
+		const keystore_entry_st alice_entries[] = {
+			{ KEYSTORE_EC_SK, serialized_ec_sk, RLC_BN_SIZE },
+			{ KEYSTORE_EC_PK, serialized_ec_pk, RLC_EC_SIZE_COMPRESSED },
+		};
+		if (keystore_write(alice_key_file_name, alice_entries, 2) != RLC_OK) {
 			RLC_THROW(ERR_NO_FILE);
 		}
 
+		// Write Bob's keys to a key store.
 		bn_write_bin(serialized_ec_sk, RLC_BN_SIZE, ec_sk_bob);
-		fwrite(serialized_ec_sk, sizeof(uint8_t), RLC_BN_SIZE, file);
 		ec_write_bin(serialized_ec_pk, RLC_EC_SIZE_COMPRESSED, ec_pk_bob, 1);
-		fwrite(serialized_ec_pk, sizeof(uint8_t), RLC_EC_SIZE_COMPRESSED, file);
-
-		memzero(serialized_ec_sk, RLC_BN_SIZE);
-		memzero(serialized_ec_pk, RLC_EC_SIZE_COMPRESSED);
-
-		fclose(file);
 
-		// Write Tumbler's keys to a file.
-		file = fopen(tumbler_key_file_name, "wb");
-		if (file == NULL) {
+		const keystore_entry_st bob_entries[] = {
+			{ KEYSTORE_EC_SK, serialized_ec_sk, RLC_BN_SIZE },
+			{ KEYSTORE_EC_PK, serialized_ec_pk, RLC_EC_SIZE_COMPRESSED },
+		};
+		if (keystore_write(bob_key_file_name, bob_entries, 2) != RLC_OK) {
 			RLC_THROW(ERR_NO_FILE);
 		}
 
-		// Tumbler has two EC public keys, one with Alice and one with Bob.
+		// Write Tumbler's keys to a key store, along with the fixed-base tables
+		// of the CL public key and of g_q so that no party has to compute them.
 		bn_write_bin(serialized_ec_sk, RLC_BN_SIZE, ec_sk_tumbler);
-		fwrite(serialized_ec_sk, sizeof(uint8_t), RLC_BN_SIZE, file);
 		ec_write_bin(serialized_ec_pk, RLC_EC_SIZE_COMPRESSED, ec_pk_tumbler, 1);
-		fwrite(serialized_ec_pk, sizeof(uint8_t), RLC_EC_SIZE_COMPRESSED, file);
-
-		fwrite(GENtostr_raw(cl_sk_tumbler), sizeof(char), RLC_CL_SECRET_KEY_SIZE, file);
-    	fwrite(GENtostr_raw(cl_pk_tumbler), sizeof(char), RLC_CL_PUBLIC_KEY_SIZE, file);
-
-		g1_write_bin(serialized_g1, RLC_G1_SIZE_COMPRESSED, ps_sk_tumbler->X_1, 1);
-		fwrite(serialized_g1, sizeof(uint8_t), RLC_G1_SIZE_COMPRESSED, file);
-		memzero(serialized_g1, RLC_G1_SIZE_COMPRESSED);
-		g1_write_bin(serialized_g1, RLC_G1_SIZE_COMPRESSED, ps_pk_tumbler->Y_1, 1);
-		fwrite(serialized_g1, sizeof(uint8_t), RLC_G1_SIZE_COMPRESSED, file);
-		g2_write_bin(serialized_g2, RLC_G2_SIZE_COMPRESSED, ps_pk_tumbler->X_2, 1);
-		fwrite(serialized_g2, sizeof(uint8_t), RLC_G2_SIZE_COMPRESSED, file);
-		memzero(serialized_g2, RLC_G2_SIZE_COMPRESSED);
-		g2_write_bin(serialized_g2, RLC_G2_SIZE_COMPRESSED, ps_pk_tumbler->Y_2, 1);
-		fwrite(serialized_g2, sizeof(uint8_t), RLC_G2_SIZE_COMPRESSED, file);
+		g1_write_bin(serialized_g1_x_1, RLC_G1_SIZE_COMPRESSED, ps_sk_tumbler->X_1, 1);
+		g1_write_bin(serialized_g1_y_1, RLC_G1_SIZE_COMPRESSED, ps_pk_tumbler->Y_1, 1);
+		g2_write_bin(serialized_g2_x_2, RLC_G2_SIZE_COMPRESSED, ps_pk_tumbler->X_2, 1);
+		g2_write_bin(serialized_g2_y_2, RLC_G2_SIZE_COMPRESSED, ps_pk_tumbler->Y_2, 1);
+
+		cl_sk_length = cl_int_size(cl_sk_tumbler);
+		cl_pk_length = cl_forms_size(mkvec(cl_pk_tumbler));
+		cl_pk_table_length = cl_forms_size(cl_pk_table);
+		g_q_table_length = cl_forms_size(params->g_q_table);
+
+		serialized_cl_sk = malloc(cl_sk_length);
+		serialized_cl_pk = malloc(cl_pk_length);
+		serialized_cl_pk_table = malloc(cl_pk_table_length);
+		serialized_g_q_table = malloc(g_q_table_length);
+		if (serialized_cl_sk == NULL || serialized_cl_pk == NULL
+		||  serialized_cl_pk_table == NULL || serialized_g_q_table == NULL) {
+			RLC_THROW(ERR_NO_MEMORY);
+		}
 
-		fclose(file);
+		cl_int_write_bin(serialized_cl_sk, cl_sk_length, cl_sk_tumbler);
+		cl_forms_write_bin(serialized_cl_pk, cl_pk_length, mkvec(cl_pk_tumbler));
+		cl_forms_write_bin(serialized_cl_pk_table, cl_pk_table_length, cl_pk_table);
+		cl_forms_write_bin(serialized_g_q_table, g_q_table_length, params->g_q_table);
+		write_le32(serialized_cl_level, CL_SECURITY_LEVEL);
+
+		const keystore_entry_st tumbler_entries[] = {
+			{ KEYSTORE_EC_SK, serialized_ec_sk, RLC_BN_SIZE },
+			{ KEYSTORE_EC_PK, serialized_ec_pk, RLC_EC_SIZE_COMPRESSED },
+			{ KEYSTORE_CL_SK, serialized_cl_sk, cl_sk_length },
+			{ KEYSTORE_CL_PK, serialized_cl_pk, cl_pk_length },
+			{ KEYSTORE_CL_PK_TABLE, serialized_cl_pk_table, cl_pk_table_length },
+			{ KEYSTORE_PS_SK_X_1, serialized_g1_x_1, RLC_G1_SIZE_COMPRESSED },
+			{ KEYSTORE_PS_PK_Y_1, serialized_g1_y_1, RLC_G1_SIZE_COMPRESSED },
+			{ KEYSTORE_PS_PK_X_2, serialized_g2_x_2, RLC_G2_SIZE_COMPRESSED },
+			{ KEYSTORE_PS_PK_Y_2, serialized_g2_y_2, RLC_G2_SIZE_COMPRESSED },
+			{ KEYSTORE_G_Q_TABLE, serialized_g_q_table, g_q_table_length },
+			{ KEYSTORE_CL_LEVEL, serialized_cl_level, sizeof(serialized_cl_level) },
+		};
+		if (keystore_write(tumbler_key_file_name, tumbler_entries, sizeof(tumbler_entries) / sizeof(tumbler_entries[0])) != RLC_OK) {
+			RLC_THROW(ERR_NO_FILE);
+		}
 
 		free(alice_key_file_name);
 		free(bob_key_file_name);
@@ -253,24 +407,36 @@ int generate_keys_and_write_to_file(const cl_params_t params) {
 		bn_free(ec_sk_alice);
 		bn_free(ec_sk_bob);
 		bn_free(ec_sk_tumbler);
-		
+
 		ec_free(ec_pk_alice);
 		ec_free(ec_pk_bob);
 		ec_free(ec_pk_tumbler);
 
 		ps_secret_key_free(ps_sk_tumbler);
 		ps_public_key_free(ps_pk_tumbler);
+
+		memzero(serialized_ec_sk, RLC_BN_SIZE);
+		memzero(serialized_g1_x_1, RLC_G1_SIZE_COMPRESSED);
+		if (serialized_cl_sk != NULL) {
+			memzero(serialized_cl_sk, cl_sk_length);
+			free(serialized_cl_sk);
+		}
+		free(serialized_cl_pk);
+		free(serialized_cl_pk_table);
+		free(serialized_g_q_table);
+		set_avma(av);
 	}
 
 	return result_status;
 }
 
-int read_keys_from_file_alice_bob(const char *name,
-								  ec_secret_key_t ec_sk,
-								  ec_public_key_t ec_pk,
-								  ec_public_key_t tumbler_ec_pk,
-								  ps_public_key_t tumbler_ps_pk,
-								  cl_public_key_t tumbler_cl_pk) {
+// Key files written before the key store: fixed offsets, CL keys as text.
+static int read_legacy_keys_from_file_alice_bob(const char *name,
+												ec_secret_key_t ec_sk,
+												ec_public_key_t ec_pk,
+												ec_public_key_t tumbler_ec_pk,
+												ps_public_key_t tumbler_ps_pk,
+												cl_public_key_t tumbler_cl_pk) {
 	int result_status = RLC_OK;
 
 	uint8_t serialized_ec_sk[RLC_BN_SIZE];
@@ -332,7 +498,7 @@ int read_keys_from_file_alice_bob(const char *name,
 		if (fread(serialized_cl_pk, sizeof(char), RLC_CL_PUBLIC_KEY_SIZE, file) != RLC_CL_PUBLIC_KEY_SIZE) {
 			RLC_THROW(ERR_NO_READ);
 		}
-		tumbler_cl_pk->pk = gp_read_str(serialized_cl_pk);
+		tumbler_cl_pk->pk = gclone(gp_read_str(serialized_cl_pk));
 
 		fseek(file, RLC_G1_SIZE_COMPRESSED, SEEK_CUR);
 		if (fread(serialized_g1, sizeof(uint8_t), RLC_G1_SIZE_COMPRESSED, file) != RLC_G1_SIZE_COMPRESSED) {
@@ -360,14 +526,14 @@ int read_keys_from_file_alice_bob(const char *name,
 	return result_status;
 }
 
-int read_keys_from_file_tumbler(ec_secret_key_t tumbler_ec_sk,
-								ec_public_key_t tumbler_ec_pk,
-								ps_secret_key_t tumbler_ps_sk,
-								ps_public_key_t tumbler_ps_pk,
-								cl_secret_key_t tumbler_cl_sk,
-								cl_public_key_t tumbler_cl_pk,
-								ec_public_key_t alice_ec_pk,
-								ec_public_key_t bob_ec_pk) {
+static int read_legacy_keys_from_file_tumbler(ec_secret_key_t tumbler_ec_sk,
+											  ec_public_key_t tumbler_ec_pk,
+											  ps_secret_key_t tumbler_ps_sk,
+											  ps_public_key_t tumbler_ps_pk,
+											  cl_secret_key_t tumbler_cl_sk,
+											  cl_public_key_t tumbler_cl_pk,
+											  ec_public_key_t alice_ec_pk,
+											  ec_public_key_t bob_ec_pk) {
 	int result_status = RLC_OK;
 
 	uint8_t serialized_ec_sk[RLC_BN_SIZE];
@@ -406,12 +572,12 @@ int read_keys_from_file_tumbler(ec_secret_key_t tumbler_ec_sk,
 		if (fread(serialized_cl_sk, sizeof(char), RLC_CL_SECRET_KEY_SIZE, file) != RLC_CL_SECRET_KEY_SIZE) {
 			RLC_THROW(ERR_NO_READ);
 		}
-		tumbler_cl_sk->sk = gp_read_str(serialized_cl_sk);
+		tumbler_cl_sk->sk = gclone(gp_read_str(serialized_cl_sk));
 		
 		if (fread(serialized_cl_pk, sizeof(char), RLC_CL_PUBLIC_KEY_SIZE, file) != RLC_CL_PUBLIC_KEY_SIZE) {
 			RLC_THROW(ERR_NO_READ);
 		}
-		tumbler_cl_pk->pk = gp_read_str(serialized_cl_pk);
+		tumbler_cl_pk->pk = gclone(gp_read_str(serialized_cl_pk));
 
 		if (fread(serialized_g1, sizeof(uint8_t), RLC_G1_SIZE_COMPRESSED, file) != RLC_G1_SIZE_COMPRESSED) {
 			RLC_THROW(ERR_NO_READ);
@@ -461,28 +627,602 @@ int read_keys_from_file_tumbler(ec_secret_key_t tumbler_ec_sk,
 		fclose(file);
 		free(key_file_name);
 
-		key_file_length = strlen(BOB_KEY_FILE_PREFIX) + strlen(KEY_FILE_EXTENSION) + 10;
-		key_file_name = malloc(key_file_length);
-		if (key_file_name == NULL) {
+		key_file_length = strlen(BOB_KEY_FILE_PREFIX) + strlen(KEY_FILE_EXTENSION) + 10;
+		key_file_name = malloc(key_file_length);
+		if (key_file_name == NULL) {
+			RLC_THROW(ERR_CAUGHT);
+		}
+
+		snprintf(key_file_name, key_file_length, "../keys/%s.%s", BOB_KEY_FILE_PREFIX, KEY_FILE_EXTENSION);
+		
+		file = fopen(key_file_name, "rb");
+		if (file == NULL) {
+			RLC_THROW(ERR_NO_FILE);
+		}
+
+		fseek(file, RLC_BN_SIZE, SEEK_SET);
+		if (fread(serialized_ec_pk, sizeof(uint8_t), RLC_EC_SIZE_COMPRESSED, file) != RLC_EC_SIZE_COMPRESSED) {
+			RLC_THROW(ERR_NO_READ);
+		}
+		ec_read_bin(bob_ec_pk->pk, serialized_ec_pk, RLC_EC_SIZE_COMPRESSED);
+		memzero(serialized_ec_pk, RLC_EC_SIZE_COMPRESSED);
+
+		fclose(file);
+		free(key_file_name);
+	} RLC_CATCH_ANY {
+		result_status = RLC_ERR;
+	}
+
+	return result_status;
+}
+
+// Reads the EC key pair of a party from its key store, skipping the secret
+// key when ec_sk is NULL.
+static int read_ec_keys_from_store(const char *name,
+								   ec_secret_key_t ec_sk,
+								   ec_public_key_t ec_pk) {
+	int result_status = RLC_OK;
+
+	keystore_t store;
+	keystore_null(store);
+
+	RLC_TRY {
+		const size_t key_file_length = strlen(name) + strlen(KEY_FILE_EXTENSION) + 10;
+		char key_file_name[key_file_length];
+		snprintf(key_file_name, key_file_length, "../keys/%s.%s", name, KEY_FILE_EXTENSION);
+
+		keystore_new(store);
+		if (keystore_open(store, key_file_name) != RLC_OK) {
+			RLC_THROW(ERR_NO_FILE);
+		}
+
+		const uint8_t *entry;
+		size_t length;
+
+		if (ec_sk != NULL) {
+			if ((entry = keystore_get(store, KEYSTORE_EC_SK, &length)) == NULL) {
+				RLC_THROW(ERR_NO_VALID);
+			}
+			bn_read_bin(ec_sk->sk, entry, length);
+		}
+
+		if ((entry = keystore_get(store, KEYSTORE_EC_PK, &length)) == NULL) {
+			RLC_THROW(ERR_NO_VALID);
+		}
+		ec_read_bin(ec_pk->pk, entry, length);
+	} RLC_CATCH_ANY {
+		result_status = RLC_ERR;
+	} RLC_FINALLY {
+		if (store != NULL) keystore_free(store);
+	}
+
+	return result_status;
+}
+
+// Reads the tumbler's keys from its key store, skipping the secret keys that
+// are NULL, which is how Alice and Bob read it. The fixed-base table of the
+// CL public key is taken along when the store has one.
+static int read_tumbler_keys_from_store(ec_secret_key_t tumbler_ec_sk,
+										ec_public_key_t tumbler_ec_pk,
+										ps_secret_key_t tumbler_ps_sk,
+										ps_public_key_t tumbler_ps_pk,
+										cl_secret_key_t tumbler_cl_sk,
+										cl_public_key_t tumbler_cl_pk) {
+	int result_status = RLC_OK;
+	pari_sp av = avma;
+
+	keystore_t store;
+	keystore_null(store);
+
+	RLC_TRY {
+		const size_t key_file_length = strlen(TUMBLER_KEY_FILE_PREFIX) + strlen(KEY_FILE_EXTENSION) + 10;
+		char key_file_name[key_file_length];
+		snprintf(key_file_name, key_file_length, "../keys/%s.%s", TUMBLER_KEY_FILE_PREFIX, KEY_FILE_EXTENSION);
+
+		keystore_new(store);
+		if (keystore_open(store, key_file_name) != RLC_OK) {
+			RLC_THROW(ERR_NO_FILE);
+		}
+
+		const uint8_t *entry;
+		size_t length;
+
+		if (tumbler_ec_sk != NULL) {
+			if ((entry = keystore_get(store, KEYSTORE_EC_SK, &length)) == NULL) {
+				RLC_THROW(ERR_NO_VALID);
+			}
+			bn_read_bin(tumbler_ec_sk->sk, entry, length);
+		}
+
+		if ((entry = keystore_get(store, KEYSTORE_EC_PK, &length)) == NULL) {
+			RLC_THROW(ERR_NO_VALID);
+		}
+		ec_read_bin(tumbler_ec_pk->pk, entry, length);
+
+		// CL keys only work with the parameters they were generated for.
+		uint32_t cl_level = 128;
+		if ((entry = keystore_get(store, KEYSTORE_CL_LEVEL, &length)) != NULL) {
+			if (length != sizeof(uint32_t)) {
+				RLC_THROW(ERR_NO_VALID);
+			}
+			cl_level = read_le32(entry);
+		}
+		if (cl_level != CL_SECURITY_LEVEL) {
+			fprintf(stderr, "Error: the CL keys are for security level %u, this build uses %d.\n", cl_level, CL_SECURITY_LEVEL);
+			RLC_THROW(ERR_NO_VALID);
+		}
+
+		if (tumbler_cl_sk != NULL) {
+			GEN cl_sk = (entry = keystore_get(store, KEYSTORE_CL_SK, &length)) == NULL ? NULL : cl_int_read_bin(entry, length);
+			if (cl_sk == NULL) {
+				RLC_THROW(ERR_NO_VALID);
+			}
+			tumbler_cl_sk->sk = gclone(cl_sk);
+		}
+
+		GEN cl_pk = (entry = keystore_get(store, KEYSTORE_CL_PK, &length)) == NULL ? NULL : cl_forms_read_bin(entry, length);
+		if (cl_pk == NULL || lg(cl_pk) != 2) {
+			RLC_THROW(ERR_NO_VALID);
+		}
+		tumbler_cl_pk->pk = gclone(gel(cl_pk, 1));
+
+		if ((entry = keystore_get(store, KEYSTORE_CL_PK_TABLE, &length)) != NULL) {
+			GEN cl_pk_table = cl_forms_read_bin(entry, length);
+			if (cl_pk_table == NULL) {
+				RLC_THROW(ERR_NO_VALID);
+			}
+			tumbler_cl_pk->pk_table = gclone(cl_pk_table);
+		}
+
+		if (tumbler_ps_sk != NULL) {
+			if ((entry = keystore_get(store, KEYSTORE_PS_SK_X_1, &length)) == NULL) {
+				RLC_THROW(ERR_NO_VALID);
+			}
+			g1_read_bin(tumbler_ps_sk->X_1, entry, length);
+		}
+
+		if ((entry = keystore_get(store, KEYSTORE_PS_PK_Y_1, &length)) == NULL) {
+			RLC_THROW(ERR_NO_VALID);
+		}
+		g1_read_bin(tumbler_ps_pk->Y_1, entry, length);
+
+		if ((entry = keystore_get(store, KEYSTORE_PS_PK_X_2, &length)) == NULL) {
+			RLC_THROW(ERR_NO_VALID);
+		}
+		g2_read_bin(tumbler_ps_pk->X_2, entry, length);
+
+		if ((entry = keystore_get(store, KEYSTORE_PS_PK_Y_2, &length)) == NULL) {
+			RLC_THROW(ERR_NO_VALID);
+		}
+		g2_read_bin(tumbler_ps_pk->Y_2, entry, length);
+	} RLC_CATCH_ANY {
+		result_status = RLC_ERR;
+	} RLC_FINALLY {
+		if (store != NULL) keystore_free(store);
+		set_avma(av);
+	}
+
+	return result_status;
+}
+
+int read_tables_from_file(cl_params_t params) {
+	int result_status = RLC_OK;
+	pari_sp av = avma;
+
+	keystore_t store;
+	keystore_null(store);
+
+	RLC_TRY {
+		const size_t key_file_length = strlen(TUMBLER_KEY_FILE_PREFIX) + strlen(KEY_FILE_EXTENSION) + 10;
+		char key_file_name[key_file_length];
+		snprintf(key_file_name, key_file_length, "../keys/%s.%s", TUMBLER_KEY_FILE_PREFIX, KEY_FILE_EXTENSION);
+
+		// Key files written before the key store carry no tables.
+		if (keystore_probe(key_file_name)) {
+			keystore_new(store);
+			if (keystore_open(store, key_file_name) != RLC_OK) {
+				RLC_THROW(ERR_NO_FILE);
+			}
+
+			size_t length;
+			const uint8_t *entry = keystore_get(store, KEYSTORE_G_Q_TABLE, &length);
+			if (entry != NULL) {
+				GEN g_q_table = cl_forms_read_bin(entry, length);
+				if (g_q_table == NULL) {
+					RLC_THROW(ERR_NO_VALID);
+				}
+				params->g_q_table = gclone(g_q_table);
+			}
+		}
+	} RLC_CATCH_ANY {
+		result_status = RLC_ERR;
+	} RLC_FINALLY {
+		if (store != NULL) keystore_free(store);
+		set_avma(av);
+	}
+
+	return result_status;
+}
+
+int read_keys_from_file_alice_bob(const char *name,
+								  ec_secret_key_t ec_sk,
+								  ec_public_key_t ec_pk,
+								  ec_public_key_t tumbler_ec_pk,
+								  ps_public_key_t tumbler_ps_pk,
+								  cl_public_key_t tumbler_cl_pk) {
+	const size_t key_file_length = strlen(name) + strlen(KEY_FILE_EXTENSION) + 10;
+	char key_file_name[key_file_length];
+	snprintf(key_file_name, key_file_length, "../keys/%s.%s", name, KEY_FILE_EXTENSION);
+
+	// Legacy key files only ever held keys for the 128-bit CL parameters.
+	if (!keystore_probe(key_file_name) && CL_SECURITY_LEVEL == 128) {
+		return read_legacy_keys_from_file_alice_bob(name, ec_sk, ec_pk, tumbler_ec_pk, tumbler_ps_pk, tumbler_cl_pk);
+	}
+
+	if (read_ec_keys_from_store(name, ec_sk, ec_pk) != RLC_OK
+	||  read_tumbler_keys_from_store(NULL, tumbler_ec_pk, NULL, tumbler_ps_pk, NULL, tumbler_cl_pk) != RLC_OK) {
+		return RLC_ERR;
+	}
+	return RLC_OK;
+}
+
+int read_keys_from_file_tumbler(ec_secret_key_t tumbler_ec_sk,
+								ec_public_key_t tumbler_ec_pk,
+								ps_secret_key_t tumbler_ps_sk,
+								ps_public_key_t tumbler_ps_pk,
+								cl_secret_key_t tumbler_cl_sk,
+								cl_public_key_t tumbler_cl_pk,
+								ec_public_key_t alice_ec_pk,
+								ec_public_key_t bob_ec_pk) {
+	const size_t key_file_length = strlen(TUMBLER_KEY_FILE_PREFIX) + strlen(KEY_FILE_EXTENSION) + 10;
+	char key_file_name[key_file_length];
+	snprintf(key_file_name, key_file_length, "../keys/%s.%s", TUMBLER_KEY_FILE_PREFIX, KEY_FILE_EXTENSION);
+
+	if (!keystore_probe(key_file_name) && CL_SECURITY_LEVEL == 128) {
+		return read_legacy_keys_from_file_tumbler(tumbler_ec_sk, tumbler_ec_pk, tumbler_ps_sk, tumbler_ps_pk,
+												  tumbler_cl_sk, tumbler_cl_pk, alice_ec_pk, bob_ec_pk);
+	}
+
+	if (read_tumbler_keys_from_store(tumbler_ec_sk, tumbler_ec_pk, tumbler_ps_sk, tumbler_ps_pk, tumbler_cl_sk, tumbler_cl_pk) != RLC_OK
+	||  read_ec_keys_from_store(ALICE_KEY_FILE_PREFIX, NULL, alice_ec_pk) != RLC_OK
+	||  read_ec_keys_from_store(BOB_KEY_FILE_PREFIX, NULL, bob_ec_pk) != RLC_OK) {
+		return RLC_ERR;
+	}
+	return RLC_OK;
+}
+
+void cl_int_write_bin(uint8_t *bin, size_t len, const GEN x) {
+	const size_t bytes = signe(x) == 0 ? 0 : (size_t) (expi(x) + 8) / 8;
+	if (bytes > 0xFFFF || RLC_CL_INT_HEADER_SIZE + bytes > len) {
+		RLC_THROW(ERR_NO_BUFFER);
+		return;
+	}
+
+	memset(bin, 0, len);
+	bin[0] = signe(x) < 0;
+	bin[1] = (uint8_t) (bytes >> 8);
+	bin[2] = (uint8_t) bytes;
+
+	// Fill the magnitude from its least significant byte, one limb at a time.
+	uint8_t *end = bin + RLC_CL_INT_HEADER_SIZE + bytes;
+	size_t written = 0;
+	GEN limb = int_LSW(x);
+	for (long i = 2; i < lgefint(x); i++, limb = int_nextW(limb)) {
+		ulong word = (ulong) *limb;
+		for (size_t j = 0; j < sizeof(ulong) && written < bytes; j++, written++) {
+			*(end - 1 - written) = (uint8_t) (word >> (8 * j));
+		}
+	}
+}
+
+GEN cl_int_read_bin(const uint8_t *bin, size_t len) {
+	if (len < RLC_CL_INT_HEADER_SIZE) {
+		RLC_THROW(ERR_NO_BUFFER);
+		return NULL;
+	}
+
+	const size_t bytes = ((size_t) bin[1] << 8) | bin[2];
+	if (bin[0] > 1 || RLC_CL_INT_HEADER_SIZE + bytes > len) {
+		RLC_THROW(ERR_NO_VALID);
+		return NULL;
+	}
+
+	if (bytes == 0) {
+		return gen_0;
+	}
+
+	const long words = (long) ((bytes + sizeof(ulong) - 1) / sizeof(ulong));
+	GEN x = cgetipos(words + 2);
+	const uint8_t *end = bin + RLC_CL_INT_HEADER_SIZE + bytes;
+	size_t read = 0;
+	GEN limb = int_LSW(x);
+	for (long i = 0; i < words; i++, limb = int_nextW(limb)) {
+		ulong word = 0;
+		for (size_t j = 0; j < sizeof(ulong) && read < bytes; j++, read++) {
+			word |= (ulong) *(end - 1 - read) << (8 * j);
+		}
+		*limb = (long) word;
+	}
+
+	x = int_normalize(x, 0);
+	if (bin[0] && signe(x) != 0) {
+		togglesign(x);
+	}
+	return x;
+}
+
+void cl_qfi_write_bin(uint8_t *bin, size_t len, const GEN form) {
+	// Only (a, b) are written, c follows from the discriminant.
+	const size_t half = len / 2;
+	cl_int_write_bin(bin, half, gel(form, 1));
+	cl_int_write_bin(bin + half, len - half, gel(form, 2));
+}
+
+GEN cl_qfi_read_bin(const uint8_t *bin, size_t len, const cl_params_t params) {
+	const size_t half = len / 2;
+	GEN a = cl_int_read_bin(bin, half);
+	GEN b = cl_int_read_bin(bin + half, len - half);
+	if (a == NULL || b == NULL || signe(a) <= 0 || abscmpii(b, a) > 0) {
+		RLC_THROW(ERR_NO_VALID);
+		return NULL;
+	}
+
+	// c = (b^2 - q^2 * Delta_K) / 4a, which is exact only for a valid form.
+	GEN remainder;
+	GEN discriminant = mulii(sqri(params->q), params->Delta_K);
+	GEN c = dvmdii(subii(sqri(b), discriminant), shifti(a, 2), &remainder);
+	if (signe(remainder) != 0) {
+		RLC_THROW(ERR_NO_VALID);
+		return NULL;
+	}
+
+	return qfi(a, b, c);
+}
+
+size_t cl_int_size(const GEN x) {
+	return RLC_CL_INT_HEADER_SIZE + (signe(x) == 0 ? 0 : (size_t) (expi(x) + 8) / 8);
+}
+
+// A vector of forms is stored as its length (4 bytes, big-endian) and a, b and
+// c of every form, each integer in as many bytes as it needs. Keeping c makes
+// reading a table a matter of copying limbs.
+size_t cl_forms_size(const GEN forms) {
+	size_t size = 4;
+	for (long i = 1; i < lg(forms); i++) {
+		for (long j = 1; j <= 3; j++) {
+			size += cl_int_size(gmael(forms, i, j));
+		}
+	}
+	return size;
+}
+
+void cl_forms_write_bin(uint8_t *bin, size_t len, const GEN forms) {
+	const uint32_t n = (uint32_t) (lg(forms) - 1);
+	if (len < 4) {
+		RLC_THROW(ERR_NO_BUFFER);
+		return;
+	}
+
+	bin[0] = (uint8_t) (n >> 24);
+	bin[1] = (uint8_t) (n >> 16);
+	bin[2] = (uint8_t) (n >> 8);
+	bin[3] = (uint8_t) n;
+
+	size_t offset = 4;
+	for (long i = 1; i <= (long) n; i++) {
+		for (long j = 1; j <= 3; j++) {
+			const size_t size = cl_int_size(gmael(forms, i, j));
+			if (size > len - offset) {
+				RLC_THROW(ERR_NO_BUFFER);
+				return;
+			}
+			cl_int_write_bin(bin + offset, size, gmael(forms, i, j));
+			offset += size;
+		}
+	}
+}
+
+GEN cl_forms_read_bin(const uint8_t *bin, size_t len) {
+	if (len < 4) {
+		RLC_THROW(ERR_NO_BUFFER);
+		return NULL;
+	}
+
+	const size_t n = ((size_t) bin[0] << 24) | ((size_t) bin[1] << 16) | ((size_t) bin[2] << 8) | bin[3];
+	if (n > (len - 4) / (3 * RLC_CL_INT_HEADER_SIZE)) {
+		RLC_THROW(ERR_NO_VALID);
+		return NULL;
+	}
+
+	GEN forms = cgetg((long) n + 1, t_VEC);
+	size_t offset = 4;
+	for (size_t i = 1; i <= n; i++) {
+		GEN coefficients[3];
+		for (int j = 0; j < 3; j++) {
+			coefficients[j] = cl_int_read_bin(bin + offset, len - offset);
+			if (coefficients[j] == NULL) {
+				return NULL;
+			}
+			offset += RLC_CL_INT_HEADER_SIZE + (((size_t) bin[offset + 1] << 8) | bin[offset + 2]);
+		}
+
+		if (signe(coefficients[0]) <= 0) {
+			RLC_THROW(ERR_NO_VALID);
+			return NULL;
+		}
+		gel(forms, i) = qfi(coefficients[0], coefficients[1], coefficients[2]);
+	}
+
+	return forms;
+}
+
+// RELIC digits and PARI limbs are both machine words stored least significant
+// first, so integers can move between the two libraries limb by limb.
+#if RLC_DIG != BITS_IN_LONG
+#error "RELIC digits must have the same width as PARI limbs"
+#endif
+
+GEN cl_int_from_bn(const bn_t x) {
+	if (bn_is_zero(x)) {
+		return gen_0;
+	}
+
+	GEN y = cgetipos(x->used + 2);
+	GEN limb = int_LSW(y);
+	for (int i = 0; i < x->used; i++, limb = int_nextW(limb)) {
+		*limb = (long) x->dp[i];
+	}
+
+	y = int_normalize(y, 0);
+	if (bn_sign(x) == RLC_NEG) {
+		togglesign(y);
+	}
+	return y;
+}
+
+void cl_int_to_bn(bn_t x, const GEN y) {
+	if (signe(y) == 0) {
+		bn_zero(x);
+		return;
+	}
+
+	const int words = (int) (lgefint(y) - 2);
+	bn_grow(x, words);
+
+	GEN limb = int_LSW(y);
+	for (int i = 0; i < words; i++, limb = int_nextW(limb)) {
+		x->dp[i] = (dig_t) *limb;
+	}
+	x->used = words;
+	x->sign = signe(y) < 0 ? RLC_NEG : RLC_POS;
+	bn_trim(x);
+}
+
+GEN cl_fixed_base_precompute(const GEN base, const GEN L) {
+	GEN table = cgetg(CL_FIXED_BASE_ROWS + 1, t_VEC);
+
+	gel(table, 1) = base;
+	for (long i = 2; i <= CL_FIXED_BASE_ROWS; i++) {
+		GEN row = gel(table, i - 1);
+		for (long j = 0; j < CL_FIXED_BASE_WINDOW; j++) {
+			row = nudupl(row, L);
+		}
+		gel(table, i) = row;
+	}
+
+	return table;
+}
+
+// Tables come from key stores too, where a stale one may be left behind.
+int cl_fixed_base_matches(const GEN table, const GEN base) {
+	return lg(table) - 1 == CL_FIXED_BASE_ROWS && gequal(gel(table, 1), base);
+}
+
+GEN cl_fixed_base_pow(const GEN table, const GEN exponent, const GEN L) {
+	const long rows = lg(table) - 1;
+	if (signe(exponent) == 0) {
+		return qfi_1(gel(table, 1));
+	}
+
+	if (expi(exponent) >= rows * CL_FIXED_BASE_WINDOW) {
+		return nupow(gel(table, 1), exponent, L);
+	}
+
+	// Yao's method: for every digit value d, from the largest down, fold the rows
+	// whose digit is at least d into a running product, and multiply it in.
+	GEN digits = binary_2k_nv(exponent, CL_FIXED_BASE_WINDOW);
+	const long length = lg(digits) - 1;
+	GEN result = NULL;
+	GEN partial = NULL;
+
+	for (long d = (1L << CL_FIXED_BASE_WINDOW) - 1; d > 0; d--) {
+		for (long i = 1; i <= length; i++) {
+			if (digits[length - i + 1] == d) {
+				partial = partial == NULL ? gel(table, i) : nucomp(partial, gel(table, i), L);
+			}
+		}
+
+		if (partial != NULL) {
+			result = result == NULL ? partial : nucomp(result, partial, L);
+		}
+	}
+
+	return signe(exponent) < 0 ? ginv(result) : result;
+}
+
+GEN cl_multi_pow(const GEN bases, const GEN exponents, const GEN L) {
+	const long n = lg(bases) - 1;
+	const long digit_values = 1L << CL_MULTI_POW_WINDOW;
+	GEN tables = cgetg(n + 1, t_VEC);
+	GEN digits = cgetg(n + 1, t_VEC);
+	long length = 0;
+
+	// Negative exponents are applied to the inverse form, so that every base
+	// gets a table of its first 2^w - 1 powers and unsigned digits.
+	for (long i = 1; i <= n; i++) {
+		GEN base = signe(gel(exponents, i)) < 0 ? ginv(gel(bases, i)) : gel(bases, i);
+		GEN table = cgetg(digit_values, t_VEC);
+		gel(table, 1) = base;
+		for (long d = 2; d < digit_values; d++) {
+			gel(table, d) = nucomp(gel(table, d - 1), base, L);
+		}
+		gel(tables, i) = table;
+
+		if (signe(gel(exponents, i)) == 0) {
+			gel(digits, i) = cgetg(1, t_VECSMALL);
+		} else {
+			gel(digits, i) = binary_2k_nv(absi(gel(exponents, i)), CL_MULTI_POW_WINDOW);
+		}
+		length = maxss(length, lg(gel(digits, i)) - 1);
+	}
+
+	// Straus' method: all bases share one chain of squarings, and the digits of
+	// every exponent at the same position are multiplied in after it.
+	GEN result = NULL;
+	for (long position = 0; position < length; position++) {
+		if (result != NULL) {
+			for (long j = 0; j < CL_MULTI_POW_WINDOW; j++) {
+				result = nudupl(result, L);
+			}
+		}
+
+		for (long i = 1; i <= n; i++) {
+			GEN exponent_digits = gel(digits, i);
+			const long offset = length - (lg(exponent_digits) - 1);
+			if (position < offset) {
+				continue;
+			}
+
+			const long d = exponent_digits[position - offset + 1];
+			if (d != 0) {
+				GEN power = gel(gel(tables, i), d);
+				result = result == NULL ? power : nucomp(result, power, L);
+			}
+		}
+	}
+
+	return result == NULL ? qfi_1(gel(bases, 1)) : result;
+}
+
+int cl_public_key_precompute(cl_public_key_t public_key, const cl_params_t params) {
+	int result_status = RLC_OK;
+
+	RLC_TRY {
+		if (public_key == NULL || params == NULL) {
 			RLC_THROW(ERR_CAUGHT);
 		}
 
-		snprintf(key_file_name, key_file_length, "../keys/%s.%s", BOB_KEY_FILE_PREFIX, KEY_FILE_EXTENSION);
-		
-		file = fopen(key_file_name, "rb");
-		if (file == NULL) {
-			RLC_THROW(ERR_NO_FILE);
+		// A table read from the key store is kept if it is one for this key.
+		if (public_key->pk_table != NULL && !cl_fixed_base_matches(public_key->pk_table, public_key->pk)) {
+			gunclone(public_key->pk_table);
+			public_key->pk_table = NULL;
 		}
 
-		fseek(file, RLC_BN_SIZE, SEEK_SET);
-		if (fread(serialized_ec_pk, sizeof(uint8_t), RLC_EC_SIZE_COMPRESSED, file) != RLC_EC_SIZE_COMPRESSED) {
-			RLC_THROW(ERR_NO_READ);
+		if (public_key->pk_table == NULL) {
+			pari_sp av = avma;
+			public_key->pk_table = gclone(cl_fixed_base_precompute(public_key->pk, params->L));
+			set_avma(av);
 		}
-		ec_read_bin(bob_ec_pk->pk, serialized_ec_pk, RLC_EC_SIZE_COMPRESSED);
-		memzero(serialized_ec_pk, RLC_EC_SIZE_COMPRESSED);
-
-		fclose(file);
-		free(key_file_name);
 	} RLC_CATCH_ANY {
 		result_status = RLC_ERR;
 	}
@@ -490,38 +1230,93 @@ int read_keys_from_file_tumbler(ec_secret_key_t tumbler_ec_sk,
 	return result_status;
 }
 
+GEN cl_public_key_pow(const cl_public_key_t public_key, const GEN exponent, const cl_params_t params) {
+	if (public_key->pk_table != NULL) {
+		return cl_fixed_base_pow(public_key->pk_table, exponent, params->L);
+	}
+	return nupow(public_key->pk, exponent, params->L);
+}
+
+// f^x = (q^2, Lq, (L^2 - Delta_K) / 4) with L = x^-1 mod q of odd parity, for x
+// not a multiple of q. f has order q, so only x mod q matters.
+static GEN cl_f_pow(const GEN x, const cl_params_t params) {
+	GEN L = Fp_inv(x, params->q);
+	if (!mpodd(L)) {
+		L = subii(L, params->q);
+	}
+	return qfi(sqri(params->q), mulii(L, params->q), shifti(subii(sqri(L), params->Delta_K), -2));
+}
+
+// base^exponent * c^k, with a fixed-base table for base when there is one.
+// Otherwise both powers are computed in a single pass of squarings.
+static GEN cl_pow_times_pow(const GEN table, const GEN base, const GEN exponent, const GEN c, const GEN k, const GEN L) {
+	if (table != NULL) {
+		return nucomp(cl_fixed_base_pow(table, exponent, L), cl_multi_pow(mkvec(c), mkvec(k), L), L);
+	}
+	return cl_multi_pow(mkvec2(base, c), mkvec2(exponent, k), L);
+}
+
+#if CL_PARAMS_BITS_IN_LONG != BITS_IN_LONG
+#error "cl_params_constants.h was generated for a different limb size"
+#endif
+
+// Wraps limbs emitted by cl_params_gen as a PARI integer, nothing is parsed.
+static GEN cl_int_from_limbs(const ulong *limbs, size_t n, int sign) {
+	GEN x = cgetipos((long) n + 2);
+	GEN limb = int_LSW(x);
+	for (size_t i = 0; i < n; i++, limb = int_nextW(limb)) {
+		*limb = (long) limbs[i];
+	}
+
+	x = int_normalize(x, 0);
+	if (sign < 0) {
+		togglesign(x);
+	}
+	return x;
+}
+
+#define CL_PARAMS_INT(name) cl_int_from_limbs(name, sizeof(name) / sizeof(name[0]), name##_SIGN)
+
 int generate_cl_params(cl_params_t params) {
 	int result_status = RLC_OK;
+	pari_sp av = avma;
 
 	RLC_TRY {
 		if (params == NULL) {
 			RLC_THROW(ERR_CAUGHT);
 		}
 
-		// Parameters generated using SageMath script.
-		params->Delta_K = negi(strtoi("7917297328878683784842235952488620683924100338715963369693275768732162831834859052302716918416013031853265985178593375655994934704463023676296364363803257769443921988228513012040548137047446483986199954435962221122006965317176921759968659376932101987729556148116190707955808747136944623277094531007901655971804163515065712136708172984834192213773138039179492400722665370317221867505959207212674207052581946756527848674480328854830559945140752059719739492686061412113598389028096554833252668553020964851121112531561161799093718416247246137641387797659"));
-		// Bound for exponentiation, for uniform sampling to be at 2^{-40} from the unifom in <g_q>.
-   		params->bound = strtoi("25413151665722220203610173826311975594790577398151861612310606875883990655261658217495681782816066858410439979225400605895077952191850577877370585295070770312182177789916520342292660169492395314400288273917787194656036294620169343699612953311314935485124063580486497538161801803224580096");
-
-    	GEN g_q_a = strtoi("4008431686288539256019978212352910132512184203702279780629385896624473051840259706993970111658701503889384191610389161437594619493081376284617693948914940268917628321033421857293703008209538182518138447355678944124861126384966287069011522892641935034510731734298233539616955610665280660839844718152071538201031396242932605390717004106131705164194877377");
-    	GEN g_q_b = negi(strtoi("3117991088204303366418764671444893060060110057237597977724832444027781815030207752301780903747954421114626007829980376204206959818582486516608623149988315386149565855935873517607629155593328578131723080853521348613293428202727746191856239174267496577422490575311784334114151776741040697808029563449966072264511544769861326483835581088191752567148165409"));
-    	GEN g_q_c = strtoi("7226982982667784284607340011220616424554394853592495056851825214613723615410492468400146084481943091452495677425649405002137153382700126963171182913281089395393193450415031434185562111748472716618186256410737780813669746598943110785615647848722934493732187571819575328802273312361412673162473673367423560300753412593868713829574117975260110889575205719");
-
-		// Order of the secp256k1 elliptic curve group and the group G^q.
-		params->q = strtoi("115792089237316195423570985008687907852837564279074904382605163141518161494337");
-		params->g_q = qfi(g_q_a, g_q_b, g_q_c);
-
-		GEN A = strtoi("0");
-		GEN B = strtoi("7");
-		GEN p = strtoi("115792089237316195423570985008687907853269984665640564039457584007908834671663");
-		GEN coeff = mkvecn(2, A, B);
-		params->E = ellinit(coeff, p, 1);
+		// Parameters of CL_SECURITY_LEVEL, turned into limbs by cl_params_gen at
+		// build time. The bound is for exponentiation, for uniform sampling to be
+		// at 2^{-40} from the unifom in <g_q>, and q is the order of the secp256k1
+		// elliptic curve group and the group G^q.
+		params->Delta_K = CL_PARAMS_INT(CL_DELTA_K);
+		params->bound = CL_PARAMS_INT(CL_BOUND);
+		params->q = CL_PARAMS_INT(CL_Q);
+		params->g_q = qfi(CL_PARAMS_INT(CL_G_Q_A), CL_PARAMS_INT(CL_G_Q_B), CL_PARAMS_INT(CL_G_Q_C));
+
+		// NUCOMP bound and fixed-base table for g_q, which never changes. A table
+		// installed by read_tables_from_file() beforehand is used instead.
+		params->L = CL_PARAMS_INT(CL_L);
+		GEN g_q_table = NULL;
+		if (params->g_q_table == NULL || !cl_fixed_base_matches(params->g_q_table, params->g_q)) {
+			g_q_table = cl_fixed_base_precompute(params->g_q, params->L);
+		}
 
-		GEN Gx = strtoi("0x79be667ef9dcbbac55a06295ce870b07029bfcdb2dce28d959f2815b16f81798");
-		GEN Gy = strtoi("0x483ada7726a3c4655da4fbfc0e1108a8fd17b448a68554199c47d08ffb10d4b8");
-		params->G = mkvecn(2, Gx, Gy);
+		// The parameters live as long as the party, so move them off the stack.
+		params->Delta_K = gclone(params->Delta_K);
+		params->q = gclone(params->q);
+		params->g_q = gclone(params->g_q);
+		params->bound = gclone(params->bound);
+		params->L = gclone(params->L);
+		if (g_q_table != NULL) {
+			if (params->g_q_table != NULL) gunclone(params->g_q_table);
+			params->g_q_table = gclone(g_q_table);
+		}
 	} RLC_CATCH_ANY {
 		result_status = RLC_ERR;
+	} RLC_FINALLY {
+		set_avma(av);
 	}
 
 	return result_status;
@@ -535,16 +1330,8 @@ int cl_enc(cl_ciphertext_t ciphertext,
 
   RLC_TRY {
     ciphertext->r = randomi(params->bound);
-    ciphertext->c1 = nupow(params->g_q, ciphertext->r, NULL);
-
-    GEN L = Fp_inv(plaintext, params->q);
-    if (!mpodd(L)) {
-      	L = subii(L, params->q);
-    }
-
-		// f^plaintext = (q^2, Lq, (L - Delta_k) / 4)
-    GEN fm = qfi(sqri(params->q), mulii(L, params->q), shifti(subii(sqri(L), params->Delta_K), -2));
-    ciphertext->c2 = gmul(nupow(public_key->pk, ciphertext->r, NULL), fm);
+    ciphertext->c1 = cl_fixed_base_pow(params->g_q_table, ciphertext->r, params->L);
+    ciphertext->c2 = gmul(cl_public_key_pow(public_key, ciphertext->r, params), cl_f_pow(plaintext, params));
   } RLC_CATCH_ANY {
     	result_status = RLC_ERR;
   }
@@ -552,6 +1339,26 @@ int cl_enc(cl_ciphertext_t ciphertext,
   return result_status;
 }
 
+// cl_enc() with r and its powers computed beforehand, see cl_reservoir.h.
+int cl_enc_precomputed(cl_ciphertext_t ciphertext,
+					   const GEN plaintext,
+					   const GEN r,
+					   const GEN g_q_to_the_r,
+					   const GEN pk_to_the_r,
+					   const cl_params_t params) {
+	int result_status = RLC_OK;
+
+	RLC_TRY {
+		ciphertext->r = r;
+		ciphertext->c1 = g_q_to_the_r;
+		ciphertext->c2 = gmul(pk_to_the_r, cl_f_pow(plaintext, params));
+	} RLC_CATCH_ANY {
+		result_status = RLC_ERR;
+	}
+
+	return result_status;
+}
+
 int cl_dec(GEN *plaintext,
 					 const cl_ciphertext_t ciphertext,
 					 const cl_secret_key_t secret_key,
@@ -560,7 +1367,7 @@ int cl_dec(GEN *plaintext,
 
   RLC_TRY {
 		// c2 * (c1^sk)^(-1)
-    GEN fm = gmul(ciphertext->c2, ginv(nupow(ciphertext->c1, secret_key->sk, NULL)));
+    GEN fm = gmul(ciphertext->c2, ginv(nupow(ciphertext->c1, secret_key->sk, params->L)));
     GEN L = diviiexact(gel(fm, 2), params->q);
     *plaintext = Fp_inv(L, params->q);
   } RLC_CATCH_ANY {
@@ -608,6 +1415,7 @@ int adaptor_schnorr_sign(schnorr_signature_t signature,
 			ec_get_x(x, R);
 			bn_mod(r, x, q);
 		} while (bn_is_zero(r));
+		ec_copy(signature->R, R);
 
 		memcpy(m, msg, len);
 		bn_write_bin(m + len, RLC_FC_BYTES, r);
@@ -714,6 +1522,179 @@ int adaptor_schnorr_preverify(schnorr_signature_t signature,
 	return result_status;
 }
 
+int schnorr_sign(schnorr_signature_t signature,
+								 uint8_t *msg,
+								 size_t len,
+								 const ec_secret_key_t secret_key) {
+	int result_status = RLC_OK;
+
+	ec_t infinity;
+	ec_null(infinity);
+
+	RLC_TRY {
+		ec_new(infinity);
+		ec_set_infty(infinity);
+
+		// A pre-signature for the identity is a complete signature.
+		if (adaptor_schnorr_sign(signature, msg, len, infinity, secret_key) != RLC_OK) {
+			RLC_THROW(ERR_CAUGHT);
+		}
+	} RLC_CATCH_ANY {
+		result_status = RLC_ERR;
+	} RLC_FINALLY {
+		ec_free(infinity);
+	}
+
+	return result_status;
+}
+
+// e = H(msg || x(R) mod q), as computed by cp_ecss_sig.
+static int schnorr_challenge(bn_t e, const uint8_t *msg, size_t len, const ec_t R, const bn_t q) {
+	int result_status = RLC_OK;
+
+	bn_t r;
+	uint8_t hash[RLC_MD_LEN];
+	uint8_t *m = RLC_ALLOCA(uint8_t, len + RLC_FC_BYTES);
+
+	bn_null(r);
+
+	RLC_TRY {
+		bn_new(r);
+
+		if (m == NULL) {
+			RLC_THROW(ERR_NO_MEMORY);
+		}
+
+		ec_get_x(r, R);
+		bn_mod(r, r, q);
+
+		memcpy(m, msg, len);
+		bn_write_bin(m + len, RLC_FC_BYTES, r);
+		md_map(hash, m, len + RLC_FC_BYTES);
+
+		if (8 * RLC_MD_LEN > bn_bits(q)) {
+			len = RLC_CEIL(bn_bits(q), 8);
+			bn_read_bin(e, hash, len);
+			bn_rsh(e, e, 8 * RLC_MD_LEN - bn_bits(q));
+		} else {
+			bn_read_bin(e, hash, RLC_MD_LEN);
+		}
+
+		bn_mod(e, e, q);
+	} RLC_CATCH_ANY {
+		result_status = RLC_ERR;
+	} RLC_FINALLY {
+		bn_free(r);
+		RLC_FREE(m);
+	}
+
+	return result_status;
+}
+
+int schnorr_batch_verify(const schnorr_signature_t *signatures,
+												 const ec_public_key_t *public_keys,
+												 uint8_t *const *msgs,
+												 const size_t *lens,
+												 size_t n) {
+	if (n == 0) {
+		return RLC_OK;
+	}
+
+	int result_status = RLC_ERR;
+
+	const size_t points_count = (2 * n) + 1;
+	bn_t q, e, rho, sum_s;
+	bn_t *scalars = NULL;
+	ec_t *points = NULL;
+	ec_t T;
+
+	bn_null(q);
+	bn_null(e);
+	bn_null(rho);
+	bn_null(sum_s);
+	ec_null(T);
+
+	RLC_TRY {
+		bn_new(q);
+		bn_new(e);
+		bn_new(rho);
+		bn_new(sum_s);
+		ec_new(T);
+
+		scalars = calloc(points_count, sizeof(bn_t));
+		points = calloc(points_count, sizeof(ec_t));
+		if (scalars == NULL || points == NULL) {
+			RLC_THROW(ERR_NO_MEMORY);
+		}
+		for (size_t i = 0; i < points_count; i++) {
+			bn_null(scalars[i]);
+			ec_null(points[i]);
+			bn_new(scalars[i]);
+			ec_new(points[i]);
+		}
+
+		ec_curve_get_ord(q);
+		bn_zero(sum_s);
+
+		// Each R_i must hash to e_i, then with random rho_i the equations
+		// s_i g + e_i pk_i = R_i are checked at once as
+		//   (sum rho_i s_i) g + sum (rho_i e_i) pk_i - sum rho_i R_i = 0.
+		int valid = 1;
+		for (size_t i = 0; i < n; i++) {
+			const schnorr_signature_t signature = signatures[i];
+			if (bn_sign(signature->e) != RLC_POS || bn_sign(signature->s) != RLC_POS || bn_is_zero(signature->s)
+			||  bn_cmp(signature->e, q) != RLC_LT || bn_cmp(signature->s, q) != RLC_LT || ec_is_infty(signature->R)) {
+				valid = 0;
+				break;
+			}
+
+			if (schnorr_challenge(e, msgs[i], lens[i], signature->R, q) != RLC_OK) {
+				RLC_THROW(ERR_CAUGHT);
+			}
+			if (bn_cmp(e, signature->e) != RLC_EQ) {
+				valid = 0;
+				break;
+			}
+
+			bn_rand(rho, RLC_POS, 128); // a false batch passes with probability 2^-128
+			bn_mul(scalars[i], rho, signature->e);
+			bn_mod(scalars[i], scalars[i], q);
+			ec_copy(points[i], public_keys[i]->pk);
+			bn_sub(scalars[n + i], q, rho);
+			ec_copy(points[n + i], signature->R);
+
+			bn_mul(e, rho, signature->s);
+			bn_add(sum_s, sum_s, e);
+			bn_mod(sum_s, sum_s, q);
+		}
+
+		if (valid) {
+			bn_copy(scalars[2 * n], sum_s);
+			ec_curve_get_gen(points[2 * n]);
+			ec_mul_sim_lot(T, (const ec_t *) points, (const bn_t *) scalars, (int) points_count);
+			if (ec_is_infty(T)) {
+				result_status = RLC_OK;
+			}
+		}
+	} RLC_CATCH_ANY {
+		result_status = RLC_ERR;
+	} RLC_FINALLY {
+		bn_free(q);
+		bn_free(e);
+		bn_free(rho);
+		bn_free(sum_s);
+		ec_free(T);
+		for (size_t i = 0; scalars != NULL && points != NULL && i < points_count; i++) {
+			bn_free(scalars[i]);
+			ec_free(points[i]);
+		}
+		free(scalars);
+		free(points);
+	}
+
+	return result_status;
+}
+
 int ps_blind_sign(ps_signature_t signature,
 									const pedersen_com_t com, 
 									const ps_secret_key_t secret_key) {
@@ -800,42 +1781,157 @@ int ps_verify(const ps_signature_t signature,
 						 	const ps_public_key_t public_key) {
 	int result_status = RLC_ERR;
 
-	g2_t g2_gen, y_2_to_the_m;
-	g2_t x_2_times_y_2_to_the_m;
-	gt_t pairing_1, pairing_2;
+	g1_t g1_points[3];
+	g2_t g2_points[3];
+	gt_t pairing;
 
-	g2_null(g2_gen);
-	g2_null(y_2_to_the_m);
-	g2_null(x_2_times_y_2_to_the_m);
-	gt_null(pairing_1);
-	gt_null(pairing_2);
+	for (int i = 0; i < 3; i++) {
+		g1_null(g1_points[i]);
+		g2_null(g2_points[i]);
+	}
+	gt_null(pairing);
 
 	RLC_TRY {
-		g2_new(g2_gen);
-		g2_new(y_2_to_the_m);
-		g2_new(x_2_times_y_2_to_the_m);
-		gt_new(pairing_1);
-		gt_new(pairing_2);
+		for (int i = 0; i < 3; i++) {
+			g1_new(g1_points[i]);
+			g2_new(g2_points[i]);
+		}
+		gt_new(pairing);
+
+		// e(sigma_1, X_2 + m Y_2) = e(sigma_2, g_2) is checked as the product
+		// e(sigma_1, X_2) e(m sigma_1, Y_2) e(-sigma_2, g_2) = 1, which moves the
+		// scalar multiplication to G1 and shares the final exponentiation.
+		if (!g1_is_infty(signature->sigma_1)) {
+			g1_copy(g1_points[0], signature->sigma_1);
+			g2_copy(g2_points[0], public_key->X_2);
+			g1_mul(g1_points[1], signature->sigma_1, message);
+			g2_copy(g2_points[1], public_key->Y_2);
+			g1_neg(g1_points[2], signature->sigma_2);
+			g2_get_gen(g2_points[2]);
+
+			pc_map_sim(pairing, g1_points, g2_points, 3);
+			if (gt_is_unity(pairing)) {
+				result_status = RLC_OK;
+			}
+		}
+	} RLC_CATCH_ANY {
+		result_status = RLC_ERR;
+	} RLC_FINALLY {
+		for (int i = 0; i < 3; i++) {
+			g1_free(g1_points[i]);
+			g2_free(g2_points[i]);
+		}
+		gt_free(pairing);
+	}
+
+	return result_status;
+}
 
-		g2_get_gen(g2_gen);
+int ps_batch_verify(const ps_signature_t *signatures,
+										bn_t *messages,
+										size_t n,
+										const ps_public_key_t public_key) {
+	if (n == 0) {
+		return RLC_OK;
+	}
 
-		g2_mul(y_2_to_the_m, public_key->Y_2, message);
-		g2_add(x_2_times_y_2_to_the_m, public_key->X_2, y_2_to_the_m);
-		g2_norm(x_2_times_y_2_to_the_m, x_2_times_y_2_to_the_m);
+	int result_status = RLC_ERR;
 
-		pc_map(pairing_1, signature->sigma_1, x_2_times_y_2_to_the_m);
-		pc_map(pairing_2, signature->sigma_2, g2_gen);
-		if (gt_cmp(pairing_1, pairing_2) == RLC_EQ) {
-			result_status = RLC_OK;
+	bn_t q;
+	bn_t *rhos = NULL;
+	bn_t *rhos_times_m = NULL;
+	g1_t *sigmas_1 = NULL;
+	g1_t *sigmas_2 = NULL;
+	g1_t g1_points[3];
+	g2_t g2_points[3];
+	gt_t pairing;
+
+	bn_null(q);
+	for (int i = 0; i < 3; i++) {
+		g1_null(g1_points[i]);
+		g2_null(g2_points[i]);
+	}
+	gt_null(pairing);
+
+	RLC_TRY {
+		bn_new(q);
+		for (int i = 0; i < 3; i++) {
+			g1_new(g1_points[i]);
+			g2_new(g2_points[i]);
+		}
+		gt_new(pairing);
+
+		rhos = calloc(n, sizeof(bn_t));
+		rhos_times_m = calloc(n, sizeof(bn_t));
+		sigmas_1 = calloc(n, sizeof(g1_t));
+		sigmas_2 = calloc(n, sizeof(g1_t));
+		if (rhos == NULL || rhos_times_m == NULL || sigmas_1 == NULL || sigmas_2 == NULL) {
+			RLC_THROW(ERR_NO_MEMORY);
+		}
+		for (size_t i = 0; i < n; i++) {
+			bn_null(rhos[i]);
+			bn_null(rhos_times_m[i]);
+			g1_null(sigmas_1[i]);
+			g1_null(sigmas_2[i]);
+			bn_new(rhos[i]);
+			bn_new(rhos_times_m[i]);
+			g1_new(sigmas_1[i]);
+			g1_new(sigmas_2[i]);
+		}
+
+		// With random rho_i the N verification equations are combined into
+		//   e(sum rho_i sigma_1_i, X_2) e(sum rho_i m_i sigma_1_i, Y_2)
+		//     e(-sum rho_i sigma_2_i, g_2) = 1,
+		// three multi-scalar multiplications in G1 and one multi-pairing.
+		int valid = 1;
+		pc_get_ord(q);
+		for (size_t i = 0; i < n; i++) {
+			if (g1_is_infty(signatures[i]->sigma_1)) {
+				valid = 0;
+				break;
+			}
+
+			bn_rand(rhos[i], RLC_POS, 128); // a false batch passes with probability 2^-128
+			bn_mul(rhos_times_m[i], rhos[i], messages[i]);
+			bn_mod(rhos_times_m[i], rhos_times_m[i], q);
+			g1_copy(sigmas_1[i], signatures[i]->sigma_1);
+			g1_copy(sigmas_2[i], signatures[i]->sigma_2);
+		}
+
+		if (valid) {
+			g1_mul_sim_lot(g1_points[0], (const g1_t *) sigmas_1, (const bn_t *) rhos, (int) n);
+			g1_mul_sim_lot(g1_points[1], (const g1_t *) sigmas_1, (const bn_t *) rhos_times_m, (int) n);
+			g1_mul_sim_lot(g1_points[2], (const g1_t *) sigmas_2, (const bn_t *) rhos, (int) n);
+			g1_neg(g1_points[2], g1_points[2]);
+
+			g2_copy(g2_points[0], public_key->X_2);
+			g2_copy(g2_points[1], public_key->Y_2);
+			g2_get_gen(g2_points[2]);
+
+			pc_map_sim(pairing, g1_points, g2_points, 3);
+			if (gt_is_unity(pairing)) {
+				result_status = RLC_OK;
+			}
 		}
 	} RLC_CATCH_ANY {
 		result_status = RLC_ERR;
 	} RLC_FINALLY {
-		g2_free(g2_gen);
-		g2_free(y_2_to_the_m);
-		g2_free(x_2_times_y_2_to_the_m);
-		gt_free(pairing_1);
-		gt_free(pairing_2);
+		bn_free(q);
+		for (int i = 0; i < 3; i++) {
+			g1_free(g1_points[i]);
+			g2_free(g2_points[i]);
+		}
+		gt_free(pairing);
+		for (size_t i = 0; rhos != NULL && rhos_times_m != NULL && sigmas_1 != NULL && sigmas_2 != NULL && i < n; i++) {
+			bn_free(rhos[i]);
+			bn_free(rhos_times_m[i]);
+			g1_free(sigmas_1[i]);
+			g1_free(sigmas_2[i]);
+		}
+		free(rhos);
+		free(rhos_times_m);
+		free(sigmas_1);
+		free(sigmas_2);
 	}
 
 	return result_status;
@@ -1110,6 +2206,27 @@ int zk_pedersen_com_verify(const pedersen_com_zk_proof_t proof,
 	return result_status;
 }
 
+// The Fiat-Shamir challenge of a CLDL proof, reduced modulo the soundness bound.
+static void zk_cldl_challenge(bn_t k, const zk_proof_cldl_t proof, const bn_t soundness) {
+	uint8_t serialized[RLC_CLDL_PROOF_T1_SIZE + RLC_CLDL_PROOF_T2_SIZE + RLC_CLDL_PROOF_T3_SIZE];
+	uint8_t hash[RLC_MD_LEN];
+
+	cl_qfi_write_bin(serialized, RLC_CLDL_PROOF_T1_SIZE, proof->t1);
+	ec_write_bin(serialized + RLC_CLDL_PROOF_T1_SIZE, RLC_CLDL_PROOF_T2_SIZE, proof->t2, 1);
+	cl_qfi_write_bin(serialized + RLC_CLDL_PROOF_T1_SIZE + RLC_CLDL_PROOF_T2_SIZE, RLC_CLDL_PROOF_T3_SIZE, proof->t3);
+	md_map(hash, serialized, sizeof(serialized));
+
+	if (8 * RLC_MD_LEN > bn_bits(soundness)) {
+		unsigned len = RLC_CEIL(bn_bits(soundness), 8);
+		bn_read_bin(k, hash, len);
+		bn_rsh(k, k, 8 * RLC_MD_LEN - bn_bits(soundness));
+	} else {
+		bn_read_bin(k, hash, RLC_MD_LEN);
+	}
+
+	bn_mod(k, k, soundness);
+}
+
 int zk_cldl_prove(zk_proof_cldl_t proof,
 									const GEN x,
 									const cl_ciphertext_t ciphertext,
@@ -1133,51 +2250,25 @@ int zk_cldl_prove(zk_proof_cldl_t proof,
 		GEN r1 = randomi(dist);
 		GEN r2 = randomi(params->q);
 
-		bn_read_str(rlc_r2, GENtostr(r2), strlen(GENtostr(r2)), 10);
-		bn_read_str(rlc_soundness, GENtostr(soundness), strlen(GENtostr(soundness)), 10);
+		cl_int_to_bn(rlc_r2, r2);
+		cl_int_to_bn(rlc_soundness, soundness);
 
-		GEN L = Fp_inv(r2, params->q);
-		if (!mpodd(L)) {
-			L = subii(L, params->q);
-		}
-		// f^r_2 = (q^2, Lq, (L - Delta_k) / 4)
-		GEN fr2 = qfi(sqri(params->q), mulii(L, params->q), shifti(subii(sqri(L), params->Delta_K), -2));
+		GEN fr2 = cl_f_pow(r2, params);
 
-		proof->t1 = gmul(nupow(public_key->pk, r1, NULL), fr2); // pk^r_1 \cdot f^r_2
+		proof->t1 = gmul(cl_public_key_pow(public_key, r1, params), fr2); // pk^r_1 \cdot f^r_2
 		ec_mul_gen(proof->t2, rlc_r2);							// g^r_2
-		proof->t3 = nupow(params->g_q, r1, NULL);				// g_q^r_1
-
-		const unsigned SERIALIZED_LEN = RLC_EC_SIZE_COMPRESSED + strlen(GENtostr(proof->t1)) + strlen(GENtostr(proof->t3));
-		uint8_t serialized[SERIALIZED_LEN];
-		uint8_t hash[RLC_MD_LEN];
-
-		memcpy(serialized, (uint8_t *) GENtostr(proof->t1), strlen(GENtostr(proof->t1)));
-		ec_write_bin(serialized + strlen(GENtostr(proof->t1)), RLC_EC_SIZE_COMPRESSED, proof->t2, 1);
-		memcpy(serialized + strlen(GENtostr(proof->t1)) + RLC_EC_SIZE_COMPRESSED, 
-					(uint8_t *) GENtostr(proof->t3), strlen(GENtostr(proof->t3)));
-		md_map(hash, serialized, SERIALIZED_LEN);
+		proof->t3 = cl_fixed_base_pow(params->g_q_table, r1, params->L);				// g_q^r_1
 
-		if (8 * RLC_MD_LEN > bn_bits(rlc_soundness)) {
-			unsigned len = RLC_CEIL(bn_bits(rlc_soundness), 8);
-			bn_read_bin(rlc_k, hash, len);
-			bn_rsh(rlc_k, rlc_k, 8 * RLC_MD_LEN - bn_bits(rlc_soundness));
-		} else {
-			bn_read_bin(rlc_k, hash, RLC_MD_LEN);
-		}
+		zk_cldl_challenge(rlc_k, proof, rlc_soundness);
 
-		bn_mod(rlc_k, rlc_k, rlc_soundness);
-
-		const unsigned K_STR_LEN = bn_size_str(rlc_k, 10);
-		char k_str[K_STR_LEN];
-		bn_write_str(k_str, K_STR_LEN, rlc_k, 10);
-		GEN k = strtoi(k_str);
+		GEN k = cl_int_from_bn(rlc_k);
 
 		proof->u1 = addmulii(r1, ciphertext->r, k);	// r_1 + r \cdot k
 		proof->u2 = Fp_addmul(r2, x, k, params->q); // r_2 + x \cdot k
 	} RLC_CATCH_ANY {
 		result_status = RLC_ERR;
 	} RLC_FINALLY {
-		bn_free(k);
+		bn_free(rlc_k);
 		bn_free(rlc_r2);
 		bn_free(rlc_soundness);
 	}
@@ -1215,49 +2306,28 @@ int zk_cldl_verify(const zk_proof_cldl_t proof,
 
 		// Soundness is 2^-40.
 		GEN soundness = shifti(gen_1, 40);
-		bn_read_str(rlc_soundness, GENtostr(soundness), strlen(GENtostr(soundness)), 10);
-		bn_read_str(rlc_u2, GENtostr(proof->u2), strlen(GENtostr(proof->u2)), 10);
-
-		const unsigned SERIALIZED_LEN = RLC_EC_SIZE_COMPRESSED + strlen(GENtostr(proof->t1)) + strlen(GENtostr(proof->t3));
-		uint8_t serialized[SERIALIZED_LEN];
-		uint8_t hash[RLC_MD_LEN];
-
-		memcpy(serialized, (uint8_t *) GENtostr(proof->t1), strlen(GENtostr(proof->t1)));
-		ec_write_bin(serialized + strlen(GENtostr(proof->t1)), RLC_EC_SIZE_COMPRESSED, proof->t2, 1);
-		memcpy(serialized + strlen(GENtostr(proof->t1)) + RLC_EC_SIZE_COMPRESSED, 
-					(uint8_t *) GENtostr(proof->t3), strlen(GENtostr(proof->t3)));
-		md_map(hash, serialized, SERIALIZED_LEN);
+		cl_int_to_bn(rlc_soundness, soundness);
+		cl_int_to_bn(rlc_u2, proof->u2);
 
-		if (8 * RLC_MD_LEN > bn_bits(rlc_soundness)) {
-			unsigned len = RLC_CEIL(bn_bits(rlc_soundness), 8);
-			bn_read_bin(rlc_k, hash, len);
-			bn_rsh(rlc_k, rlc_k, 8 * RLC_MD_LEN - bn_bits(rlc_soundness));
-		} else {
-			bn_read_bin(rlc_k, hash, RLC_MD_LEN);
-		}
+		zk_cldl_challenge(rlc_k, proof, rlc_soundness);
 
-		bn_mod(rlc_k, rlc_k, rlc_soundness);
+		GEN k = cl_int_from_bn(rlc_k);
 
-		const unsigned K_STR_LEN = bn_size_str(rlc_k, 10);
-		char k_str[K_STR_LEN];
-		bn_write_str(k_str, K_STR_LEN, rlc_k, 10);
-		GEN k = strtoi(k_str);
-
-		GEN L = Fp_inv(proof->u2, params->q);
-		if (!mpodd(L)) {
-			L = subii(L, params->q);
-		}
-		// f^u_2 = (q^2, Lq, (L - Delta_k) / 4)
-		GEN fu2 = qfi(sqri(params->q), mulii(L, params->q), shifti(subii(sqri(L), params->Delta_K), -2));
+		GEN fu2 = cl_f_pow(proof->u2, params);
 
 		ec_mul_gen(g_to_the_u2, rlc_u2);
 		ec_mul(Q_to_the_k, Q, rlc_k);
 		ec_add(t2_times_Q_to_the_k, proof->t2, Q_to_the_k);
 		ec_norm(t2_times_Q_to_the_k, t2_times_Q_to_the_k);
 
-		if (gequal(gmul(proof->t1, nupow(ciphertext->c2, k, NULL)), gmul(nupow(public_key->pk, proof->u1, NULL), fu2))
+		// t1 = pk^u1 * c2^-k * f^u2 and t3 = g_q^u1 * c1^-k.
+		GEN minus_k = negi(k);
+		GEN pk_part = cl_pow_times_pow(public_key->pk_table, public_key->pk, proof->u1, ciphertext->c2, minus_k, params->L);
+		GEN g_q_part = cl_pow_times_pow(params->g_q_table, params->g_q, proof->u1, ciphertext->c1, minus_k, params->L);
+
+		if (gequal(proof->t1, nucomp(pk_part, fu2, params->L))
 		&&  ec_cmp(g_to_the_u2, t2_times_Q_to_the_k) == RLC_EQ
-		&&  gequal(gmul(proof->t3, nupow(ciphertext->c1, k, NULL)), nupow(params->g_q, proof->u1, NULL))) {
+		&&  gequal(proof->t3, g_q_part)) {
 			result_status = RLC_OK;
 		}
 	} RLC_CATCH_ANY {
@@ -1274,6 +2344,140 @@ int zk_cldl_verify(const zk_proof_cldl_t proof,
 	return result_status;
 }
 
+int zk_cldl_batch_verify(const zk_proof_cldl_t *proofs,
+												 const ec_t *Qs,
+												 const cl_ciphertext_t *ciphertexts,
+												 size_t n,
+												 const cl_public_key_t public_key,
+												 const cl_params_t params) {
+	if (n == 0) {
+		return RLC_OK;
+	}
+	if (n == 1) {
+		return zk_cldl_verify(proofs[0], Qs[0], ciphertexts[0], public_key, params);
+	}
+
+	int result_status = RLC_ERR;
+
+	const size_t points_count = (2 * n) + 1;
+	bn_t q, rlc_k, rlc_rho, rlc_u2, rlc_soundness, sum_u2;
+	bn_t *scalars = NULL;
+	ec_t *points = NULL;
+	ec_t R;
+
+	bn_null(q);
+	bn_null(rlc_k);
+	bn_null(rlc_rho);
+	bn_null(rlc_u2);
+	bn_null(rlc_soundness);
+	bn_null(sum_u2);
+	ec_null(R);
+
+	RLC_TRY {
+		bn_new(q);
+		bn_new(rlc_k);
+		bn_new(rlc_rho);
+		bn_new(rlc_u2);
+		bn_new(rlc_soundness);
+		bn_new(sum_u2);
+		ec_new(R);
+
+		scalars = calloc(points_count, sizeof(bn_t));
+		points = calloc(points_count, sizeof(ec_t));
+		if (scalars == NULL || points == NULL) {
+			RLC_THROW(ERR_NO_MEMORY);
+		}
+		for (size_t i = 0; i < points_count; i++) {
+			bn_null(scalars[i]);
+			ec_null(points[i]);
+			bn_new(scalars[i]);
+			ec_new(points[i]);
+		}
+
+		GEN soundness = shifti(gen_1, 40);
+		cl_int_to_bn(rlc_soundness, soundness);
+		ec_curve_get_ord(q);
+		bn_zero(sum_u2);
+
+		// Every proof i is weighted by random rho_i and sigma_i in [1, 2^40]:
+		//   prod t1_i^rho_i * c2_i^(rho_i k_i) * pk^-(sum rho_i u1_i) = f^(sum rho_i u2_i)
+		//   prod t3_i^sigma_i * c1_i^(sigma_i k_i) * g_q^-(sum sigma_i u1_i) = 1
+		//   sum rho_i t2_i + (rho_i k_i) Q_i - (sum rho_i u2_i) g = 0
+		// Both class group equations share one multi-exponentiation, and the
+		// elliptic curve one is a single multi-scalar multiplication.
+		GEN bases = cgetg((4 * n) + 3, t_VEC);
+		GEN exponents = cgetg((4 * n) + 3, t_VEC);
+		GEN sum_rho_u1 = gen_0;
+		GEN sum_sigma_u1 = gen_0;
+
+		for (size_t i = 0; i < n; i++) {
+			zk_cldl_challenge(rlc_k, proofs[i], rlc_soundness);
+			GEN k = cl_int_from_bn(rlc_k);
+			GEN rho = addiu(randomi(soundness), 1);
+			GEN sigma = addiu(randomi(soundness), 1);
+
+			gel(bases, (4 * i) + 1) = proofs[i]->t1;
+			gel(exponents, (4 * i) + 1) = rho;
+			gel(bases, (4 * i) + 2) = ciphertexts[i]->c2;
+			gel(exponents, (4 * i) + 2) = mulii(rho, k);
+			gel(bases, (4 * i) + 3) = proofs[i]->t3;
+			gel(exponents, (4 * i) + 3) = sigma;
+			gel(bases, (4 * i) + 4) = ciphertexts[i]->c1;
+			gel(exponents, (4 * i) + 4) = mulii(sigma, k);
+
+			sum_rho_u1 = addmulii(sum_rho_u1, rho, proofs[i]->u1);
+			sum_sigma_u1 = addmulii(sum_sigma_u1, sigma, proofs[i]->u1);
+
+			cl_int_to_bn(rlc_rho, rho);
+			cl_int_to_bn(rlc_u2, proofs[i]->u2);
+			ec_copy(points[i], proofs[i]->t2);
+			bn_copy(scalars[i], rlc_rho);
+			ec_copy(points[n + i], Qs[i]);
+			bn_mul(scalars[n + i], rlc_rho, rlc_k);
+			bn_mod(scalars[n + i], scalars[n + i], q);
+			bn_mul(rlc_u2, rlc_u2, rlc_rho);
+			bn_add(sum_u2, sum_u2, rlc_u2);
+			bn_mod(sum_u2, sum_u2, q);
+		}
+
+		gel(bases, (4 * n) + 1) = public_key->pk;
+		gel(exponents, (4 * n) + 1) = negi(sum_rho_u1);
+		gel(bases, (4 * n) + 2) = params->g_q;
+		gel(exponents, (4 * n) + 2) = negi(sum_sigma_u1);
+
+		GEN sum_rho_u2 = cl_int_from_bn(sum_u2);
+		GEN f_to_the_sum_u2 = signe(sum_rho_u2) == 0 ? qfi_1(params->g_q) : cl_f_pow(sum_rho_u2, params);
+
+		ec_curve_get_gen(points[2 * n]);
+		bn_sub(scalars[2 * n], q, sum_u2);
+		bn_mod(scalars[2 * n], scalars[2 * n], q);
+		ec_mul_sim_lot(R, (const ec_t *) points, (const bn_t *) scalars, (int) points_count);
+
+		if (ec_is_infty(R)
+		&&  gequal(cl_multi_pow(bases, exponents, params->L), f_to_the_sum_u2)) {
+			result_status = RLC_OK;
+		}
+	} RLC_CATCH_ANY {
+		result_status = RLC_ERR;
+	} RLC_FINALLY {
+		bn_free(q);
+		bn_free(rlc_k);
+		bn_free(rlc_rho);
+		bn_free(rlc_u2);
+		bn_free(rlc_soundness);
+		bn_free(sum_u2);
+		ec_free(R);
+		for (size_t i = 0; scalars != NULL && points != NULL && i < points_count; i++) {
+			bn_free(scalars[i]);
+			ec_free(points[i]);
+		}
+		free(scalars);
+		free(points);
+	}
+
+	return result_status;
+}
+
 int zk_dlog_prove(zk_proof_t proof, const ec_t h, const bn_t w) {
 	int result_status = RLC_OK;
 